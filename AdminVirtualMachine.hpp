@@ -1,8 +1,11 @@
 #pragma once
 
+#include <capnp/serialize.h>
 #include <chrono>
 #include "Database/Database.h"
 #include "CollabVm.capnp.h"
+#include "CpuPool.hpp"
+#include "GuacamoleScreenshot.hpp"
 #include "IPData.hpp"
 #include "TurnController.hpp"
 #include "VoteController.hpp"
@@ -27,7 +30,9 @@ struct AdminVirtualMachine
                          id,
                          io_context,
                          initial_settings,
-                         admin_vm_info),
+                         admin_vm_info,
+                         server.GetVoteStatusInterval(),
+                         server.GetInputEventsFlushInterval()),
                        server_(server)
   {
   }
@@ -105,7 +110,7 @@ struct AdminVirtualMachine
         [instructions = std::move(instructions)]
         (const auto&, auto& user)
         {
-          user.QueueMessageBatch([instructions](auto enqueue)
+          user.QueueGuacamoleInstructions([instructions](auto enqueue)
           {
             for (auto& instruction : *instructions)
             {
@@ -116,6 +121,36 @@ struct AdminVirtualMachine
       });
   }
 
+  /**
+   * Sends the current display to a user in the channel, like when it stops
+   * playing a recording.
+   */
+  void SendDisplay(std::shared_ptr<TClient> user) {
+    state_.dispatch([user = std::move(user)](auto& state) {
+      if (!state.GetUserData(user).has_value()) {
+        return;
+      }
+      auto messages = std::make_shared<std::vector<std::shared_ptr<SocketMessage>>>();
+      state.guacamole_client_.AddUser(
+        [&messages](capnp::MallocMessageBuilder&& message_builder)
+        {
+          auto& socket_message = messages->emplace_back(SocketMessage::CreateShared());
+          socket_message->GetMessageBuilder()
+                        .initRoot<CollabVmServerMessage>()
+                        .initMessage()
+                        .setGuacInstr(
+                          message_builder.getRoot<Guacamole::GuacServerInstruction>());
+        });
+      user->QueueMessageBatch([messages](auto queue_message)
+        {
+          for (auto& message : *messages)
+          {
+            queue_message(message);
+          }
+        });
+      });
+  }
+
   template<typename TCallback>
   void SetRecordingSettings(TCallback&& callback) {
     state_.dispatch([callback = std::forward<TCallback>(callback)](auto& state) {
@@ -140,12 +175,15 @@ struct AdminVirtualMachine
       const std::uint32_t id,
       boost::asio::io_context& io_context,
       capnp::List<VmSetting>::Reader initial_settings,
-      CollabVmServerMessage::AdminVmInfo::Builder admin_vm_info)
+      CollabVmServerMessage::AdminVmInfo::Builder admin_vm_info,
+      std::chrono::milliseconds vote_status_interval,
+      std::chrono::milliseconds input_events_flush_interval)
       : VmTurnController(strand),
-        VmVoteController(strand),
-        VmUserChannel(id),
-        VmRecording(strand, id),
+        VmVoteController(strand, vote_status_interval),
+        VmUserChannel(strand, id),
+        VmRecording(strand, id, input_events_flush_interval),
         connect_delay_timer_(strand),
+        turn_queue_timer_(strand),
         message_builder_(std::make_unique<capnp::MallocMessageBuilder>()),
         settings_(GetInitialSettings(initial_settings)),
         guacamole_client_(strand, admin_vm),
@@ -284,6 +322,11 @@ struct AdminVirtualMachine
           QueueMessage(std::forward<decltype(socket_message)>(socket_message));
         });
       }
+      template<typename TCallback>
+      void QueueGuacamoleInstructions(TCallback&& callback)
+      {
+        QueueMessageBatch(std::forward<TCallback>(callback));
+      }
       VmRecording& recording_;
       typename TClient::UserData user_data;
     } recording_user_ = {*this};
@@ -325,40 +368,48 @@ struct AdminVirtualMachine
       if (!user_data.has_value()) {
         return;
       }
-      const auto votes_changed =
-        VmVoteController::RemoveVote(user_data->get().vote_data);
-      if (votes_changed) {
-          VmUserChannel::BroadcastMessage(GetVoteStatus());
-      }
+      VmVoteController::RemoveVote(user_data->get().vote_data);
     }
 
-    void OnCurrentUserChanged(
-        const std::deque<std::shared_ptr<TClient>>& users_queue,
-        std::chrono::milliseconds time_remaining) override {
-      BroadcastTurnQueue(users_queue, time_remaining);
+    void OnCurrentUserChanged(std::chrono::milliseconds time_remaining) override {
+      // The pending changes are included in this broadcast
+      turn_queue_timer_.cancel();
+      turn_queue_broadcast_pending_ = false;
+      VmUserChannel::BroadcastMessage(GetTurnQueue());
     }
 
-    void OnUserAdded(
-        const std::deque<std::shared_ptr<TClient>>& users_queue,
-        std::chrono::milliseconds time_remaining) override {
-      BroadcastTurnQueue(users_queue, time_remaining);
+    void OnUserAdded(const std::shared_ptr<TClient>& user,
+                     std::size_t position,
+                     std::chrono::milliseconds time_remaining) override {
+      QueueTurnQueueBroadcast();
     }
 
-    void OnUserRemoved(
-        const std::deque<std::shared_ptr<TClient>>& users_queue,
-        std::chrono::milliseconds time_remaining) override {
-      BroadcastTurnQueue(users_queue, time_remaining);
+    void OnUserRemoved(const std::shared_ptr<TClient>& user,
+                       std::size_t position,
+                       std::chrono::milliseconds time_remaining) override {
+      QueueTurnQueueBroadcast();
     }
 
-    void BroadcastTurnQueue(
-        const std::deque<std::shared_ptr<TClient>>& users_queue,
-        std::chrono::milliseconds time_remaining) {
-      VmUserChannel::BroadcastMessage(GetTurnQueue());
+    // Changes behind the current user don't affect who has control, so
+    // they are combined into one broadcast to avoid sending the whole queue
+    // to every viewer each time someone joins or leaves it
+    void QueueTurnQueueBroadcast() {
+      if (turn_queue_broadcast_pending_) {
+        return;
+      }
+      turn_queue_broadcast_pending_ = true;
+      turn_queue_timer_.expires_after(turn_queue_broadcast_interval);
+      turn_queue_timer_.async_wait([this](const auto error_code) {
+        if (error_code || !turn_queue_broadcast_pending_) {
+          return;
+        }
+        turn_queue_broadcast_pending_ = false;
+        VmUserChannel::BroadcastMessage(GetTurnQueue());
+      });
     }
 
     [[nodiscard]]
     std::shared_ptr<SocketMessage> GetTurnQueue() const {
-      const auto& users_queue = VmTurnController::GetTurnQueue();
       auto message = SocketMessage::CreateShared();
       auto vm_turn_info =
         message->GetMessageBuilder().initRoot<CollabVmServerMessage>()
@@ -370,15 +421,16 @@ struct AdminVirtualMachine
           : CollabVmServerMessage::TurnState::ENABLED
         : CollabVmServerMessage::TurnState::DISABLED);
       vm_turn_info.setTimeRemaining(VmTurnController::GetTimeRemaining().count());
-      auto users_list = vm_turn_info.initUsers(users_queue.size());
+      auto users_list =
+        vm_turn_info.initUsers(VmTurnController::GetTurnQueueSize());
       auto i = 0u;
-      const auto& channel_users = VmUserChannel::GetUsers();
-      for (const auto& user_in_queue : users_queue) {
-        if (const auto channel_user = channel_users.find(user_in_queue);
-            channel_user != channel_users.end()) {
-          users_list.set(i++, channel_user->second.username);
-        }
-      }
+      VmTurnController::ForEachUserInQueue(
+        [this, &users_list, &i](const auto& user_in_queue) {
+          if (const auto user_data = VmUserChannel::GetUserData(user_in_queue);
+              user_data.has_value()) {
+            users_list.set(i++, user_data->get().username);
+          }
+        });
       return message;
     }
 
@@ -536,7 +588,7 @@ struct AdminVirtualMachine
           && !user_data->get().IsRegistered()) {
         return;
       }
-      auto& ip_data_has_voted = user_data->get().ip_data.voted;
+      auto& ip_data_has_voted = user_data->get().ip_data->voted;
       if (ip_data_has_voted) {
         return;
       }
@@ -544,12 +596,16 @@ struct AdminVirtualMachine
         VmVoteController::AddVote(user_data->get().vote_data, voted_yes);
       if (vote_counted) {
         ip_data_has_voted = true;
-        VmUserChannel::BroadcastMessage(GetVoteStatus());
       }
-    }
+    }
 
-    void OnVoteStart()
+    void OnVoteStart()
+    {
+    }
+
+    void OnVoteStatusChanged()
     {
+      VmUserChannel::BroadcastMessage(GetVoteStatus());
     }
 
     void OnVoteEnd(bool vote_passed)
@@ -573,7 +629,7 @@ struct AdminVirtualMachine
           if constexpr (
             !std::is_same_v<std::decay_t<decltype(user_data)>, typename TClient::UserData>)
           {
-            user_data.ip_data.voted = false;
+            user_data.ip_data->voted = false;
           }
           socket.QueueMessage(message);
         });
@@ -610,12 +666,23 @@ struct AdminVirtualMachine
     {
       admin_vm_.server_.GetDatabase().SetRecordingStartTime(
         VmUserChannel::GetId(), VmRecording::GetFilename(), time);
+      admin_vm_.server_.GetRecordingIndex().AddRecording(
+        VmUserChannel::GetId(), VmRecording::GetFilename(), time);
     }
 
     void OnRecordingStopped(std::chrono::time_point<std::chrono::system_clock> time)
     {
       admin_vm_.server_.GetDatabase().SetRecordingStopTime(
         VmUserChannel::GetId(), VmRecording::GetFilename(), time);
+      admin_vm_.server_.GetRecordingIndex().SetStopTime(
+        VmUserChannel::GetId(), VmRecording::GetFilename(), time);
+    }
+
+    void OnKeyframeAdded(std::uint64_t file_offset, std::uint64_t timestamp)
+    {
+      admin_vm_.server_.GetRecordingIndex().AddKeyframe(
+        VmUserChannel::GetId(), VmRecording::GetFilename(),
+        file_offset, timestamp);
     }
 
     void OnKeyframeInRecording()
@@ -641,6 +708,10 @@ struct AdminVirtualMachine
     bool active_ = false;
     bool connected_ = false;
     boost::asio::steady_timer connect_delay_timer_;
+    constexpr static auto turn_queue_broadcast_interval =
+      std::chrono::milliseconds(500);
+    boost::asio::steady_timer turn_queue_timer_;
+    bool turn_queue_broadcast_pending_ = false;
     std::size_t viewer_count_ = 0;
     std::unique_ptr<capnp::MallocMessageBuilder> message_builder_;
     capnp::List<VmSetting>::Builder settings_;
@@ -768,7 +839,7 @@ struct AdminVirtualMachine
         return;
       }
 
-      state.viewer_count_ = state.GetUsers().size();
+      state.viewer_count_ = state.GetUserCount();
 
       auto vm_info = set_vm_info.InitVmInfo();
       vm_info.setId(state.GetId());
@@ -783,16 +854,37 @@ struct AdminVirtualMachine
       vm_info.setSafeForWork(state.GetSetting(VmSetting::Setting::SAFE_FOR_WORK).getSafeForWork());
       vm_info.setViewerCount(state.viewer_count_);
 
-      auto png = std::vector<std::byte>();
-      png.reserve(100 * 1'024);
-      const auto created_screenshot =
-        state.guacamole_client_.CreateScreenshot([&png](auto png_bytes)
+      auto instructions =
+        state.guacamole_client_.CopyScreenshotInstructions();
+      if (instructions.empty()) {
+        return;
+      }
+      // The screenshot is drawn and encoded on the CPU pool, and the VM info
+      // is sent to the server when set_vm_info is destroyed, with or without
+      // a thumbnail if the pool is busy
+      server_.cpu_pool_.TryPost(CpuPool::Priority::Background,
+        [instructions = std::move(instructions),
+         set_vm_info = std::move(set_vm_info)]() mutable
         {
-          png.insert(png.end(), png_bytes.begin(), png_bytes.end());
+          auto screenshot = GuacamoleScreenshot();
+          for (const auto& instruction : instructions) {
+            auto reader = capnp::FlatArrayMessageReader(instruction);
+            screenshot.WriteInstruction(
+              reader.getRoot<Guacamole::GuacServerInstruction>());
+          }
+          auto png = std::vector<std::byte>();
+          png.reserve(100 * 1'024);
+          const auto created_screenshot = screenshot.CreateScreenshot(
+            GuacamoleScreenshot::thumbnail_size,
+            GuacamoleScreenshot::thumbnail_size,
+            [&png](auto png_bytes)
+            {
+              png.insert(png.end(), png_bytes.begin(), png_bytes.end());
+            });
+          if (created_screenshot) {
+            set_vm_info.SetThumbnail(std::move(png));
+          }
         });
-      if (created_screenshot) {
-        set_vm_info.SetThumbnail(std::move(png));
-      }
     });
   }
 
@@ -894,7 +986,7 @@ private:
         [&messages]
         (const auto&, auto& user)
         {
-          user.QueueMessageBatch(
+          user.QueueGuacamoleInstructions(
             [&messages](auto queue_message)
             {
               for (auto& message : messages)
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace CollabVm::Server {
+/**
+ * Finds banned phrases in chat messages with an Aho-Corasick automaton.
+ * The automaton is compiled into a table with a transition for every state
+ * and input byte, so matching a message is one table lookup per byte
+ * regardless of the number of phrases, and it never allocates.
+ * Bytes are mapped to classes before the lookup: bytes that aren't in any
+ * phrase share a class, and ASCII letters are matched case-insensitively.
+ */
+class ChatFilter {
+public:
+  enum class Action : std::uint8_t {
+    // The message isn't sent to anyone
+    Drop,
+    // The banned phrases are replaced with asterisks
+    Mask,
+    // The message is sent but logged for the admins
+    Flag
+  };
+
+  explicit ChatFilter(const std::vector<std::string>& phrases) {
+    classes_.fill(0);
+    for (const auto& phrase : phrases) {
+      for (const auto c : phrase) {
+        auto& byte_class = classes_[Fold(c)];
+        if (!byte_class) {
+          byte_class = class_count_++;
+        }
+      }
+    }
+    for (auto c = 0u; c < classes_.size(); c++) {
+      classes_[c] = classes_[Fold(static_cast<char>(c))];
+    }
+
+    // Build the trie, with absent transitions marked as none
+    constexpr auto none = std::numeric_limits<std::uint32_t>::max();
+    transitions_.assign(class_count_, none);
+    match_lengths_.assign(1, 0);
+    for (const auto& phrase : phrases) {
+      if (phrase.empty()) {
+        continue;
+      }
+      auto state = std::uint32_t(0);
+      for (const auto c : phrase) {
+        auto& next_state = transitions_[state * class_count_ + GetClass(c)];
+        if (next_state == none) {
+          next_state = static_cast<std::uint32_t>(match_lengths_.size());
+          transitions_.resize(transitions_.size() + class_count_, none);
+          match_lengths_.push_back(0);
+        }
+        // The reference may have been invalidated by the resize
+        state = transitions_[state * class_count_ + GetClass(c)];
+      }
+      match_lengths_[state] = static_cast<std::uint16_t>(
+        std::min<std::size_t>(phrase.size(),
+                              std::numeric_limits<std::uint16_t>::max()));
+    }
+
+    // Replace the absent transitions with the transitions of the failure
+    // states in breadth-first order, so every state has a transition for
+    // every class and the failure links are no longer needed
+    auto failure_states = std::vector<std::uint32_t>(match_lengths_.size(), 0);
+    auto states = std::queue<std::uint32_t>();
+    for (auto byte_class = 0u; byte_class < class_count_; byte_class++) {
+      auto& next_state = transitions_[byte_class];
+      if (next_state == none) {
+        next_state = 0;
+      } else {
+        states.push(next_state);
+      }
+    }
+    while (!states.empty()) {
+      const auto state = states.front();
+      states.pop();
+      const auto failure_state = failure_states[state];
+      match_lengths_[state] =
+        std::max(match_lengths_[state], match_lengths_[failure_state]);
+      for (auto byte_class = 0u; byte_class < class_count_; byte_class++) {
+        auto& next_state = transitions_[state * class_count_ + byte_class];
+        const auto failure_transition =
+          transitions_[failure_state * class_count_ + byte_class];
+        if (next_state == none) {
+          next_state = failure_transition;
+        } else {
+          failure_states[next_state] = failure_transition;
+          states.push(next_state);
+        }
+      }
+    }
+    // Store the offsets of the rows so the lookup doesn't need to multiply,
+    // and flag the transitions into states that end a phrase so the lengths
+    // are only looked up when there's a match
+    for (auto& next_state : transitions_) {
+      next_state = next_state * class_count_
+                   | (match_lengths_[next_state] ? match_flag : 0);
+    }
+  }
+
+  /**
+   * Reads a phrase from each line of a file, ignoring blank lines and lines
+   * starting with '#'.
+   * @returns nullptr if the file can't be read.
+   */
+  static std::shared_ptr<const ChatFilter> ReadFile(
+      const std::filesystem::path& path) {
+    auto file = std::ifstream(path);
+    if (!file) {
+      return nullptr;
+    }
+    auto phrases = std::vector<std::string>();
+    auto line = std::string();
+    while (std::getline(file, line)) {
+      const auto begin = line.find_first_not_of(" \t");
+      const auto end = line.find_last_not_of(" \t\r");
+      if (begin == std::string::npos || line[begin] == '#') {
+        continue;
+      }
+      phrases.emplace_back(line, begin, end - begin + 1);
+    }
+    return std::make_shared<const ChatFilter>(phrases);
+  }
+
+  [[nodiscard]]
+  bool Contains(std::string_view text) const {
+    auto state = std::uint32_t(0);
+    for (const auto c : text) {
+      state = transitions_[state + GetClass(c)];
+      if (state & match_flag) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Replaces the bytes of every banned phrase in the text with asterisks.
+   * @returns Whether any phrase was found.
+   */
+  bool Mask(char* text, std::size_t length) const {
+    auto state = std::uint32_t(0);
+    auto found = false;
+    // The end of the bytes that have already been masked
+    auto masked_end = std::size_t(0);
+    for (auto i = std::size_t(0); i < length; i++) {
+      state = transitions_[state + GetClass(text[i])];
+      if (state & match_flag) {
+        state &= ~match_flag;
+        const auto match_length = match_lengths_[state / class_count_];
+        std::fill(text + std::max(i + 1 - match_length, masked_end),
+                  text + i + 1, '*');
+        masked_end = i + 1;
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  [[nodiscard]]
+  std::size_t GetStateCount() const {
+    return match_lengths_.size();
+  }
+
+private:
+  static std::uint8_t Fold(char c) {
+    const auto byte = static_cast<std::uint8_t>(c);
+    return byte >= 'A' && byte <= 'Z' ? byte - 'A' + 'a' : byte;
+  }
+
+  std::uint32_t GetClass(char c) const {
+    return classes_[static_cast<std::uint8_t>(c)];
+  }
+
+  constexpr static auto match_flag = std::uint32_t(1) << 31;
+  // Class 0 is for bytes that aren't in any phrase
+  std::array<std::uint8_t, 256> classes_;
+  std::uint32_t class_count_ = 1;
+  std::vector<std::uint32_t> transitions_;
+  // The length of the longest phrase that ends at each state, or zero
+  std::vector<std::uint16_t> match_lengths_;
+};
+
+/**
+ * A chat filter that is read from a file and reloaded whenever the file is
+ * modified. The current filter can be used from any thread.
+ */
+class ChatFilterFile {
+public:
+  ChatFilterFile(boost::asio::io_context& io_context,
+                 std::filesystem::path path,
+                 ChatFilter::Action action)
+    : timer_(io_context),
+      path_(std::move(path)),
+      action_(action) {
+  }
+
+  void Start() {
+    if (path_.empty()) {
+      return;
+    }
+    Reload();
+  }
+
+  void Stop() {
+    timer_.cancel();
+  }
+
+  /**
+   * @returns The current filter, or nullptr if there isn't one.
+   */
+  [[nodiscard]]
+  std::shared_ptr<const ChatFilter> GetFilter() const {
+    return std::atomic_load(&filter_);
+  }
+
+  [[nodiscard]]
+  ChatFilter::Action GetAction() const {
+    return action_;
+  }
+
+private:
+  void Reload() {
+    auto error_code = std::error_code();
+    const auto write_time =
+      std::filesystem::last_write_time(path_, error_code);
+    if (!error_code && write_time != write_time_) {
+      if (auto filter = ChatFilter::ReadFile(path_)) {
+        write_time_ = write_time;
+        std::cout << "Loaded chat filter '" << path_.string() << "' ("
+                  << filter->GetStateCount() << " states)" << std::endl;
+        std::atomic_store(&filter_, std::move(filter));
+      }
+    }
+    timer_.expires_after(reload_interval);
+    timer_.async_wait([this](const auto error_code) {
+      if (!error_code) {
+        Reload();
+      }
+    });
+  }
+
+  constexpr static auto reload_interval = std::chrono::seconds(10);
+  boost::asio::steady_timer timer_;
+  const std::filesystem::path path_;
+  const ChatFilter::Action action_;
+  std::filesystem::file_time_type write_time_;
+  std::shared_ptr<const ChatFilter> filter_;
+};
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "CollabVm.capnp.h"
+
+namespace CollabVm::Server {
+/**
+ * A ring of the most recent chat messages that only uses as many bytes as
+ * the messages contain. The text of every message is appended to a single
+ * arena and located using a table of offsets. The text of messages that
+ * were evicted is reclaimed when it makes up more than half of the arena,
+ * so the arena is never more than twice the size of the live messages.
+ */
+template<std::size_t MaxMessages>
+class ChatHistory {
+public:
+  struct Entry {
+    std::uint32_t offset;
+    std::uint16_t sender_length;
+    std::uint16_t message_length;
+    CollabVmServerMessage::UserType user_type;
+    std::uint64_t timestamp;
+  };
+
+  void Add(std::string_view sender,
+           std::string_view message,
+           CollabVmServerMessage::UserType user_type,
+           std::uint64_t timestamp) {
+    sender = sender.substr(0, max_text_length);
+    message = message.substr(0, max_text_length);
+    auto entry = Entry{
+      0,
+      static_cast<std::uint16_t>(sender.size()),
+      static_cast<std::uint16_t>(message.size()),
+      user_type,
+      timestamp
+    };
+    if (entries_.size() < MaxMessages) {
+      entries_.push_back(entry);
+    } else {
+      // Replace the oldest message
+      auto& oldest_entry = entries_[first_];
+      dead_bytes_ += GetSize(oldest_entry);
+      oldest_entry.sender_length = 0;
+      oldest_entry.message_length = 0;
+      if (dead_bytes_ > arena_.size() / 2) {
+        Compact();
+      }
+      oldest_entry = entry;
+      first_ = (first_ + 1) % MaxMessages;
+    }
+    auto& new_entry = entries_[(first_ + entries_.size() - 1) % entries_.size()];
+    new_entry.offset = static_cast<std::uint32_t>(arena_.size());
+    arena_.insert(arena_.end(), sender.begin(), sender.end());
+    arena_.insert(arena_.end(), message.begin(), message.end());
+  }
+
+  [[nodiscard]]
+  std::size_t GetCount() const {
+    return entries_.size();
+  }
+
+  /**
+   * Invokes the callback with the sender, message, user type, and timestamp
+   * of every message from oldest to newest, optionally limited to the
+   * messages in the range [begin, end).
+   */
+  template<typename TCallback>
+  void ForEach(TCallback&& callback,
+               std::size_t begin = 0,
+               std::size_t end = SIZE_MAX) const {
+    end = std::min(end, entries_.size());
+    for (auto i = begin; i < end; i++) {
+      const auto& entry = entries_[(first_ + i) % entries_.size()];
+      const auto text = arena_.data() + entry.offset;
+      callback(std::string_view(text, entry.sender_length),
+               std::string_view(text + entry.sender_length, entry.message_length),
+               entry.user_type,
+               entry.timestamp);
+    }
+  }
+
+  /**
+   * @returns The number of bytes allocated for the messages.
+   */
+  [[nodiscard]]
+  std::size_t GetMemoryUsage() const {
+    return arena_.capacity() + entries_.capacity() * sizeof(Entry);
+  }
+
+private:
+  constexpr static std::size_t max_text_length = UINT16_MAX;
+
+  static std::size_t GetSize(const Entry& entry) {
+    return entry.sender_length + entry.message_length;
+  }
+
+  /**
+   * Moves the text of the live messages to the beginning of the arena.
+   * The text is already in the same order as the messages because it's
+   * always appended.
+   */
+  void Compact() {
+    auto offset = std::size_t(0);
+    for (auto i = std::size_t(0); i < entries_.size(); i++) {
+      auto& entry = entries_[(first_ + i) % entries_.size()];
+      const auto size = GetSize(entry);
+      std::memmove(arena_.data() + offset, arena_.data() + entry.offset, size);
+      entry.offset = static_cast<std::uint32_t>(offset);
+      offset += size;
+    }
+    arena_.resize(offset);
+    dead_bytes_ = 0;
+  }
+
+  std::vector<char> arena_;
+  std::vector<Entry> entries_;
+  // Index of the oldest message in entries_
+  std::size_t first_ = 0;
+  std::size_t dead_bytes_ = 0;
+};
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#define MODERN_SQLITE_STD_OPTIONAL_SUPPORT
+#include <sqlite_modern_cpp.h>
+
+namespace CollabVm::Server {
+/**
+ * A persistent log of every chat message that can be searched by admins.
+ * Messages are written by a background thread in batches: every message
+ * that arrives while a batch is being written is part of the next one.
+ * Appending only takes a short lock and never waits for the database.
+ * Searches run on another thread with a read-only connection, so they never
+ * delay the writer. The log is kept in its own database with an FTS5 index
+ * for the text.
+ */
+class ChatLog {
+public:
+  struct Message {
+    std::uint64_t id;
+    // Seconds since the Unix epoch
+    std::uint64_t timestamp;
+    std::uint32_t channel_id;
+    std::string username;
+    std::vector<std::byte> ip_address;
+    std::string message;
+  };
+
+  struct Query {
+    std::optional<std::string> username;
+    std::optional<std::vector<std::byte>> ip_address;
+    std::optional<std::uint32_t> channel_id;
+    std::optional<std::uint64_t> start_time;
+    std::optional<std::uint64_t> stop_time;
+    std::string text;
+    // Only messages older than this ID are returned, so the ID of the last
+    // result is used to get the next page
+    std::uint64_t before_id = 0;
+    std::uint32_t count = 20;
+  };
+
+  constexpr static std::uint32_t max_results = 100;
+
+  explicit ChatLog(const std::string& file_path)
+    : db_(file_path),
+      thread_pool_(1),
+      search_thread_pool_(1) {
+    db_ << "PRAGMA journal_mode = WAL";
+    db_ << "PRAGMA synchronous = NORMAL";
+    db_ <<
+      "CREATE TABLE IF NOT EXISTS ChatMessage ("
+      "  Id INTEGER NOT NULL PRIMARY KEY,"
+      "  Timestamp INTEGER NOT NULL,"
+      "  ChannelId INTEGER NOT NULL,"
+      "  Username TEXT NOT NULL,"
+      "  IpAddress BLOB(16) NOT NULL,"
+      "  Message TEXT NOT NULL)";
+    // IDs increase with time, so every filter is combined with the ID
+    // to read a page in order
+    db_ << "CREATE INDEX IF NOT EXISTS ChatMessageUsername"
+           "  ON ChatMessage (Username COLLATE NOCASE, Id)";
+    db_ << "CREATE INDEX IF NOT EXISTS ChatMessageIpAddress"
+           "  ON ChatMessage (IpAddress, Id)";
+    db_ << "CREATE INDEX IF NOT EXISTS ChatMessageChannelId"
+           "  ON ChatMessage (ChannelId, Id)";
+    db_ << "CREATE INDEX IF NOT EXISTS ChatMessageTimestamp"
+           "  ON ChatMessage (Timestamp)";
+    try {
+      db_ <<
+        "CREATE VIRTUAL TABLE IF NOT EXISTS ChatMessageText USING fts5("
+        "  Message, content = 'ChatMessage', content_rowid = 'Id')";
+    } catch (const sqlite::sqlite_exception&) {
+      std::cout << "Warning: SQLite was built without FTS5, "
+                   "searching the chat log will be slow" << std::endl;
+      full_text_search_ = false;
+    }
+    auto config = sqlite::sqlite_config();
+    config.flags = sqlite::OpenFlags::READONLY;
+    read_db_.emplace(file_path, config);
+  }
+
+  void Append(std::uint32_t channel_id,
+              std::string username,
+              std::vector<std::byte> ip_address,
+              std::string message,
+              std::uint64_t timestamp) {
+    const auto lock = std::lock_guard(mutex_);
+    if (pending_messages_.size() >= max_pending_messages) {
+      // The writer has fallen behind
+      dropped_messages_++;
+      return;
+    }
+    pending_messages_.push_back({0, timestamp, channel_id, std::move(username),
+                                 std::move(ip_address), std::move(message)});
+    if (!write_pending_) {
+      write_pending_ = true;
+      boost::asio::post(thread_pool_, [this] { WritePendingMessages(); });
+    }
+  }
+
+  /**
+   * Searches the log on the search thread and invokes the callback there
+   * with the results, newest first.
+   */
+  template<typename TCallback>
+  void Search(Query query, TCallback&& callback) {
+    boost::asio::post(search_thread_pool_,
+      [this, query = std::move(query),
+       callback = std::forward<TCallback>(callback)]() mutable {
+        auto messages = std::vector<Message>();
+        try {
+          messages = Read(query);
+        } catch (const sqlite::sqlite_exception& exception) {
+          std::cout << "Failed to search the chat log: "
+                    << exception.what() << std::endl;
+        }
+        callback(std::move(messages));
+      });
+  }
+
+  /**
+   * Waits for the pending messages to be written.
+   */
+  void Stop() {
+    thread_pool_.join();
+    search_thread_pool_.join();
+  }
+
+private:
+  void WritePendingMessages() {
+    auto messages = std::vector<Message>();
+    auto dropped_messages = std::uint32_t(0);
+    {
+      const auto lock = std::lock_guard(mutex_);
+      messages.swap(pending_messages_);
+      std::swap(dropped_messages, dropped_messages_);
+      write_pending_ = false;
+    }
+    if (dropped_messages) {
+      std::cout << "Dropped " << dropped_messages
+                << " chat message(s) from the chat log" << std::endl;
+    }
+    try {
+      db_ << "BEGIN";
+      auto insert_message = db_ <<
+        "INSERT INTO ChatMessage"
+        "  (Timestamp, ChannelId, Username, IpAddress, Message)"
+        "  VALUES (?, ?, ?, ?, ?)";
+      auto insert_text = db_ <<
+        "INSERT INTO ChatMessageText (rowid, Message) VALUES (?, ?)";
+      for (const auto& message : messages) {
+        insert_message << message.timestamp << message.channel_id
+                       << message.username << message.ip_address
+                       << message.message;
+        insert_message++;
+        if (full_text_search_) {
+          insert_text << db_.last_insert_rowid() << message.message;
+          insert_text++;
+        }
+      }
+      db_ << "COMMIT";
+    } catch (const sqlite::sqlite_exception& exception) {
+      std::cout << "Failed to write to the chat log: "
+                << exception.what() << std::endl;
+      try {
+        db_ << "ROLLBACK";
+      } catch (const sqlite::sqlite_exception&) {
+      }
+    }
+  }
+
+  /**
+   * Full-text searches start from the FTS5 index and read its matches in
+   * descending order, so a page only reads the matches that are returned
+   * or filtered out rather than every match in the log.
+   */
+  std::vector<Message> Read(const Query& query) {
+    const auto use_full_text_search = full_text_search_ && !query.text.empty();
+    const auto id_column = use_full_text_search
+                             ? std::string("ChatMessageText.rowid")
+                             : std::string("ChatMessage.Id");
+    auto sql = std::string(
+      "SELECT ChatMessage.Id, ChatMessage.Timestamp, ChatMessage.ChannelId,"
+      "  ChatMessage.Username, ChatMessage.IpAddress, ChatMessage.Message");
+    sql += use_full_text_search
+      ? " FROM ChatMessageText JOIN ChatMessage"
+        "  ON ChatMessage.Id = ChatMessageText.rowid"
+        "  WHERE ChatMessageText MATCH ?"
+      : " FROM ChatMessage WHERE 1";
+    if (query.before_id) {
+      sql += " AND " + id_column + " < ?";
+    }
+    if (query.username) {
+      sql += " AND ChatMessage.Username = ? COLLATE NOCASE";
+    }
+    if (query.ip_address) {
+      sql += " AND ChatMessage.IpAddress = ?";
+    }
+    if (query.channel_id) {
+      sql += " AND ChatMessage.ChannelId = ?";
+    }
+    if (query.start_time) {
+      sql += " AND ChatMessage.Timestamp >= ?";
+    }
+    if (query.stop_time) {
+      sql += " AND ChatMessage.Timestamp <= ?";
+    }
+    if (!query.text.empty() && !use_full_text_search) {
+      sql += " AND ChatMessage.Message LIKE ? ESCAPE '\\'";
+    }
+    sql += " ORDER BY " + id_column + " DESC LIMIT ?";
+
+    auto statement = *read_db_ << sql;
+    if (use_full_text_search) {
+      statement << QuoteFullTextPhrase(query.text);
+    }
+    if (query.before_id) {
+      statement << query.before_id;
+    }
+    if (query.username) {
+      statement << *query.username;
+    }
+    if (query.ip_address) {
+      statement << *query.ip_address;
+    }
+    if (query.channel_id) {
+      statement << *query.channel_id;
+    }
+    if (query.start_time) {
+      statement << *query.start_time;
+    }
+    if (query.stop_time) {
+      statement << *query.stop_time;
+    }
+    if (!query.text.empty() && !use_full_text_search) {
+      statement << EscapeLikePattern(query.text);
+    }
+    statement << std::min(std::max(query.count, 1u), max_results);
+
+    auto messages = std::vector<Message>();
+    statement >> [&messages](std::uint64_t id,
+                             std::uint64_t timestamp,
+                             std::uint32_t channel_id,
+                             std::string username,
+                             std::vector<std::byte> ip_address,
+                             std::string message) {
+      messages.push_back({id, timestamp, channel_id, std::move(username),
+                          std::move(ip_address), std::move(message)});
+    };
+    return messages;
+  }
+
+  // Searches for the text as a single phrase so FTS5 operators in it
+  // aren't interpreted
+  static std::string QuoteFullTextPhrase(const std::string& text) {
+    auto phrase = std::string("\"");
+    for (const auto c : text) {
+      if (c == '"') {
+        phrase += '"';
+      }
+      phrase += c;
+    }
+    return phrase += '"';
+  }
+
+  static std::string EscapeLikePattern(const std::string& text) {
+    auto pattern = std::string("%");
+    for (const auto c : text) {
+      if (c == '%' || c == '_' || c == '\\') {
+        pattern += '\\';
+      }
+      pattern += c;
+    }
+    return pattern += '%';
+  }
+
+  constexpr static std::size_t max_pending_messages = 100'000;
+  // Only accessed by the thread pool after construction
+  sqlite::database db_;
+  // Only accessed by the search thread pool after construction
+  std::optional<sqlite::database> read_db_;
+  bool full_text_search_ = true;
+  std::mutex mutex_;
+  std::vector<Message> pending_messages_;
+  std::uint32_t dropped_messages_ = 0;
+  bool write_pending_ = false;
+  boost::asio::thread_pool thread_pool_;
+  boost::asio::thread_pool search_thread_pool_;
+};
+}
@@ -1,83 +1,232 @@
 #pragma once
 
 #include <algorithm>
-#include <capnp/message.h>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include "ChatHistory.hpp"
 #include "CollabVm.capnp.h"
+#include "SocketMessage.hpp"
 
 namespace CollabVm::Server {
 template <typename TClient, unsigned MaxUsernameLen, unsigned MaxMessageLen>
 class CollabVmChatRoom {
-  const std::uint32_t id_;
-  std::uint8_t next_message_offset_;
-  capnp::MallocMessageBuilder history_message_builder_;
-  CollabVmServerMessage::ChannelChatMessages::Builder channel_messages_;
   constexpr static auto max_chat_message_history = 100;
+  // The number of messages sent to users when they join, the rest can be
+  // requested with GetChatHistoryPage()
+  constexpr static auto join_chat_message_history = 10;
+  constexpr static auto max_cached_history_pages = 8;
+  const std::uint32_t id_;
+  ChatHistory<max_chat_message_history> history_;
+  // The ID that will be assigned to the next message, where IDs are
+  // sequence numbers starting from zero
+  std::uint64_t next_message_id_ = 0;
+  // The newest messages in the history that haven't been broadcast yet
+  std::size_t pending_messages_count_ = 0;
+  // The serialized history that is shared by every user that joins until
+  // the next message is added
+  std::shared_ptr<SharedSocketMessage> chat_history_message_;
+  struct HistoryPage {
+    std::uint64_t before_id;
+    std::uint32_t count;
+    std::uint64_t begin_id;
+    std::shared_ptr<SharedSocketMessage> message;
+  };
+  // The pages that were requested most recently, which never change because
+  // they only contain messages that have been broadcast
+  std::array<HistoryPage, max_cached_history_pages> history_pages_{};
+  std::size_t next_history_page_ = 0;
 public:
 
   explicit CollabVmChatRoom(const std::uint32_t id)
-    : id_(id),
-      next_message_offset_(0),
-      channel_messages_(
-        history_message_builder_.initRoot<CollabVmServerMessage>()
-        .initMessage()
-        .initChatMessages()) {
-    channel_messages_.setChannel(id);
-    auto messages = channel_messages_.initMessages(max_chat_message_history);
-    for (auto&& message : messages) {
-      message.initSender(MaxUsernameLen);
-      message.initMessage(MaxMessageLen);
-    }
+    : id_(id) {
   }
 
   void AddUserMessage(
     CollabVmServerMessage::ChannelChatMessage::Builder channel_chat_message,
     const std::string& username,
-    CollabVmServerMessage::UserType user_type,
+    CollabVmServerMessage::UserType user_type,
     const std::string& message) {
-    const auto timestamp =
-      std::chrono::duration_cast<std::chrono::seconds>(
-        std::chrono::system_clock::now().time_since_epoch())
-      .count();
+    const auto timestamp = GetTimestamp();
     channel_chat_message.setChannel(id_);
     auto chat_message = channel_chat_message.initMessage();
     chat_message.setMessage(message);
-    chat_message.setUserType(user_type);
+    chat_message.setUserType(user_type);
     chat_message.setSender(username);
     chat_message.setTimestamp(timestamp);
 
-    channel_messages_.setCount(
-      (std::min)(channel_messages_.getCount() + 1, max_chat_message_history));
-    chat_message = channel_messages_.getMessages()[next_message_offset_];
-    next_message_offset_ = (next_message_offset_ + 1) % max_chat_message_history;
-    const auto message_body = chat_message.getMessage();
-    copyStringToTextBuilder(message, message_body);
-    copyStringToTextBuilder(username, chat_message.getSender());
-    chat_message.setTimestamp(timestamp);
+    AddToHistory(username, user_type, message, timestamp);
+    chat_history_message_.reset();
   }
 
-  static void copyStringToTextBuilder(const std::string& string,
-                                      capnp::Text::Builder text_builder)
-  {
-    const auto new_text_end = std::copy(string.begin(),
-                                        string.end(),
-                                        text_builder.begin());
-    std::fill(new_text_end, text_builder.end(), '\0');
+  /**
+   * Adds a message to the history that will be broadcast later with
+   * CreatePendingMessagesMessage().
+   * @returns true if the pending messages must be broadcast now because
+   * older ones would otherwise be removed from the history.
+   */
+  bool AddPendingUserMessage(const std::string& username,
+                             CollabVmServerMessage::UserType user_type,
+                             const std::string& message) {
+    AddToHistory(username, user_type, message, GetTimestamp());
+    return ++pending_messages_count_ == max_chat_message_history;
+  }
+
+  /**
+   * @returns A framed chatMessages message containing every pending message
+   * in the order they were added, or nullptr if there are none.
+   */
+  std::shared_ptr<SharedSocketMessage> CreatePendingMessagesMessage() {
+    if (!pending_messages_count_) {
+      return nullptr;
+    }
+    const auto messages_count = history_.GetCount();
+    auto socket_message = CreateChatMessages(
+      messages_count - pending_messages_count_, messages_count);
+    pending_messages_count_ = 0;
+    chat_history_message_.reset();
+    return socket_message;
   }
 
   void GetChatHistory(
       CollabVmServerMessage::ChannelConnectResponse::ConnectInfo::Builder
       connect_success) {
-    const auto messages_count = channel_messages_.getCount();
-    auto message_index = messages_count == max_chat_message_history ? next_message_offset_ : 0;
-    auto messages = connect_success.initChatMessages(messages_count);
-    for (auto i = 0; i < messages_count; i++) {
-      messages.setWithCaveats(i, channel_messages_.getMessages()[message_index]);
-      message_index = (message_index + 1) % channel_messages_.getMessages().size();
-    }
+    WriteChatHistory(connect_success.initChatMessages(history_.GetCount()),
+                     0, history_.GetCount());
+  }
+
+  /**
+   * @returns A framed chatMessages message containing the most recent
+   * messages in the history, which is only serialized again after a new
+   * message has been broadcast, or nullptr if there is no history. Pending
+   * messages are excluded because users that join receive them when
+   * they're broadcast.
+   */
+  std::shared_ptr<SharedSocketMessage> GetChatHistoryMessage() {
+    const auto messages_end = history_.GetCount() - pending_messages_count_;
+    if (!messages_end) {
+      return nullptr;
+    }
+    if (!chat_history_message_) {
+      chat_history_message_ = CreateChatMessages(
+        GetIndex(GetChatHistoryMessageBeginId()), messages_end);
+    }
+    return chat_history_message_;
+  }
+
+  /**
+   * @returns The ID of the oldest message in GetChatHistoryMessage().
+   */
+  std::uint64_t GetChatHistoryMessageBeginId() const {
+    const auto end_id = GetBroadcastEndId();
+    return end_id - std::min<std::uint64_t>(end_id - GetBeginId(),
+                                            join_chat_message_history);
+  }
+
+  /**
+   * @returns A framed chatMessages message containing up to count messages
+   * that were broadcast before the message with the ID, and the ID of the
+   * oldest message in it, or nullptr if there are no older messages in
+   * the history.
+   */
+  std::pair<std::shared_ptr<SharedSocketMessage>, std::uint64_t>
+  GetChatHistoryPage(std::uint64_t before_id, std::uint32_t count) {
+    const auto end_id = std::min(before_id, GetBroadcastEndId());
+    const auto begin_id =
+      std::max(end_id - std::min<std::uint64_t>(end_id, count), GetBeginId());
+    if (begin_id >= end_id) {
+      return {nullptr, end_id};
+    }
+    for (const auto& page : history_pages_) {
+      if (page.message && page.before_id == before_id && page.count == count) {
+        return {page.message, page.begin_id};
+      }
+    }
+    auto message = CreateChatMessages(GetIndex(begin_id), GetIndex(end_id));
+    if (end_id == before_id) {
+      // Pages that were cut off at the newest message aren't cached
+      // because they would grow when more messages are broadcast
+      history_pages_[next_history_page_++ % max_cached_history_pages] =
+        HistoryPage{before_id, count, begin_id, message};
+    }
+    return {std::move(message), begin_id};
+  }
+
+  /**
+   * @returns The number of bytes used to store the history.
+   */
+  std::size_t GetHistoryMemoryUsage() const {
+    return history_.GetMemoryUsage();
   }
 
   std::uint32_t GetId() const {
     return id_;
   }
+
+private:
+  std::uint64_t GetBeginId() const {
+    return next_message_id_ - history_.GetCount();
+  }
+
+  // The ID after the newest message that has been broadcast
+  std::uint64_t GetBroadcastEndId() const {
+    return next_message_id_ - pending_messages_count_;
+  }
+
+  std::size_t GetIndex(std::uint64_t id) const {
+    return static_cast<std::size_t>(id - GetBeginId());
+  }
+
+  static std::uint64_t GetTimestamp() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  void AddToHistory(const std::string& username,
+                    CollabVmServerMessage::UserType user_type,
+                    const std::string& message,
+                    std::uint64_t timestamp) {
+    history_.Add(std::string_view(username).substr(0, MaxUsernameLen),
+                 std::string_view(message).substr(0, MaxMessageLen),
+                 user_type,
+                 timestamp);
+    next_message_id_++;
+  }
+
+  std::shared_ptr<SharedSocketMessage> CreateChatMessages(std::size_t begin,
+                                                          std::size_t end) {
+    auto socket_message = SocketMessage::CreateShared();
+    auto channel_messages =
+      socket_message->GetMessageBuilder()
+                    .initRoot<CollabVmServerMessage>()
+                    .initMessage()
+                    .initChatMessages();
+    channel_messages.setChannel(id_);
+    channel_messages.setCount(end - begin);
+    WriteChatHistory(channel_messages.initMessages(end - begin), begin, end);
+    // Framed once here instead of by every socket it's queued on
+    socket_message->CreateFrame();
+    return socket_message;
+  }
+
+  template<typename TMessagesBuilder>
+  void WriteChatHistory(TMessagesBuilder messages,
+                        std::size_t begin,
+                        std::size_t end) {
+    auto i = 0u;
+    history_.ForEach(
+      [&messages, &i](auto sender, auto message, auto user_type, auto timestamp) {
+        auto chat_message = messages[i++];
+        CopyText(sender, chat_message.initSender(sender.size()));
+        CopyText(message, chat_message.initMessage(message.size()));
+        chat_message.setUserType(user_type);
+        chat_message.setTimestamp(timestamp);
+      }, begin, end);
+  }
+
+  static void CopyText(std::string_view string, capnp::Text::Builder text_builder) {
+    std::copy(string.begin(), string.end(), text_builder.begin());
+  }
 };
 }  // namespace CollabVm::Server
@@ -1,12 +1,16 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 #include <boost/functional/hash.hpp>
+#include <charconv>
 #include <filesystem>
 #include <gsl/span>
 #include <memory>
+#include <mutex>
 #include <string_view>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
@@ -19,22 +23,33 @@
 #include <stdio.h>
 
 #include "capnp-list.hpp"
-#include "CaseInsensitiveUtils.hpp"
+#include "ChatFilter.hpp"
+#include "ChatLog.hpp"
 #include "CollabVm.capnp.h"
 #include "CollabVmCommon.hpp"
 #include "CollabVmChatRoom.hpp"
 #include "CollabVmGuacamoleClient.hpp"
 #include "SocketMessage.hpp"
 #include "Database/Database.h"
+#include "DirectMessageRegistry.hpp"
 #include "GuacamoleClient.hpp"
 #include "GuacamoleScreenshot.hpp"
+#include "RateLimiter.hpp"
+#include "RecordingFileReader.hpp"
+#include "RecordingIndex.hpp"
+#include "RecordingPlayback.hpp"
+#include "RecordingPreviewCache.hpp"
+#include "RecordingRetention.hpp"
 #include "CaptchaVerifier.hpp"
+#include "CpuPool.hpp"
 #include "StrandGuard.hpp"
+#include "UsernameRegistry.hpp"
 #include "Totp.hpp"
 #include "TurnController.hpp"
 #include "UserChannel.hpp"
 #include "AdminVirtualMachine.hpp"
 #include "IPData.hpp"
+#include "IPDataTable.hpp"
 
 namespace CollabVm::Server
 {
@@ -66,6 +81,8 @@ namespace CollabVm::Server
         CollabVmServerMessage::UserType user_type;
         typename TSocket::IpAddress::IpBytes ip_address;
         UserVoteData vote_data;
+        // The ID of the oldest chat message the user has received
+        std::uint64_t chat_history_before_id = 0;
 
         bool IsAdmin() const {
           return user_type == CollabVmServerMessage::UserType::ADMIN;
@@ -82,12 +99,17 @@ namespace CollabVm::Server
         : TSocket(io_context, doc_root),
           server_(server),
           send_queue_(io_context),
-          chat_rooms_(io_context),
+          recording_preview_cancelled_(io_context),
           username_(io_context)
       {
       }
 
-      ~CollabVmSocket() noexcept override { }
+      ~CollabVmSocket() noexcept override {
+        if (ip_data_) {
+          // Every handler that could use the IP data has completed
+          server_.ReleaseIPData(TSocket::GetIpAddress().AsBytes());
+        }
+      }
 
       class CollabVmMessageBuffer : public TSocket::MessageBuffer
       {
@@ -166,37 +188,27 @@ namespace CollabVm::Server
 
       void OnPreConnect() override
       {
-        server_.GetIPData(TSocket::GetIpAddress(),
-          [this, self = shared_from_this()](auto& ip_data) {
-            ip_data_ = ip_data;
-            server_.settings_.dispatch([this, self = std::move(self)](auto& settings) {
-              const auto max_connections_enabled =
-                settings.GetServerSetting(ServerSetting::Setting::MAX_CONNECTIONS_ENABLED)
-                .getMaxConnectionsEnabled();
-              const auto max_connections =
-                settings.GetServerSetting(ServerSetting::Setting::MAX_CONNECTIONS)
-                .getMaxConnections();
-              ip_data_->dispatch(
-                [this, self = std::move(self), max_connections_enabled, max_connections]
-                (auto& ip_data) {
-                  if (max_connections_enabled
-                      && ++ip_data.connections > max_connections) {
-                    TSocket::Close();
-                    return;
-                  }
-                  TSocket::OnPreConnect();
-              });
-            });
-          });
+        // Connections are admitted before the WebSocket handshake without
+        // dispatching to any strand
+        auto ip_data = server_.AcquireIPData(TSocket::GetIpAddress().AsBytes());
+        if (!ip_data->TryAddConnection(
+              server_.max_connections_per_ip_.load(std::memory_order_relaxed))) {
+          server_.ReleaseIPData(TSocket::GetIpAddress().AsBytes());
+          TSocket::Close();
+          return;
+        }
+        ip_data_ = std::move(ip_data);
+        // Set before any messages are read
+        ip_rate_limiter_ = &ip_data_->rate_limiter;
+        TSocket::OnPreConnect();
       }
 
       void OnConnect() override
       {
-        server_.settings_.dispatch([this, self = shared_from_this()](auto& settings) {
-          is_captcha_required_ =
-            settings.GetServerSetting(ServerSetting::Setting::CAPTCHA_REQUIRED)
-                    .getCaptchaRequired();
-        });
+        is_captcha_required_ =
+          server_.GetSettings()
+                 ->GetServerSetting(ServerSetting::Setting::CAPTCHA_REQUIRED)
+                 .getCaptchaRequired();
       }
 
       void OnMessage(
@@ -212,11 +224,79 @@ namespace CollabVm::Server
         }
       }
 
+      /**
+       * Checks the rate limits of the connection and its IP address before
+       * the message is dispatched anywhere.
+       * @returns false if the message should be dropped.
+       */
+      bool CheckRateLimit(CollabVmClientMessage::Message::Which message_type)
+      {
+        auto type = RateLimitedMessage();
+        switch (message_type)
+        {
+        case CollabVmClientMessage::Message::CHAT_MESSAGE:
+          type = RateLimitedMessage::Chat;
+          break;
+        case CollabVmClientMessage::Message::GUAC_INSTR:
+          type = RateLimitedMessage::GuacamoleInstruction;
+          break;
+        case CollabVmClientMessage::Message::VOTE:
+          type = RateLimitedMessage::Vote;
+          break;
+        case CollabVmClientMessage::Message::TURN_REQUEST:
+          type = RateLimitedMessage::Turn;
+          break;
+        default:
+          return true;
+        }
+        if (is_admin_)
+        {
+          return true;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const auto& limits = server_.rate_limits_;
+        const auto& connection_limit = limits.GetConnectionLimit(type);
+        // The connection's bucket is only checked here, so a message dropped
+        // by the IP's limit doesn't also use up the connection's limit
+        if (rate_limiter_.CanConsume(type, connection_limit, now)
+            && (!ip_rate_limiter_
+                || ip_rate_limiter_->TryConsume(type, limits.GetIpLimit(type), now)))
+        {
+          // Only this connection reads its bucket, so it can't have emptied
+          rate_limiter_.TryConsume(type, connection_limit, now);
+          return true;
+        }
+        if (now - last_rate_limit_log_ >= rate_limit_log_interval)
+        {
+          last_rate_limit_log_ = now;
+          const auto get_dropped_counts = [](const RateLimiter& rate_limiter)
+          {
+            return "chat: " + std::to_string(rate_limiter.GetDroppedCount(RateLimitedMessage::Chat))
+              + ", input: " + std::to_string(rate_limiter.GetDroppedCount(RateLimitedMessage::GuacamoleInstruction))
+              + ", vote: " + std::to_string(rate_limiter.GetDroppedCount(RateLimitedMessage::Vote))
+              + ", turn: " + std::to_string(rate_limiter.GetDroppedCount(RateLimitedMessage::Turn));
+          };
+          std::cout << "Rate limited " << TSocket::GetIpAddress().AsString()
+                    << ", dropped by connection (" << get_dropped_counts(rate_limiter_) << ')';
+          if (ip_rate_limiter_)
+          {
+            std::cout << ", dropped by IP (" << get_dropped_counts(*ip_rate_limiter_) << ')';
+          }
+          std::cout << std::endl;
+        }
+        return false;
+      }
+
       void HandleMessage(std::shared_ptr<CollabVmMessageBuffer>&& buffer)
       {
         auto& reader = buffer->CreateReader();
         auto message = reader.template getRoot<CollabVmClientMessage>().getMessage();
 
+        if (!CheckRateLimit(message.which()))
+        {
+          return;
+        }
+
         switch (message.which())
         {
         case CollabVmClientMessage::Message::CONNECT_TO_CHANNEL:
@@ -257,14 +337,21 @@ namespace CollabVm::Server
                   .initConnectResponse()
                   .initResult();
                 auto connectSuccess = connect_result.initSuccess();
-                channel.GetChatRoom().GetChatHistory(connectSuccess);
                 connectSuccess.setUsername(username);
                 connectSuccess.setCaptchaRequired(is_captcha_required_);
                 QueueMessage(std::move(socket_message));
+                // The history is sent separately so it can be shared
+                // instead of being copied into every connect response
+                if (auto chat_history = channel.GetChatRoom().GetChatHistoryMessage())
+                {
+                  QueueMessage(std::move(chat_history));
+                }
                 auto user_data = UserData();
                 user_data.username = username;
                 user_data.user_type = GetUserType();
                 user_data.ip_address = TSocket::GetIpAddress().AsBytes();
+                user_data.chat_history_before_id =
+                  channel.GetChatRoom().GetChatHistoryMessageBeginId();
                 channel.AddUser(std::move(user_data), std::move(self));
               };
               if (channel_id == global_channel_id)
@@ -445,25 +532,20 @@ namespace CollabVm::Server
                 if (username == std::string_view(new_username.cStr(), new_username.size())) {
                   return;
                 }
-                server_.guests_.dispatch(
-                  [this, self = shared_from_this(),
-                  buffer = std::move(buffer), new_username, current_username = username](auto& guests)
+                if (!server_.guests_.TryAdd(
+                      {new_username.cStr(), new_username.size()},
+                      shared_from_this()))
                 {
-                  const auto is_username_taken =
-                    !std::get<bool>(guests.insert({ new_username, shared_from_this() }));
-                  if (is_username_taken)
-                  {
-                    auto socket_message = SocketMessage::CreateShared();
-                    auto message = socket_message->GetMessageBuilder()
-                      .initRoot<CollabVmServerMessage>()
-                      .initMessage();
-                    message.setUsernameTaken();
-                    QueueMessage(std::move(socket_message));
-                    return;
-                  }
-                  guests.erase(current_username);
-                  SetUserData(std::string(new_username));
-                });
+                  auto socket_message = SocketMessage::CreateShared();
+                  auto message = socket_message->GetMessageBuilder()
+                    .initRoot<CollabVmServerMessage>()
+                    .initMessage();
+                  message.setUsernameTaken();
+                  QueueMessage(std::move(socket_message));
+                  return;
+                }
+                server_.guests_.Remove(username);
+                SetUserData(std::string(new_username));
               });
             break;
           }
@@ -491,9 +573,12 @@ namespace CollabVm::Server
                   .initMessage().setChangePasswordResponse(success);
                 QueueMessage(std::move(socket_message));
               };
-              server_.login_strand_.post(
-                std::move(lambda),
-                std::allocator<decltype(lambda)>());
+              // Hashing the passwords is slow, so it isn't done on the
+              // threads that handle I/O
+              if (!server_.cpu_pool_.TryPost(CpuPool::Priority::Interactive,
+                                             std::move(lambda))) {
+                TSocket::Close();
+              }
             });
           break;
         case CollabVmClientMessage::Message::CHAT_MESSAGE:
@@ -504,13 +589,10 @@ namespace CollabVm::Server
           }
           const auto chat_message = message.getChatMessage();
           const auto message_len = chat_message.getMessage().size();
-          const auto now = std::chrono::steady_clock::now();
-          if (!message_len || message_len > Common::max_chat_message_len
-              || now - last_chat_message_ < Common::chat_rate_limit)
+          if (!message_len || message_len > Common::max_chat_message_len)
           {
             break;
           }
-          last_chat_message_ = now;
           username_.dispatch(
             [this, self = shared_from_this(),
             buffer = std::move(buffer), chat_message]
@@ -526,186 +608,142 @@ namespace CollabVm::Server
             {
             case CollabVmClientMessage::ChatMessageDestination::Destination::
             NEW_DIRECT:
-              server_.guests_.dispatch([
-                  this, self = shared_from_this(), buffer = std::move(buffer),
-                  chat_message, username = destination.getNewDirect()
-                ](auto& guests) mutable
+              {
+                const auto recipient_username = destination.getNewDirect();
+                const auto recipient = server_.guests_.Find(
+                  {recipient_username.cStr(), recipient_username.size()});
+                if (!recipient || recipient == self)
                 {
-                  auto guests_it = guests.find(username);
-                  if (guests_it == guests.end())
-                  {
-                    SendChatMessageResponse(
-                      CollabVmServerMessage::ChatMessageResponse::
-                      USER_NOT_FOUND);
-                    return;
-                  }
-                  chat_rooms_.dispatch([
-                      this, self = shared_from_this(), buffer = std::
-                      move(buffer),
-                      chat_message, recipient = guests_it->second
-                    ](auto& chat_rooms)
-                    {
-                      if (chat_rooms.size() >= 10)
-                      {
-                        SendChatMessageResponse(
-                          CollabVmServerMessage::ChatMessageResponse::
-                          USER_CHAT_LIMIT);
-                        return;
-                      }
-                      auto existing_chat_room =
-                        std::find_if(chat_rooms.begin(),
-                                     chat_rooms.end(),
-                                     [&recipient](const auto& room)
-                                     {
-                                       return room.second.first ==
-                                         recipient;
-                                     });
-                      if (existing_chat_room != chat_rooms.end())
-                      {
-                        SendChatChannelId(
-                          existing_chat_room->second.second);
-                        return;
-                      }
-                      const auto id = chat_rooms_id_++;
-                      chat_rooms.emplace(
-                        id, std::make_pair(recipient, 0));
-                      recipient->chat_rooms_.dispatch([
-                          this, self = shared_from_this(),
-                          buffer = std::move(buffer),
-                          chat_message, recipient, sender_id
-                          = id
-                        ](auto& recipient_chat_rooms)
-                        {
-                          auto existing_chat_room = std::
-                            find_if(
-                              recipient_chat_rooms.begin(),
-                              recipient_chat_rooms.end(),
-                              [&self](const auto& room)
-                              {
-                                return room.second.first ==
-                                  self;
-                              });
-                          if (existing_chat_room !=
-                            recipient_chat_rooms.end())
-                          {
-                            if (!existing_chat_room
-                                 ->second.second)
-                            {
-                              existing_chat_room
-                                ->second.second = sender_id;
-                              return;
-                            }
-                            SendChatChannelId(sender_id);
-                            return;
-                          }
-                          if (recipient_chat_rooms.size() >=
-                            10)
-                          {
-                            chat_rooms_.dispatch([
-                                this, self =
-                                shared_from_this(), sender_id
-                              ](auto& chat_rooms)
-                              {
-                                chat_rooms.erase(sender_id);
-                                SendChatMessageResponse(
-                                  CollabVmServerMessage::
-                                  ChatMessageResponse::
-                                  RECIPIENT_CHAT_LIMIT);
-                              });
-                            return;
-                          }
-                          const auto recipient_id = recipient
-                            ->chat_rooms_id_++;
-                          recipient_chat_rooms.emplace(
-                            recipient_id,
-                            std::make_pair(
-                              recipient, sender_id));
-                          chat_rooms_.dispatch([
-                              this, self = shared_from_this()
-                              ,
-                              buffer = std::move(buffer),
-                              chat_message, recipient,
-                              sender_id, recipient_id
-                            ](auto& chat_rooms)
-                            {
-                              auto chat_rooms_it = chat_rooms
-                                .find(sender_id);
-                              if (chat_rooms_it != chat_rooms
-                                .end() &&
-                                !chat_rooms_it->second.second
-                              )
-                              {
-                                chat_rooms_it->second.second
-                                  = recipient_id;
-                                SendChatChannelId(sender_id);
-
-                                auto socket_message =
-                                  SocketMessage::CreateShared();
-                                auto channel_message =
-                                  socket_message
-                                  ->GetMessageBuilder()
-                                  .initRoot<
-                                    CollabVmServerMessage>()
-                                  .initMessage()
-                                  .initNewChatChannel();
-                                channel_message.setChannel(
-                                  recipient_id);
-                                auto message =
-                                  channel_message.
-                                  initMessage();
-                                message.setMessage(
-                                  chat_message.getMessage());
-                                //                        message.setSender(username);
-                                //    message.setTimestamp(timestamp);
-                                recipient->QueueMessage(socket_message);
-                                QueueMessage(std::move(socket_message));
-                              }
-                            });
-                        });
-                    });
-                });
-              break;
+                  SendChatMessageResponse(
+                    CollabVmServerMessage::ChatMessageResponse::
+                    USER_NOT_FOUND);
+                  break;
+                }
+                const auto [result, id] =
+                  server_.direct_messages_.GetOrCreateChannel(self, recipient);
+                switch (result)
+                {
+                case DirectMessageRegistry<CollabVmSocket>::Result::SenderLimitReached:
+                  SendChatMessageResponse(
+                    CollabVmServerMessage::ChatMessageResponse::
+                    USER_CHAT_LIMIT);
+                  return;
+                case DirectMessageRegistry<CollabVmSocket>::Result::RecipientLimitReached:
+                  SendChatMessageResponse(
+                    CollabVmServerMessage::ChatMessageResponse::
+                    RECIPIENT_CHAT_LIMIT);
+                  return;
+                case DirectMessageRegistry<CollabVmSocket>::Result::UserRemoved:
+                  SendChatMessageResponse(
+                    CollabVmServerMessage::ChatMessageResponse::
+                    USER_NOT_FOUND);
+                  return;
+                case DirectMessageRegistry<CollabVmSocket>::Result::Existing:
+                  SendChatChannelId(id);
+                  return;
+                case DirectMessageRegistry<CollabVmSocket>::Result::Created:
+                  break;
+                }
+                SendChatChannelId(id);
+                auto socket_message = SocketMessage::CreateShared();
+                auto channel_message = socket_message->GetMessageBuilder()
+                  .initRoot<CollabVmServerMessage>()
+                  .initMessage()
+                  .initNewChatChannel();
+                channel_message.setChannel(id);
+                auto message = channel_message.initMessage();
+                message.setMessage(chat_message.getMessage());
+                message.setSender(username);
+                message.setUserType(GetUserType());
+                message.setTimestamp(
+                  std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                  .count());
+                recipient->QueueMessage(socket_message);
+                QueueMessage(std::move(socket_message));
+                break;
+              }
             case CollabVmClientMessage::ChatMessageDestination::Destination::
             DIRECT:
               {
-                chat_rooms_.dispatch([
-                    this, self = shared_from_this(), username,
-                    buffer = std::move(buffer), chat_message, destination
-                  ](const auto& chat_rooms) mutable
-                  {
-                    const auto id = destination.getDirect();
-                    const auto chat_rooms_it = chat_rooms.find(id);
-                    if (chat_rooms_it == chat_rooms.end())
-                    {
-                      // TODO: Tell the client the message could not be sent
-                      return;
-                    }
-                    const auto recipient = chat_rooms_it->second.first;
-                    recipient->QueueMessage(CreateChatMessage(
-                      id, username, chat_message.getMessage()));
-                  });
+                // Both users refer to the channel by the same ID
+                const auto id = destination.getDirect();
+                const auto recipient =
+                  server_.direct_messages_.GetRecipient(id, *this);
+                if (!recipient)
+                {
+                  // TODO: Tell the client the message could not be sent
+                  break;
+                }
+                recipient->QueueMessage(CreateChatMessage(
+                  id, username, chat_message.getMessage()));
                 break;
               }
             case CollabVmClientMessage::ChatMessageDestination::Destination::VM:
               {
                 const auto id = destination.getVm();
+                if (is_admin_ && SearchChatLog(id, chat_message.getMessage()))
+                {
+                  break;
+                }
+                if (const auto count =
+                      ParseChatHistoryRequest(chat_message.getMessage()))
+                {
+                  server_.GetChannel(id,
+                    [self = shared_from_this(), count](auto& channel)
+                    {
+                      channel.SendChatHistoryPage(self, count);
+                    });
+                  break;
+                }
+                const auto text = chat_message.getMessage();
+                // Only allocated when a banned phrase is masked
+                auto masked_text = std::string();
+                if (const auto filter = server_.chat_filter_.GetFilter();
+                    filter && !is_admin_
+                    && filter->Contains(std::string_view(text.begin(), text.size())))
+                {
+                  switch (server_.chat_filter_.GetAction())
+                  {
+                  case ChatFilter::Action::Drop:
+                    return;
+                  case ChatFilter::Action::Mask:
+                    masked_text.assign(text.begin(), text.size());
+                    filter->Mask(masked_text.data(), masked_text.size());
+                    break;
+                  case ChatFilter::Action::Flag:
+                    std::cout << "Flagged chat message from " << username
+                      << " (" << TSocket::GetIpAddress().AsString() << "): "
+                      << text.cStr() << std::endl;
+                    break;
+                  }
+                }
                 auto send_message = [
-                    this, self = shared_from_this(), username,
-                    buffer = std::move(buffer), chat_message
+                    this, self = shared_from_this(), id, username,
+                    buffer = std::move(buffer), chat_message,
+                    masked_text = std::move(masked_text)
                   ](auto& channel)
                 {
-                  auto& chat_room = channel.GetChatRoom();
-                  auto new_chat_message = SocketMessage::CreateShared();
-                  auto chat_room_message =
-                    new_chat_message->GetMessageBuilder()
-                                    .initRoot<CollabVmServerMessage>()
-                                    .initMessage()
-                                    .initChatMessage();
-                  chat_room.AddUserMessage(chat_room_message,
-                                           username,
-                                           GetUserType(),
-                                           chat_message.getMessage());
-                  channel.BroadcastMessage(std::move(new_chat_message));
+                  if (!channel.GetUserData(self))
+                  {
+                    return;
+                  }
+                  const auto text = masked_text.empty()
+                                      ? chat_message.getMessage()
+                                      : capnp::Text::Reader(
+                                          masked_text.c_str(),
+                                          masked_text.size());
+                  channel.SendChatMessage(username,
+                                          GetUserType(),
+                                          text,
+                                          server_.chat_batch_interval_);
+                  // Only the messages that users received are logged
+                  server_.chat_log_.Append(
+                    id, username, TSocket::GetIpAddress().AsVector(),
+                    std::string(text.begin(), text.size()),
+                    std::chrono::duration_cast<std::chrono::seconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                    .count());
                 };
                 if (id == global_channel_id)
                 {
@@ -769,15 +807,19 @@ namespace CollabVm::Server
                   .initResult();
                 if (is_valid)
                 {
+                  // The password is hashed on the CPU pool and the result is
+                  // handled on the login strand
+                  auto login = [this, username, password]
+                  {
+                    return server_.db_.Login(username, password);
+                  };
                   auto lambda = [
-                      this, self = std::move(self), socket_message,
+                      this, self, socket_message,
                       buffer = std::move(buffer), login_response,
-                      username,
-                      password
-                    ]() mutable
+                      username
+                    ](auto result) mutable
                   {
-                    const auto [login_result, totp_key] =
-                      server_.db_.Login(username, password);
+                    auto& [login_result, totp_key] = result;
                     if (login_result == CollabVmServerMessage::
                       LoginResponse::
                       LoginResult::SUCCESS)
@@ -812,9 +854,12 @@ namespace CollabVm::Server
                       QueueMessage(std::move(socket_message));
                     }
                   };
-                  server_.login_strand_.post(
-                    std::move(lambda),
-                    std::allocator<decltype(lambda)>());
+                  if (!server_.cpu_pool_.TryPost(
+                        CpuPool::Priority::Interactive, std::move(login),
+                        boost::asio::bind_executor(server_.login_strand_,
+                                                   std::move(lambda)))) {
+                    TSocket::Close();
+                  }
                 }
                 else
                 {
@@ -953,7 +998,7 @@ namespace CollabVm::Server
             auto register_request = message.getAccountRegistrationRequest();
             if (register_request.getInviteId().size()) {
               // Captchas are not required for invites
-              server_.settings_.dispatch(std::move(create_account));
+              create_account(*server_.GetSettings());
               break;
             }
             server_.captcha_verifier_.Verify(
@@ -962,7 +1007,7 @@ namespace CollabVm::Server
               (bool is_valid) mutable
               {
                 if (is_valid) {
-                  server_.settings_.dispatch(std::move(create_account));
+                  create_account(*server_.GetSettings());
                   return;
                 }
                 auto response = SocketMessage::CreateShared();
@@ -983,12 +1028,7 @@ namespace CollabVm::Server
             {
               break;
             }
-            server_.settings_.dispatch(
-              [ this, self = shared_from_this() ](auto& settings)
-              {
-                QueueMessage(SocketMessage::CopyFromMessageBuilder(
-                  settings.GetServerSettingsMessageBuilder()));
-              });
+            QueueMessage(server_.GetSettings()->GetServerSettingsMessage());
             if (!is_viewing_server_config)
             {
               is_viewing_server_config = true;
@@ -1011,29 +1051,19 @@ namespace CollabVm::Server
           {
             // TODO: Validate setttings
           }
-          server_.settings_.dispatch([
-            this, self = shared_from_this(), buffer = std::move(
-              buffer),
-              changed_settings
-          ](auto& settings) mutable
+          auto config_message =
+            server_.UpdateServerSettings(changed_settings)
+                   ->GetServerSettingsMessage();
+          // Broadcast the config changes to all other admins viewing the
+          // admin panel
+          server_.virtual_machines_.dispatch([
+            self = shared_from_this(),
+            config_message = std::move(config_message)
+            ]
+            (auto& virtual_machines)
             {
-              settings.UpdateServerSettings(changed_settings,
-                [this](auto new_settings, auto current_settings) {
-                  server_.ApplySettings(new_settings, current_settings);
-                });
-              auto config_message = SocketMessage::CopyFromMessageBuilder(
-                settings.GetServerSettingsMessageBuilder());
-              // Broadcast the config changes to all other admins viewing the
-              // admin panel
-              server_.virtual_machines_.dispatch([
-                self = std::move(self),
-                config_message = std::move(config_message)
-                ]
-                (auto& virtual_machines)
-                {
-                  virtual_machines
-                    .BroadcastToViewingAdminsExcluding(config_message, self);
-                });
+              virtual_machines
+                .BroadcastToViewingAdminsExcluding(config_message, self);
             });
         }
           break;
@@ -1359,24 +1389,22 @@ namespace CollabVm::Server
             boost::endian::big_to_native(message.getBanIp().getFirst());
           *reinterpret_cast<std::uint64_t*>(&ip_bytes[8]) =
             boost::endian::big_to_native(message.getBanIp().getSecond());
-          server_.settings_.dispatch([
-            ip_address = boost::asio::ip::address_v6(ip_bytes).to_string()]
-            (auto& settings)
-            {
-              const auto ban_ip_command = 
-                settings.GetServerSetting(ServerSetting::Setting::BAN_IP_COMMAND)
-                        .getBanIpCommand();
-              if (ban_ip_command.size()) {
+          const auto settings = server_.GetSettings();
+          const auto ban_ip_command =
+            settings->GetServerSetting(ServerSetting::Setting::BAN_IP_COMMAND)
+                    .getBanIpCommand();
+          if (ban_ip_command.size()) {
+            const auto ip_address =
+              boost::asio::ip::address_v6(ip_bytes).to_string();
 #ifdef _WIN32
   #define putenv _putenv
 #endif
-                putenv(("IP_ADDRESS=" + ip_address).data());
+            putenv(("IP_ADDRESS=" + ip_address).data());
 #ifdef _WIN32
   #undef putenv
 #endif
-                ExecuteCommandAsync(ban_ip_command.cStr());
-              }
-            });
+            ExecuteCommandAsync(ban_ip_command.cStr());
+          }
           break;
         }
         case CollabVmClientMessage::Message::SEND_CAPTCHA:
@@ -1390,8 +1418,7 @@ namespace CollabVm::Server
           server_.GetUser(
             std::string_view(username.cStr(), username.size()),
             send_captcha.getChannel(),
-            [buffer = std::move(buffer)](auto& user) {
-              auto& [socket, user_data] = user;
+            [buffer = std::move(buffer)](auto& socket, auto& user_data) {
               socket->is_captcha_required_ = true;
               auto socket_message = SocketMessage::CreateShared();
               auto& message_builder = socket_message->GetMessageBuilder();
@@ -1413,8 +1440,7 @@ namespace CollabVm::Server
           server_.GetUser(
             std::string_view(username.cStr(), username.size()),
             kick_user.getChannel(),
-            [buffer = std::move(buffer)](auto& user) {
-              auto& [socket, user_data] = user;
+            [buffer = std::move(buffer)](auto& socket, auto& user_data) {
               socket->Close();
             });
           break;
@@ -1490,12 +1516,50 @@ namespace CollabVm::Server
         }
         case CollabVmClientMessage::Message::RECORDING_PREVIEW_REQUEST:
         {
-          if (is_admin_)
+          if (!is_admin_)
           {
-            SendRecordingPreviews(
-              std::move(buffer),
-              message.getRecordingPreviewRequest());
+            break;
+          }
+          const auto request = message.getRecordingPreviewRequest();
+          if (request.getWidth() == playback_request_size
+              && request.getHeight() == playback_request_size)
+          {
+            PlayRecording(request);
+            break;
           }
+          username_.dispatch(
+            [this, self = shared_from_this(), buffer = std::move(buffer),
+              request](auto& username) mutable
+            {
+              recording_preview_cancelled_.dispatch(
+                [this, self = std::move(self), buffer = std::move(buffer),
+                  request, account = username](auto& previous_cancelled) mutable
+                {
+                  if (!server_.TryStartRecordingPreviewJob(account))
+                  {
+                    SendRecordingPreviewResult(false);
+                    return;
+                  }
+                  // A new request replaces the previous one
+                  if (previous_cancelled)
+                  {
+                    CancelRecordingPreviews(*previous_cancelled);
+                  }
+                  auto cancelled = std::make_shared<std::atomic_bool>(false);
+                  previous_cancelled = cancelled;
+                  if (!server_.cpu_pool_.TryPost(CpuPool::Priority::Background,
+                        [this, self, buffer = std::move(buffer),
+                          request, cancelled, account]() mutable
+                        {
+                          StartRecordingPreviews(request, std::move(cancelled),
+                                                 std::move(account));
+                        }))
+                  {
+                    FinishRecordingPreviews(*cancelled, false);
+                    server_.FinishRecordingPreviewJob(account);
+                  }
+                });
+            });
           break;
         }
         default:
@@ -1537,6 +1601,170 @@ namespace CollabVm::Server
         QueueMessage(std::move(socket_message));
       }
 
+      /**
+       * Handles a chat message of the form
+       * "/chatlog [user:name] [ip:address] [vm:id] [from:time] [to:time]
+       * [before:id] [limit:count] [text]", where times are in seconds since
+       * the Unix epoch. The results are only sent to this socket, and the
+       * ID of the oldest result is used as "before" to get the next page.
+       * @returns false if the message isn't a chat log command.
+       */
+      bool SearchChatLog(std::uint32_t channel_id,
+                         const capnp::Text::Reader message)
+      {
+        constexpr auto command = std::string_view("/chatlog");
+        auto arguments = std::string_view(message.begin(), message.size());
+        if (arguments.substr(0, command.size()) != command
+            || (arguments.size() > command.size()
+                && arguments[command.size()] != ' '))
+        {
+          return false;
+        }
+        arguments.remove_prefix(command.size());
+        auto query = ChatLog::Query();
+        const auto parse_number = [](std::string_view value, auto& number)
+        {
+          return std::from_chars(value.data(), value.data() + value.size(),
+                                 number).ec == std::errc();
+        };
+        while (!arguments.empty())
+        {
+          const auto argument = arguments.substr(0, arguments.find(' '));
+          arguments.remove_prefix(std::min(argument.size() + 1, arguments.size()));
+          if (argument.empty())
+          {
+            continue;
+          }
+          const auto separator = argument.find(':');
+          const auto name = argument.substr(0, separator);
+          const auto value = separator == std::string_view::npos
+                               ? std::string_view()
+                               : argument.substr(separator + 1);
+          auto number = std::uint64_t();
+          if (name == "user")
+          {
+            query.username = std::string(value);
+          }
+          else if (name == "ip")
+          {
+            auto error_code = boost::system::error_code();
+            const auto ip_address = boost::asio::ip::make_address(
+              std::string(value), error_code);
+            if (error_code)
+            {
+              return true;
+            }
+            query.ip_address =
+              typename TSocket::IpAddress(ip_address).AsVector();
+          }
+          else if (name == "vm" && parse_number(value, number))
+          {
+            query.channel_id = static_cast<std::uint32_t>(number);
+          }
+          else if (name == "from" && parse_number(value, number))
+          {
+            query.start_time = number;
+          }
+          else if (name == "to" && parse_number(value, number))
+          {
+            query.stop_time = number;
+          }
+          else if (name == "before" && parse_number(value, number))
+          {
+            query.before_id = number;
+          }
+          else if (name == "limit" && parse_number(value, number))
+          {
+            query.count = static_cast<std::uint32_t>(
+              std::min<std::uint64_t>(number, ChatLog::max_results));
+          }
+          else
+          {
+            // The rest of the message is the text to search for
+            query.text = std::string(argument.data(),
+                                     arguments.data() + arguments.size()
+                                       - argument.data());
+            break;
+          }
+        }
+        server_.chat_log_.Search(std::move(query),
+          [this, self = shared_from_this(), channel_id](auto messages)
+          {
+            auto socket_message = SocketMessage::CreateShared();
+            auto channel_messages =
+              socket_message->GetMessageBuilder()
+                            .initRoot<CollabVmServerMessage>()
+                            .initMessage()
+                            .initChatMessages();
+            channel_messages.setChannel(channel_id);
+            channel_messages.setCount(messages.size());
+            auto messages_list = channel_messages.initMessages(messages.size());
+            // Sent oldest first like the chat history
+            auto message_list_it = messages_list.begin();
+            for (auto it = messages.rbegin(); it != messages.rend(); ++it)
+            {
+              const auto sender = '#' + std::to_string(it->id)
+                + " [vm" + std::to_string(it->channel_id) + "] "
+                + it->username + " (" + FormatIpAddress(it->ip_address) + ')';
+              auto chat_message = *message_list_it++;
+              chat_message.setSender(sender);
+              chat_message.setMessage(it->message);
+              chat_message.setTimestamp(it->timestamp);
+            }
+            QueueMessage(std::move(socket_message));
+          });
+        return true;
+      }
+
+      /**
+       * Parses a chat message of the form "/history [count]", which requests
+       * the messages that were sent before the oldest one the user has
+       * received in the channel.
+       * @returns The number of messages requested, or zero if the message
+       * isn't a history request.
+       */
+      static std::uint32_t ParseChatHistoryRequest(
+        const capnp::Text::Reader message)
+      {
+        constexpr auto command = std::string_view("/history");
+        constexpr auto default_count = 20u;
+        const auto text = std::string_view(message.begin(), message.size());
+        if (text.substr(0, command.size()) != command)
+        {
+          return 0;
+        }
+        if (text.size() == command.size())
+        {
+          return default_count;
+        }
+        auto count = 0u;
+        const auto arguments = text.substr(command.size() + 1);
+        if (text[command.size()] != ' '
+            || std::from_chars(arguments.data(),
+                               arguments.data() + arguments.size(),
+                               count).ec != std::errc())
+        {
+          return 0;
+        }
+        return std::clamp(count, 1u, 100u);
+      }
+
+      static std::string FormatIpAddress(const std::vector<std::byte>& bytes)
+      {
+        auto ip_bytes = boost::asio::ip::address_v6::bytes_type();
+        if (bytes.size() != ip_bytes.size())
+        {
+          return {};
+        }
+        std::transform(bytes.begin(), bytes.end(), ip_bytes.begin(),
+          [](auto byte) { return static_cast<unsigned char>(byte); });
+        const auto ip_address = boost::asio::ip::address_v6(ip_bytes);
+        return ip_address.is_v4_mapped()
+                 ? boost::asio::ip::make_address_v4(
+                     boost::asio::ip::v4_mapped, ip_address).to_string()
+                 : ip_address.to_string();
+      }
+
       bool ValidateVmSetting(std::uint16_t setting_id,
                              const VmSetting::Setting::Reader& setting)
       {
@@ -1665,36 +1893,58 @@ namespace CollabVm::Server
             callback = std::forward<TCallback>(callback)
           ](auto& send_queue) mutable
           {
-            callback([&send_queue](auto&& socket_message)
-            {
-              if (!socket_message) {
-                // FIXME: This shouldn't happen
-                return;
-              }
-              socket_message->CreateFrame();
-              send_queue.push(std::forward<decltype(socket_message)>(socket_message));
-            });
-            if (!send_queue.empty() && !sending_)
+            EnqueueMessageBatch(std::move(self), send_queue, callback);
+          });
+      }
+
+      /**
+       * Queues instructions from the live VM, which are dropped while a
+       * recording is being played.
+       */
+      template<typename TCallback>
+      void QueueGuacamoleInstructions(TCallback&& callback)
+      {
+        send_queue_.dispatch([
+            this, self = shared_from_this(),
+            callback = std::forward<TCallback>(callback)
+          ](auto& send_queue) mutable
+          {
+            if (!is_playing_recording_)
             {
-              sending_ = true;
-              SendMessageBatch(std::move(self), send_queue);
+              EnqueueMessageBatch(std::move(self), send_queue, callback);
             }
           });
       }
     private:
+      template<typename TCallback>
+      void EnqueueMessageBatch(std::shared_ptr<CollabVmSocket>&& self,
+                               std::queue<std::shared_ptr<SocketMessage>>& send_queue,
+                               TCallback& callback)
+      {
+        callback([&send_queue](auto&& socket_message)
+        {
+          if (!socket_message) {
+            // FIXME: This shouldn't happen
+            return;
+          }
+          socket_message->CreateFrame();
+          send_queue.push(std::forward<decltype(socket_message)>(socket_message));
+        });
+        if (!send_queue.empty() && !sending_)
+        {
+          sending_ = true;
+          SendMessageBatch(std::move(self), send_queue);
+        }
+      }
+
       void OnDisconnect() override {
         LeaveServerConfig();
         LeaveVmList();
         username_.dispatch(
           [this, self = shared_from_this()](auto& username) {
-            if (username.empty()) {
-              return;
+            if (!username.empty()) {
+              server_.guests_.Remove(username);
             }
-            server_.guests_.dispatch([
-              username = std::move(username)](auto& guests)
-              {
-                guests.erase(username);
-              });
           });
         auto leave_channel =
           [self = shared_from_this()]
@@ -1718,13 +1968,19 @@ namespace CollabVm::Server
         if (is_in_global_chat_) {
           server_.global_chat_room_.dispatch(std::move(leave_channel));
         }
+        server_.direct_messages_.RemoveUser(shared_from_this());
+        recording_preview_cancelled_.dispatch(
+          [this, self = shared_from_this()](auto& cancelled) {
+            if (cancelled) {
+              CancelRecordingPreviews(*cancelled);
+            }
+          });
+        if (recording_playback_) {
+          recording_playback_->Stop();
+          recording_playback_.reset();
+        }
         if (ip_data_) {
-          ip_data_->dispatch(
-            [this, self = shared_from_this()](auto& ip_data) {
-              if (ip_data.connections > 0) {
-                --ip_data.connections;
-              }
-            });
+          ip_data_->RemoveConnection();
         }
       }
 
@@ -1787,26 +2043,9 @@ namespace CollabVm::Server
       template<typename TContinuation>
       void GenerateUsername(TContinuation&& continuation)
       {
-        server_.guests_.dispatch([
-            this, continuation = std::forward<TContinuation>(continuation)
-        ](auto& guests)
-        {
-          auto num = server_.guest_rng_(server_.rng_);
-          auto username = std::string();
-          // Increment the number until a username is found that is not taken
-          auto is_username_taken = false;
-          do
-          {
-            if (is_username_taken) {
-              num++;
-            }
-            username = "guest" + std::to_string(num);
-            is_username_taken =
-              !std::get<bool>(guests.insert({ username, shared_from_this() }));
-          } while (is_username_taken);
-          SetUserData(username);
-          continuation(username);
-        });
+        auto username = server_.guests_.AddGuest(shared_from_this());
+        SetUserData(username);
+        continuation(username);
       }
 
       template<typename TString>
@@ -1820,26 +2059,9 @@ namespace CollabVm::Server
             if (!username.empty() && (connected_vm_id_ || is_in_global_chat_))
             {
               auto update_username = 
-                [this, self = shared_from_this(), new_username=current_username, user_type]
+                [self = shared_from_this(), new_username=current_username, user_type]
                 (auto& channel) mutable {
-                  auto user_data = channel.GetUserData(self);
-                  if (!user_data.has_value()) {
-                    return;
-                  }
-                  user_data->get().user_type = user_type;
-                  auto& current_username = user_data.value().get().username;
-                  auto message = SocketMessage::CreateShared();
-                  auto username_change = message->GetMessageBuilder()
-                                                .initRoot<
-                                                  CollabVmServerMessage>()
-                                                .initMessage()
-                                                .initChangeUsername();
-                  username_change.setOldUsername(current_username);
-                  username_change.setNewUsername(new_username);
-
-                  current_username = std::move(new_username);
-
-                  channel.BroadcastMessage(std::move(message));
+                  channel.ChangeUsername(self, std::move(new_username), user_type);
                 };
               if (connected_vm_id_) {
                 server_.virtual_machines_.dispatch([
@@ -1862,153 +2084,282 @@ namespace CollabVm::Server
           });
       }
 
-      void SendRecordingPreviews(
-          std::shared_ptr<CollabVmMessageBuffer>&& buffer,
+      void SendRecordingPreviewResult(bool result) {
+        auto socket_message = SocketMessage::CreateShared();
+        auto& message_builder = socket_message->GetMessageBuilder();
+        message_builder.initRoot<CollabVmServerMessage>()
+                       .initMessage()
+                       .setRecordingPlaybackResult(result);
+        QueueMessage(std::move(socket_message));
+      }
+
+      /*
+       * The start time is where playback begins, and sending another request
+       * for the same VM seeks to its start time. The time interval is the
+       * playback speed, and a stop time that isn't after the start time
+       * stops playback. The live VM isn't shown until playback is stopped.
+       */
+      void PlayRecording(
           CollabVmClientMessage::RecordingPreviewRequest::Reader request) {
-        const auto sendResult = [this](bool result) {
-          auto socket_message = SocketMessage::CreateShared();
-          auto& message_builder = socket_message->GetMessageBuilder();
+        if (request.getStopTime() <= request.getStartTime()) {
+          if (recording_playback_) {
+            recording_playback_->Stop();
+            recording_playback_.reset();
+            SetPlayingRecording(false);
+          }
+          return;
+        }
+        if (recording_playback_
+            && recording_playback_->GetVmId() != request.getVmId()) {
+          recording_playback_->Stop();
+          recording_playback_.reset();
+        }
+        if (!recording_playback_) {
+          recording_playback_ =
+            std::make_shared<RecordingPlayback<CollabVmSocket>>(
+              server_.io_context_, server_.cpu_pool_,
+              server_.recording_index_, shared_from_this(),
+              request.getVmId());
+          SetPlayingRecording(true);
+        }
+        recording_playback_->Play(request.getStartTime(),
+                                  request.getStopTime(),
+                                  request.getTimeInterval());
+      }
+
+      void SetPlayingRecording(bool is_playing_recording) {
+        send_queue_.dispatch(
+          [this, self = shared_from_this(), is_playing_recording](auto&) {
+            is_playing_recording_ = is_playing_recording;
+          });
+        if (is_playing_recording || !connected_vm_id_) {
+          return;
+        }
+        // Replace the recording on the client's display with the live VM
+        server_.virtual_machines_.dispatch(
+          [id = connected_vm_id_, self = shared_from_this()]
+          (auto& virtual_machines) mutable {
+            if (const auto virtual_machine =
+                  virtual_machines.GetAdminVirtualMachine(id)) {
+              virtual_machine->SendDisplay(std::move(self));
+            }
+          });
+      }
+
+      static std::shared_ptr<SocketMessage> CreateRecordingPreviewMessage(
+          std::uint32_t vm_id,
+          std::uint64_t timestamp,
+          const std::vector<std::byte>& png) {
+        auto socket_message = SocketMessage::CreateShared();
+        auto& message_builder = socket_message->GetMessageBuilder();
+        auto thumbnail_message_builder =
           message_builder.initRoot<CollabVmServerMessage>()
                          .initMessage()
-                         .setRecordingPlaybackResult(result);
-          QueueMessage(std::move(socket_message));
-        };
+                         .initRecordingPlaybackPreview();
+        thumbnail_message_builder.setTimestamp(timestamp);
+        auto vm_thumbnail = thumbnail_message_builder.initVmThumbnail();
+        vm_thumbnail.setId(vm_id);
+        vm_thumbnail.setPngBytes(kj::ArrayPtr(
+          reinterpret_cast<const kj::byte*>(png.data()),
+          png.size()));
+        return socket_message;
+      }
+
+      /*
+       * The part of a recording between two keyframes, which can be decoded
+       * independently of the rest of the recording.
+       */
+      struct RecordingPreviewSegment {
+        std::size_t recording_index;
+        std::uint64_t start_time;
+        std::uint64_t stop_time;
+        std::vector<std::shared_ptr<SocketMessage>> previews;
+        bool finished = false;
+      };
+
+      struct RecordingPreviewJob {
+        std::uint32_t vm_id;
+        std::uint64_t start_time;
+        std::uint64_t time_interval;
+        std::uint32_t width;
+        std::uint32_t height;
+        std::shared_ptr<std::atomic_bool> cancelled;
+        // The admin that the job counts toward until its last worker stops
+        std::string account;
+        std::vector<RecordingIndex::Recording> recordings;
+        std::vector<RecordingPreviewSegment> segments;
+        std::atomic<std::size_t> next_segment = 0;
+        // Guards the members below and the order that previews are sent in
+        std::mutex mutex;
+        std::size_t next_segment_to_send = 0;
+        std::size_t workers = 0;
+      };
+
+      /*
+       * Runs on the CPU pool and splits the request into segments that are
+       * decoded in parallel by up to recording_preview_workers_ workers.
+       * Previews are sent in the order of the request as soon as all
+       * preceding segments have been sent.
+       * With a time interval, a preview is created for each multiple of the
+       * interval after the start time, skipping those that would result in
+       * the same frame. Otherwise, a preview is created for the start time
+       * and each keyframe.
+       */
+      void StartRecordingPreviews(
+          CollabVmClientMessage::RecordingPreviewRequest::Reader request,
+          std::shared_ptr<std::atomic_bool> cancelled,
+          std::string account) {
         if (!request.getStartTime() || !request.getStopTime()) {
-          sendResult(false);
+          FinishRecordingPreviews(*cancelled, false);
+          server_.FinishRecordingPreviewJob(account);
           return;
         }
-        std::uint64_t current_timestamp = request.getStartTime();
-        while (current_timestamp < request.getStopTime()) {
-          const auto [file_path, file_start_time, file_stop_time] =
-            server_.db_.GetRecordingFilePath(
-              request.getVmId(),
-              std::chrono::time_point<std::chrono::system_clock>(
-                std::chrono::milliseconds(current_timestamp)),
-              std::chrono::time_point<std::chrono::system_clock>(
-                std::chrono::milliseconds(request.getStopTime())));
-          if (file_path.empty()) {
-            sendResult(false);
-            return;
-          }
-          auto file_stream =
-            std::ifstream(file_path, std::ifstream::in | std::ifstream::binary);
-          if (!file_stream.is_open()) {
-            current_timestamp =
-              std::chrono::duration_cast<std::chrono::milliseconds>(
-                file_stop_time.time_since_epoch()).count();
-            if (!current_timestamp) {
-              current_timestamp =
-                std::chrono::duration_cast<std::chrono::milliseconds>(
-                  file_start_time.time_since_epoch()).count() + 1;
-            }
-            if (current_timestamp) {
+        auto job = std::make_shared<RecordingPreviewJob>();
+        job->vm_id = request.getVmId();
+        job->start_time = request.getStartTime();
+        job->time_interval = request.getTimeInterval();
+        job->width = request.getWidth();
+        job->height = request.getHeight();
+        job->cancelled = std::move(cancelled);
+        job->account = std::move(account);
+        job->recordings = server_.recording_index_.GetRecordings(
+          request.getVmId(), request.getStartTime(), request.getStopTime());
+        if (job->recordings.empty()) {
+          FinishRecordingPreviews(*job->cancelled, false);
+          server_.FinishRecordingPreviewJob(job->account);
+          return;
+        }
+        for (auto i = std::size_t(0); i < job->recordings.size(); i++) {
+          const auto& recording = job->recordings[i];
+          auto start_time = std::max(job->start_time, recording.start_time);
+          const auto stop_time = recording.stop_time
+                                   ? std::min<std::uint64_t>(
+                                       request.getStopTime(),
+                                       recording.stop_time + 1)
+                                   : request.getStopTime();
+          for (const auto& keyframe : recording.keyframes) {
+            if (keyframe.timestamp <= start_time) {
               continue;
             }
-            sendResult(false);
-            return;
-          }
-          struct RecordingFileStream {
-            std::vector<RecordingFileHeader::Keyframe::Reader> keyframes_;
-            capnp::MallocMessageBuilder file_message_builder;
-            RecordingFileHeader::Reader file_header;
-            std::ifstream file_stream_;
-            kj::std::StdInputStream input_stream;
-            std::vector<RecordingFileHeader::Keyframe::Reader>::const_iterator keyframe_begin_;
-            std::uint64_t current_timestamp;
-            RecordingFileStream(std::ifstream&& file_stream)
-                : file_stream_(std::forward<std::ifstream>(file_stream)),
-                  input_stream(file_stream_) {
-              capnp::readMessageCopy(input_stream, file_message_builder);
-              file_header = file_message_builder.getRoot<RecordingFileHeader>();
-              auto keyframes = file_header.getKeyframes();
-              keyframes_.reserve(file_header.getKeyframesCount());
-              keyframes_.insert(keyframes_.end(), keyframes.begin(), keyframes.begin() + file_header.getKeyframesCount());
-              keyframe_begin_ = keyframes_.cbegin();
-              current_timestamp = file_header.getStartTime();
-            }
-            bool NextKeyframe() {
-              if (std::distance(keyframe_begin_, keyframes_.cend()) > 1) {
-                SeekToKeyframe(std::next(keyframe_begin_));
-                return true;
-              }
-              current_timestamp = GetNextFileTimestamp();
-              return false;
-            }
-            capnp::MallocMessageBuilder message_builder;
-            std::optional<Guacamole::GuacServerInstruction::Reader> ReadGuacamoleInstruction() {
-              std::optional<Guacamole::GuacServerInstruction::Reader> guacamole_instruction;
-              try {
-                CollabVmServerMessage::Message::Reader message;
-                do {
-                  capnp::readMessageCopy(input_stream, message_builder);
-                  message = message_builder.getRoot<CollabVmServerMessage>().getMessage();
-                } while (message.which() != CollabVmServerMessage::Message::Which::GUAC_INSTR);
-                guacamole_instruction = message.getGuacInstr();
-                if (guacamole_instruction->which() == Guacamole::GuacServerInstruction::Which::SYNC) {
-                  current_timestamp = guacamole_instruction->getSync();
-                }
-              } catch (const kj::Exception&) {
-                // End of file or deserialization error
-              }
-              return guacamole_instruction;
-            }
-            bool SeekToTimestamp(std::uint64_t timestamp) {
-              if (timestamp < file_header.getStartTime() || timestamp > file_header.getStopTime()) {
-                return false;
-              }
-              if (timestamp < current_timestamp) {
-                keyframe_begin_ = keyframes_.cbegin();
-              }
-              auto target_keyframe_message_builder = capnp::MallocMessageBuilder();
-              auto target_keyframe = target_keyframe_message_builder
-                .initRoot<RecordingFileHeader::Keyframe>();
-              target_keyframe.setTimestamp(timestamp);
-              auto keyframe = std::lower_bound(
-                std::make_reverse_iterator(keyframe_begin_),
-                keyframes_.crend(),
-                target_keyframe,
-                [](auto a, auto b) {
-                  return a.getTimestamp() > b.getTimestamp();
-                });
-              if (keyframe != keyframes_.crend()) {
-                if (current_timestamp < keyframe->getTimestamp()
-                    || timestamp < current_timestamp) {
-                  SeekToKeyframe(keyframe.base());
-                }
-              }
-              return true;
+            if (keyframe.timestamp >= stop_time) {
+              break;
             }
-            [[nodiscard]]
-            std::uint64_t GetNextFileTimestamp() const {
-              return std::max(file_header.getStartTime() + 1, file_header.getStopTime());
+            job->segments.push_back({i, start_time, keyframe.timestamp});
+            start_time = keyframe.timestamp;
+          }
+          if (start_time < stop_time) {
+            job->segments.push_back({i, start_time, stop_time});
+          }
+        }
+        if (job->segments.empty()) {
+          FinishRecordingPreviews(*job->cancelled, true);
+          server_.FinishRecordingPreviewJob(job->account);
+          return;
+        }
+        job->workers = std::min<std::size_t>(
+          server_.recording_preview_workers_, job->segments.size());
+        // The job was already accepted by the pool, so its workers are
+        // queued even if the pool is busy
+        for (auto i = job->workers; i > 0; i--) {
+          server_.cpu_pool_.Post(CpuPool::Priority::Background,
+            [this, self = shared_from_this(), job]
+            {
+              RunRecordingPreviewWorker(*job);
+            });
+        }
+      }
+
+      void RunRecordingPreviewWorker(RecordingPreviewJob& job) {
+        while (!*job.cancelled) {
+          const auto index = job.next_segment++;
+          if (index >= job.segments.size()) {
+            break;
+          }
+          DecodeRecordingPreviewSegment(job, job.segments[index]);
+          const auto lock = std::lock_guard(job.mutex);
+          job.segments[index].finished = true;
+          for (; job.next_segment_to_send < job.segments.size()
+                 && job.segments[job.next_segment_to_send].finished;
+               job.next_segment_to_send++) {
+            for (auto& preview : job.segments[job.next_segment_to_send].previews) {
+              QueueMessage(std::move(preview));
             }
-          private:
-            void SeekToKeyframe(std::vector<RecordingFileHeader::Keyframe::Reader>::const_iterator keyframe) {
-              file_stream_.seekg(keyframe->getFileOffset());
-              keyframe_begin_ = keyframe;
-              current_timestamp = keyframe->getTimestamp();
+          }
+        }
+        const auto lock = std::lock_guard(job.mutex);
+        if (--job.workers == 0) {
+          FinishRecordingPreviews(*job.cancelled, true);
+          server_.FinishRecordingPreviewJob(job.account);
+        }
+      }
+
+      /*
+       * Sends the result unless the job was already finished or cancelled.
+       */
+      void FinishRecordingPreviews(std::atomic_bool& cancelled, bool success) {
+        if (!cancelled.exchange(true)) {
+          SendRecordingPreviewResult(success);
+        }
+      }
+
+      /*
+       * The job still counts toward its admin's limit until its workers
+       * have stopped.
+       */
+      void CancelRecordingPreviews(std::atomic_bool& cancelled) {
+        cancelled = true;
+      }
+
+      void DecodeRecordingPreviewSegment(RecordingPreviewJob& job,
+                                         RecordingPreviewSegment& segment) {
+        const auto& file = job.recordings[segment.recording_index];
+        const auto getNextTimestamp = [&job](std::uint64_t timestamp) {
+          // The first multiple of the interval after the timestamp
+          return timestamp < job.start_time
+                   ? job.start_time
+                   : job.start_time + ((timestamp - job.start_time)
+                                         / job.time_interval + 1)
+                                      * job.time_interval;
+        };
+        auto current_timestamp = job.time_interval
+                                   ? getNextTimestamp(segment.start_time - 1)
+                                   : segment.start_time;
+        // The file is only opened once a thumbnail isn't found in the cache
+        auto recording = std::optional<RecordingFileReader>();
+        auto screenshot = GuacamoleScreenshot();
+        auto png = std::vector<std::byte>();
+        try {
+          while (current_timestamp < segment.stop_time) {
+            if (*job.cancelled) {
+              return;
             }
-          };
-          try {
-            auto recording = RecordingFileStream(std::move(file_stream));
-            auto png = std::vector<std::byte>();
-            png.reserve(100 * 1'024);
-            auto screenshot = GuacamoleScreenshot();
-            recording.SeekToTimestamp(current_timestamp);
-            auto keyframe_changed = false;
-            while (current_timestamp < request.getStopTime()) {
-              if (keyframe_changed) {
-                screenshot = GuacamoleScreenshot();
-                keyframe_changed = false;
+            auto cache_key = RecordingPreviewCache::Key{
+              file.file_path,
+              file.GetKeyframeOffset(current_timestamp),
+              current_timestamp,
+              job.width,
+              job.height
+            };
+            auto preview_timestamp = std::uint64_t(0);
+            if (const auto preview =
+                  server_.recording_preview_cache_.Get(cache_key)) {
+              preview_timestamp = preview->timestamp;
+              segment.previews.push_back(CreateRecordingPreviewMessage(
+                job.vm_id, preview_timestamp, preview->png));
+            } else {
+              if (!recording) {
+                recording.emplace(file.file_path);
+                recording->SeekToTimestamp(current_timestamp);
+                png.reserve(100 * 1'024);
               }
               // Create a screenshot by reading one or more frames
-              const auto stop_after_single_frame = !request.getTimeInterval();
+              const auto stop_after_single_frame = !job.time_interval;
               auto one_frame = false;
               do {
                 // Read a whole frame
                 std::optional<Guacamole::GuacServerInstruction::Reader> message;
                 do {
-                  message = recording.ReadGuacamoleInstruction();
+                  message = recording->ReadGuacamoleInstruction();
                   if (!message) {
                     break;
                   }
@@ -2021,68 +2372,47 @@ namespace CollabVm::Server
                 // If time interval is zero, read only a single keyframe,
                 // otherwise read all frames that occurred before the timestamp
               } while (!stop_after_single_frame
-                       && recording.current_timestamp < current_timestamp);
+                       && recording->current_timestamp < current_timestamp);
               if (!one_frame) {
-                current_timestamp = recording.GetNextFileTimestamp();
-                break;
+                return;
               }
               png.clear();
               const auto created_screenshot =
                 screenshot.CreateScreenshot(
-                  request.getWidth(), request.getHeight(),
+                  job.width, job.height,
                   [&png](auto png_bytes) {
                     png.insert(png.end(), png_bytes.begin(), png_bytes.end());
                   });
-              auto socket_message = SocketMessage::CreateShared();
-              auto& message_builder = socket_message->GetMessageBuilder();
-              auto thumbnail_message_builder =
-                message_builder.initRoot<CollabVmServerMessage>()
-                               .initMessage()
-                               .initRecordingPlaybackPreview();
-              thumbnail_message_builder.setTimestamp(recording.current_timestamp);
-              auto vm_thumbnail = thumbnail_message_builder.initVmThumbnail();
-              vm_thumbnail.setId(request.getVmId());
-              vm_thumbnail.setPngBytes(kj::ArrayPtr(
-                reinterpret_cast<kj::byte*>(png.data()),
-                png.size()));
-              QueueMessage(std::move(socket_message));
-
-              if (request.getTimeInterval()) {
-                current_timestamp = recording.current_timestamp + request.getTimeInterval();
-                if (!recording.SeekToTimestamp(current_timestamp)) {
-                  break;
-                }
-              } else {
-                const auto next_frame = recording.NextKeyframe();
-                current_timestamp = recording.current_timestamp;
-                if (!next_frame) {
-                  break;
-                }
-                keyframe_changed = true;
+              preview_timestamp = recording->current_timestamp;
+              segment.previews.push_back(CreateRecordingPreviewMessage(
+                job.vm_id, preview_timestamp, png));
+              // The frame may not have been recorded yet if the file is
+              // still being written to
+              if (created_screenshot
+                  && preview_timestamp >= current_timestamp) {
+                server_.recording_preview_cache_.Put(
+                  std::move(cache_key), preview_timestamp, png);
               }
             }
-          } catch (...) {
-            current_timestamp =
-              std::chrono::duration_cast<std::chrono::milliseconds>(
-                file_stop_time.time_since_epoch()).count();
-            if (!current_timestamp) {
-              current_timestamp =
-                std::chrono::duration_cast<std::chrono::milliseconds>(
-                  file_start_time.time_since_epoch()).count() + 1;
+            if (!job.time_interval) {
+              return;
             }
+            current_timestamp = getNextTimestamp(preview_timestamp);
           }
+        } catch (...) {
+          // Skip files that are missing or corrupted
         }
-        sendResult(true);
       }
 
       CollabVmServer& server_;
       StrandGuard<std::queue<std::shared_ptr<SocketMessage>>> send_queue_;
       bool sending_ = false;
-      StrandGuard<std::unordered_map<
-        std::uint32_t,
-        std::pair<std::shared_ptr<CollabVmSocket>, std::uint32_t>>>
-        chat_rooms_;
-      std::uint32_t chat_rooms_id_ = 1;
+      // Guarded by send_queue_, like sending_
+      bool is_playing_recording_ = false;
+
+      // Cancels the current recording preview job
+      StrandGuard<std::shared_ptr<std::atomic_bool>> recording_preview_cancelled_;
+      std::shared_ptr<RecordingPlayback<CollabVmSocket>> recording_playback_;
 
       std::vector<std::byte> totp_key_;
       bool is_logged_in_ = false;
@@ -2091,45 +2421,177 @@ namespace CollabVm::Server
       bool is_viewing_vm_list_ = false;
       bool is_in_global_chat_ = false;
       bool is_captcha_required_ = false;
-      std::chrono::time_point<std::chrono::steady_clock> last_chat_message_;
+      constexpr static auto rate_limit_log_interval = std::chrono::minutes(1);
+      RateLimiter rate_limiter_;
+      // Points to the rate limiter in the IPData
+      RateLimiter* ip_rate_limiter_ = nullptr;
+      std::chrono::time_point<std::chrono::steady_clock> last_rate_limit_log_;
       std::chrono::time_point<std::chrono::steady_clock> last_username_change_;
       std::uint32_t connected_vm_id_ = 0;
       StrandGuard<std::string> username_;
-      std::shared_ptr<StrandGuard<IPData>> ip_data_;
+      std::shared_ptr<IPData> ip_data_;
       friend class CollabVmServer;
     };
 
     using TServer::io_context_;
 
-    CollabVmServer(const std::string& doc_root)
+    static RateLimits GetDefaultRateLimits() {
+      using namespace std::chrono_literals;
+      auto rate_limits = RateLimits();
+      const auto set_limits = [&rate_limits](auto type,
+                                             TokenBucket::Limit connection_limit,
+                                             TokenBucket::Limit ip_limit) {
+        rate_limits.connection[std::size_t(type)] = connection_limit;
+        rate_limits.ip[std::size_t(type)] = ip_limit;
+      };
+      const auto chat_interval =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Common::chat_rate_limit);
+      set_limits(RateLimitedMessage::Chat, {chat_interval, 1}, {chat_interval / 4, 8});
+      set_limits(RateLimitedMessage::GuacamoleInstruction, {5ms, 100}, {2ms, 200});
+      set_limits(RateLimitedMessage::Vote, {1s, 3}, {500ms, 5});
+      set_limits(RateLimitedMessage::Turn, {1s, 3}, {500ms, 5});
+      return rate_limits;
+    }
+
+    /**
+     * The settings that are given on the command line.
+     */
+    struct Options
+    {
+      RecordingRetention::Policy recording_retention_policy;
+      // Zero uses half the number of cores
+      std::uint32_t recording_preview_workers = 0;
+      std::chrono::milliseconds chat_batch_interval = std::chrono::milliseconds(5);
+      RateLimits rate_limits = GetDefaultRateLimits();
+      std::filesystem::path chat_filter_path;
+      ChatFilter::Action chat_filter_action = ChatFilter::Action::Mask;
+      std::chrono::milliseconds vote_status_interval = std::chrono::milliseconds(250);
+      std::chrono::seconds ip_data_idle_time = std::chrono::minutes(10);
+      std::chrono::milliseconds input_events_flush_interval = std::chrono::seconds(1);
+      std::string chat_log_path = "chat-log.db";
+    };
+
+    CollabVmServer(const std::string& doc_root, const Options& options)
       : TServer(doc_root),
-        settings_(io_context_, db_),
+        settings_(std::make_shared<const ServerSettings>(db_)),
         sessions_(io_context_),
-        guests_(io_context_),
-        ip_data_(io_context_),
+        guests_(1'000, 99'999),
+        ip_data_(GetIPDataIdleTime(options.ip_data_idle_time, options.rate_limits),
+                 max_ip_data_entries),
         ssl_ctx_(boost::asio::ssl::context::sslv23),
         captcha_verifier_(io_context_, ssl_ctx_),
         virtual_machines_(io_context_,
                           io_context_,
                           db_, *this),
         login_strand_(io_context_),
+        cpu_pool_((std::max)(std::thread::hardware_concurrency() / 2, 1u),
+                  max_cpu_pool_tasks),
+        recording_preview_workers_(options.recording_preview_workers
+          ? options.recording_preview_workers
+          : (std::max)(std::thread::hardware_concurrency() / 2, 1u)),
+        chat_batch_interval_(options.chat_batch_interval),
+        vote_status_interval_(options.vote_status_interval),
+        input_events_flush_interval_(options.input_events_flush_interval),
+        rate_limits_(options.rate_limits),
+        recording_index_(db_),
+        recording_preview_cache_(recording_preview_cache_size,
+                                 recording_preview_cache_directory,
+                                 recording_preview_cache_disk_size),
+        recording_retention_(io_context_, db_, recording_index_,
+                             recording_preview_cache_,
+                             options.recording_retention_policy),
         global_chat_room_(
           io_context_,
+          decltype(global_chat_room_)::ConstructWithStrand,
           global_channel_id),
-        guest_rng_(1'000, 99'999),
-        vm_info_timer_(io_context_)
+        direct_messages_(max_direct_message_channels),
+        chat_log_(options.chat_log_path),
+        chat_filter_(io_context_, options.chat_filter_path,
+                     options.chat_filter_action),
+        vm_info_timer_(io_context_),
+        ip_data_timer_(io_context_),
+        recording_preview_cache_timer_(io_context_)
     {
-      settings_.dispatch([this](auto& settings)
-      {
-				ApplySettings(
-          settings.GetServerSettingsMessageBuilder()
-                  .template getRoot<CollabVmServerMessage>()
-                  .getMessage()
-                  .getServerSettings());
-      });
+      ApplySettings(settings_->GetServerSettingsList());
       StartVmInfoUpdate();
     }
 
+    // An IP's rate limits are reset when its data is evicted, so it's kept
+    // for at least as long as it takes the limits to recover
+    static std::chrono::steady_clock::duration GetIPDataIdleTime(
+        std::chrono::seconds idle_time, const RateLimits& rate_limits) {
+      auto min_idle_time = std::chrono::steady_clock::duration(idle_time);
+      for (const auto& limit : rate_limits.ip) {
+        min_idle_time = (std::max)(min_idle_time,
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            limit.interval * limit.burst));
+      }
+      return min_idle_time;
+    }
+
+    void StartIPDataEviction() {
+      ip_data_timer_.expires_after(ip_data_eviction_interval);
+      ip_data_timer_.async_wait(
+        [this](const auto error_code) {
+          if (error_code) {
+            return;
+          }
+          ip_data_.EvictIdle();
+          StartIPDataEviction();
+        });
+    }
+
+    /**
+     * Counts a recording preview job toward an admin's limit, including
+     * cancelled jobs whose workers haven't stopped, so repeated requests
+     * can't pile up decoding work.
+     * @returns false if the admin already has too many jobs.
+     */
+    bool TryStartRecordingPreviewJob(const std::string& account) {
+      const auto lock = std::lock_guard(recording_preview_jobs_mutex_);
+      auto& jobs = recording_preview_jobs_[account];
+      if (jobs >= max_recording_preview_jobs) {
+        return false;
+      }
+      jobs++;
+      return true;
+    }
+
+    void FinishRecordingPreviewJob(const std::string& account) {
+      const auto lock = std::lock_guard(recording_preview_jobs_mutex_);
+      if (const auto it = recording_preview_jobs_.find(account);
+          it != recording_preview_jobs_.end() && --it->second == 0) {
+        recording_preview_jobs_.erase(it);
+      }
+    }
+
+    void StartRecordingPreviewCacheLog() {
+      recording_preview_cache_timer_.expires_after(
+        recording_preview_cache_log_interval);
+      recording_preview_cache_timer_.async_wait(
+        [this](const auto error_code) {
+          if (error_code) {
+            return;
+          }
+          const auto statistics = recording_preview_cache_.GetStatistics();
+          const auto requests =
+            statistics.memory_hits + statistics.disk_hits + statistics.misses;
+          if (requests != recording_preview_cache_requests_) {
+            recording_preview_cache_requests_ = requests;
+            std::cout << "Recording preview cache: "
+                      << static_cast<int>(statistics.GetHitRate() * 100)
+                      << "% hit rate (" << statistics.memory_hits
+                      << " from memory, " << statistics.disk_hits
+                      << " from disk, " << statistics.misses << " misses), "
+                      << statistics.memory_bytes / (1'024 * 1'024)
+                      << " MiB in memory, "
+                      << statistics.disk_bytes / (1'024 * 1'024)
+                      << " MiB on disk" << std::endl;
+          }
+          StartRecordingPreviewCacheLog();
+        });
+    }
+
     void StartVmInfoUpdate() {
       vm_info_timer_.expires_after(vm_info_update_frequency_);
       vm_info_timer_.async_wait(
@@ -2165,11 +2627,17 @@ namespace CollabVm::Server
           });
         });
       }
+      recording_retention_.Start();
+      chat_filter_.Start();
+      StartIPDataEviction();
+      StartRecordingPreviewCacheLog();
       TServer::Start(threads, host, port);
     }
 
     void Stop() override {
       vm_info_timer_.cancel();
+      ip_data_timer_.cancel();
+      recording_preview_cache_timer_.cancel();
       virtual_machines_.dispatch(
         [](auto& virtual_machines)
         {
@@ -2178,6 +2646,10 @@ namespace CollabVm::Server
               vm.Stop();
             });
         });
+      cpu_pool_.Stop();
+      recording_retention_.Stop();
+      chat_log_.Stop();
+      chat_filter_.Stop();
       TServer::Stop();
     }
 
@@ -2193,6 +2665,18 @@ namespace CollabVm::Server
       return db_;
     }
 
+    RecordingIndex& GetRecordingIndex() {
+      return recording_index_;
+    }
+
+    std::chrono::milliseconds GetVoteStatusInterval() const {
+      return vote_status_interval_;
+    }
+
+    std::chrono::milliseconds GetInputEventsFlushInterval() const {
+      return input_events_flush_interval_;
+    }
+
   protected:
     std::shared_ptr<typename TServer::TSocket> CreateSocket(
       boost::asio::io_context& io_context,
@@ -2208,6 +2692,13 @@ namespace CollabVm::Server
     {
       captcha_verifier_.SetSettings(
         settings[ServerSetting::Setting::CAPTCHA].getSetting().getCaptcha());
+      max_connections_per_ip_.store(
+        settings[ServerSetting::Setting::MAX_CONNECTIONS_ENABLED]
+          .getSetting().getMaxConnectionsEnabled()
+        ? settings[ServerSetting::Setting::MAX_CONNECTIONS]
+            .getSetting().getMaxConnections()
+        : 0,
+        std::memory_order_relaxed);
       auto recordings_message_builder = std::make_shared<capnp::MallocMessageBuilder>();
       recordings_message_builder->setRoot(
         settings[ServerSetting::Setting::RECORDINGS].getSetting().getRecordings());
@@ -2287,65 +2778,72 @@ namespace CollabVm::Server
                  TCallback&& callback) {
       GetChannel(channel_id,
         [username, callback = std::forward<TCallback>(callback)](auto& channel) {
-          const auto& users = channel.GetUsers();
-          const auto user = std::find_if(users.cbegin(), users.cend(), [username](auto& user) {
-            auto& [socket, user_data] = user;
-            return user_data.username == username;
-          });
-          if (user != users.cend()) {
-            callback(*user);
-          }
+          channel.FindUser(username, callback);
         });
     }
 
-    template<typename TCallback>
-    void GetIPData(const typename TServer::TSocket::IpAddress& ip_address, TCallback&& callback) {
-      ip_data_.dispatch(
-        [this, &ip_address, callback = std::forward<TCallback>(callback)]
-        (auto& ip_data) {
-          auto data = ip_data.find(ip_address.AsBytes());
-          callback((data == ip_data.end()
-            ? ip_data.try_emplace(ip_address.AsBytes(), std::make_shared<StrandGuard<IPData>>(io_context_)).first
-            : data)->second);
-        });
+    std::shared_ptr<IPData> AcquireIPData(
+        const typename TServer::TSocket::IpAddress::IpBytes& ip_address) {
+      return ip_data_.Acquire(ip_address, [] {
+        return std::make_shared<IPData>();
+      });
     }
 
-    struct ServerSettingsList
+    void ReleaseIPData(const typename TServer::TSocket::IpAddress::IpBytes& ip_address) {
+      ip_data_.Release(ip_address);
+    }
+
+    /**
+     * An immutable snapshot of the server settings. Changes are made by
+     * publishing a new snapshot, so a snapshot can be read from any thread
+     * without locking.
+     */
+    class ServerSettings
     {
-      ServerSettingsList(Database& db)
-        : db_(db),
-          settings_(std::make_unique<capnp::MallocMessageBuilder>()),
-          settings_list_(InitSettings(*settings_))
+    public:
+      explicit ServerSettings(Database& db)
       {
-        db_.LoadServerSettings(settings_list_);
+        auto settings_list = InitSettings(message_builder_);
+        db.LoadServerSettings(settings_list);
+        Finish(settings_list);
       }
 
+      /**
+       * Creates a copy of the settings with the updates applied.
+       */
+      ServerSettings(const ServerSettings& settings,
+                     const capnp::List<ServerSetting>::Reader updates)
+      {
+        auto settings_list = InitSettings(message_builder_);
+        Database::UpdateList<ServerSetting>(
+          settings.settings_list_, settings_list, updates);
+        Finish(settings_list);
+      }
+
+      ServerSettings(const ServerSettings&) = delete;
+      ServerSettings& operator=(const ServerSettings&) = delete;
+
       ServerSetting::Setting::Reader GetServerSetting(
-        ServerSetting::Setting::Which setting)
+        ServerSetting::Setting::Which setting) const
       {
-        return settings_list_[setting].getSetting().asReader();
+        return settings_list_[setting].getSetting();
       }
 
-      capnp::MallocMessageBuilder& GetServerSettingsMessageBuilder() const
+      capnp::List<ServerSetting>::Reader GetServerSettingsList() const
       {
-        return *settings_;
+        return settings_list_;
       }
 
-      template<typename TCallback>
-      void UpdateServerSettings(
-        const capnp::List<ServerSetting>::Reader updates,
-        TCallback&& callback)
+      /**
+       * @returns The message that sends the settings to admins, which is
+       *          shared by every admin that views them.
+       */
+      const std::shared_ptr<CopiedSocketMessage>& GetServerSettingsMessage() const
       {
-        auto message_builder = std::make_unique<capnp::MallocMessageBuilder>();
-        auto new_settings = InitSettings(*message_builder);
-        Database::UpdateList<ServerSetting>(settings_list_, new_settings, updates);
-        db_.SaveServerSettings(updates);
-        auto current_settings = settings_list_;
-        settings_list_ = new_settings;
-        callback(new_settings, current_settings);
-        settings_ = std::move(message_builder);
+        return settings_message_;
       }
 
+    private:
       static capnp::List<ServerSetting>::Builder InitSettings(
         capnp::MallocMessageBuilder& message_builder)
       {
@@ -2356,12 +2854,45 @@ namespace CollabVm::Server
                               .initServerSettings(fields_count);
       }
 
-    private:
-      Database& db_;
-      std::unique_ptr<capnp::MallocMessageBuilder> settings_;
-      capnp::List<ServerSetting>::Builder settings_list_;
+      void Finish(capnp::List<ServerSetting>::Builder settings_list)
+      {
+        settings_list_ = settings_list.asReader();
+        settings_message_ = SocketMessage::CopyFromMessageBuilder(message_builder_);
+      }
+
+      capnp::MallocMessageBuilder message_builder_;
+      capnp::List<ServerSetting>::Reader settings_list_;
+      std::shared_ptr<CopiedSocketMessage> settings_message_;
     };
 
+    /**
+     * Gets the current settings with a single atomic load. The snapshot
+     * stays valid for as long as it's held, even if the settings change.
+     */
+    std::shared_ptr<const ServerSettings> GetSettings() const
+    {
+      return std::atomic_load_explicit(&settings_, std::memory_order_acquire);
+    }
+
+    /**
+     * Saves the updates and publishes a new snapshot of the settings, which
+     * every later call to GetSettings will return.
+     */
+    std::shared_ptr<const ServerSettings> UpdateServerSettings(
+      const capnp::List<ServerSetting>::Reader updates)
+    {
+      // Writers are serialized so no update is lost, but readers never wait
+      const auto lock = std::lock_guard(settings_update_mutex_);
+      const auto current_settings = GetSettings();
+      auto new_settings =
+        std::make_shared<const ServerSettings>(*current_settings, updates);
+      db_.SaveServerSettings(updates);
+      std::atomic_store_explicit(&settings_, new_settings, std::memory_order_release);
+      ApplySettings(new_settings->GetServerSettingsList(),
+                    current_settings->GetServerSettingsList());
+      return new_settings;
+    }
+
     template <typename TClient>
     struct VirtualMachinesList
     {
@@ -2964,36 +3495,63 @@ namespace CollabVm::Server
       std::chrono::seconds(10);
 
     Database db_;
-    StrandGuard<ServerSettingsList> settings_;
+    // Only accessed with the atomic shared_ptr functions
+    std::shared_ptr<const ServerSettings> settings_;
+    std::mutex settings_update_mutex_;
     using SessionMap = std::unordered_map<SessionId,
                                           std::shared_ptr<Socket>
                                           >;
     StrandGuard<SessionMap> sessions_;
-    StrandGuard<
-      std::unordered_map<
-        std::string,
-        std::shared_ptr<Socket>,
-        CaseInsensitiveHasher,
-        CaseInsensitiveComparator
-      >
-    >
-    guests_;
-    StrandGuard<
-      std::unordered_map<
-        typename Socket::IpAddress::IpBytes,
-        std::shared_ptr<StrandGuard<IPData>>,
-        boost::hash<typename Socket::IpAddress::IpBytes>
-      >
+    UsernameRegistry<Socket, CollabVm::Common::max_username_len> guests_;
+    constexpr static std::size_t max_ip_data_entries = 1'000'000;
+    constexpr static auto ip_data_eviction_interval = std::chrono::seconds(30);
+    IPDataTable<
+      typename Socket::IpAddress::IpBytes,
+      std::shared_ptr<IPData>,
+      boost::hash<typename Socket::IpAddress::IpBytes>
     > ip_data_;
+    // The maximum number of connections from an IP, or zero for no limit
+    std::atomic<std::uint32_t> max_connections_per_ip_ = 0;
     boost::asio::ssl::context ssl_ctx_;
     CaptchaVerifier captcha_verifier_;
   public:
     StrandGuard<VirtualMachinesList<CollabVmSocket<typename TServer::TSocket>>>
     virtual_machines_;
     boost::asio::io_context::strand login_strand_;
+    // The number of recording preview jobs of each admin that have workers
+    // running, which are declared before the CPU pool so they outlive it
+    constexpr static auto max_recording_preview_jobs = 2u;
+    std::mutex recording_preview_jobs_mutex_;
+    std::unordered_map<std::string, std::uint32_t> recording_preview_jobs_;
+    // Used for CPU-intensive work so the io_context threads remain responsive
+    CpuPool cpu_pool_;
+    // The maximum number of tasks of each priority waiting for the CPU pool
+    constexpr static std::size_t max_cpu_pool_tasks = 1'024;
+    // The maximum number of threads used by a single preview request
+    const std::uint32_t recording_preview_workers_;
+    // Chat messages sent within this interval are broadcast together
+    const std::chrono::milliseconds chat_batch_interval_;
+    const std::chrono::milliseconds vote_status_interval_;
+    const std::chrono::milliseconds input_events_flush_interval_;
+    const RateLimits rate_limits_;
+    constexpr static auto recording_preview_cache_size = 64 * 1'024 * 1'024;
+    constexpr static auto recording_preview_cache_directory = "./recordings/previews/";
+    constexpr static auto recording_preview_cache_disk_size =
+      std::uint64_t(1'024) * 1'024 * 1'024;
+    constexpr static auto recording_preview_cache_log_interval =
+      std::chrono::hours(1);
+    RecordingIndex recording_index_;
+    RecordingPreviewCache recording_preview_cache_;
+    RecordingRetention recording_retention_;
     StrandGuard<UserChannel<Socket, typename CollabVmSocket<typename TServer::TSocket>::UserData>> global_chat_room_;
-    std::uniform_int_distribution<std::uint32_t> guest_rng_;
-    std::default_random_engine rng_{std::random_device()()};
+    constexpr static auto max_direct_message_channels = 10;
+    DirectMessageRegistry<Socket> direct_messages_;
+    ChatLog chat_log_;
+    ChatFilterFile chat_filter_;
     boost::asio::steady_timer vm_info_timer_;
+    boost::asio::steady_timer ip_data_timer_;
+    boost::asio::steady_timer recording_preview_cache_timer_;
+    // Only accessed by the timer's handler
+    std::uint64_t recording_preview_cache_requests_ = 0;
   };
 } // namespace CollabVm::Server
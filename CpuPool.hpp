@@ -0,0 +1,386 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace CollabVm::Server
+{
+/**
+ * A pool of threads for CPU-heavy tasks, like hashing passwords and
+ * encoding screenshots, so they don't delay the threads that handle I/O.
+ * Each worker has its own queues, and a worker that runs out of tasks takes
+ * the oldest ones from the other workers. Interactive tasks are always run
+ * before background tasks.
+ * The queues are bounded: TryPost fails once a priority has too many tasks
+ * waiting, so callers can reject new work instead of falling behind.
+ * The pool is also an execution context, so strands can be made from its
+ * executors. Thread-safe.
+ */
+class CpuPool : public boost::asio::execution_context
+{
+public:
+  enum class Priority : std::uint8_t
+  {
+    Interactive,
+    Background
+  };
+
+  class executor_type;
+
+  /**
+   * @param max_queued_tasks The maximum number of tasks of each priority
+   *                         that TryPost will queue.
+   */
+  CpuPool(std::uint32_t threads_count, std::size_t max_queued_tasks)
+    : max_queued_tasks_(max_queued_tasks)
+  {
+    threads_count = (std::max)(threads_count, 1u);
+    for (auto i = 0u; i < threads_count; i++)
+    {
+      workers_.emplace_back(std::make_unique<Worker>());
+    }
+    for (auto i = 0u; i < threads_count; i++)
+    {
+      threads_.emplace_back([this, i] { RunWorker(i); });
+    }
+  }
+
+  CpuPool(const CpuPool&) = delete;
+  CpuPool& operator=(const CpuPool&) = delete;
+
+  ~CpuPool()
+  {
+    Stop();
+    Join();
+    // Destroy the abandoned tasks before the services they might use
+    for (auto& worker : workers_)
+    {
+      for (auto& tasks : worker->tasks)
+      {
+        auto abandoned_tasks = std::move(tasks);
+      }
+    }
+    shutdown();
+    destroy();
+  }
+
+  /**
+   * Queues a task unless there are already too many tasks of its priority.
+   * @returns Whether the task was queued.
+   */
+  template<typename TTask>
+  bool TryPost(Priority priority, TTask&& task)
+  {
+    auto& queued_count = queued_counts_[Index(priority)];
+    if (queued_count.fetch_add(1) >= max_queued_tasks_)
+    {
+      queued_count.fetch_sub(1);
+      return false;
+    }
+    Push(priority, std::forward<TTask>(task));
+    return true;
+  }
+
+  /**
+   * Queues work and passes its result to the handler, which is invoked
+   * with the handler's associated executor, like a strand.
+   * @returns Whether the work was queued.
+   */
+  template<typename TWork, typename THandler>
+  bool TryPost(Priority priority, TWork&& work, THandler&& handler)
+  {
+    auto executor =
+      boost::asio::get_associated_executor(handler, get_executor(priority));
+    return TryPost(priority,
+      [work = std::forward<TWork>(work),
+       handler = std::forward<THandler>(handler),
+       work_guard = boost::asio::make_work_guard(executor)]() mutable
+      {
+        if constexpr (std::is_void_v<std::invoke_result_t<TWork&>>)
+        {
+          work();
+          boost::asio::post(work_guard.get_executor(), std::move(handler));
+        }
+        else
+        {
+          boost::asio::post(work_guard.get_executor(),
+            [handler = std::move(handler), result = work()]() mutable
+            {
+              handler(std::move(result));
+            });
+        }
+      });
+  }
+
+  /**
+   * Queues a task even if its priority's queue is full. This is for tasks
+   * that belong to work that has already been accepted.
+   */
+  template<typename TTask>
+  void Post(Priority priority, TTask&& task)
+  {
+    queued_counts_[Index(priority)].fetch_add(1);
+    Push(priority, std::forward<TTask>(task));
+  }
+
+  executor_type get_executor(Priority priority = Priority::Background);
+
+  [[nodiscard]]
+  std::size_t GetQueuedCount(Priority priority) const
+  {
+    return queued_counts_[Index(priority)].load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]]
+  bool RunningInThisThread() const
+  {
+    return current_pool_ == this;
+  }
+
+  /**
+   * Stops the workers once they finish their current tasks. Tasks that
+   * haven't started are destroyed with the pool.
+   */
+  void Stop()
+  {
+    {
+      const auto lock = std::lock_guard(sleep_mutex_);
+      stopped_ = true;
+    }
+    wake_.notify_all();
+  }
+
+  void Join()
+  {
+    for (auto& thread : threads_)
+    {
+      if (thread.joinable())
+      {
+        thread.join();
+      }
+    }
+  }
+
+private:
+  constexpr static std::size_t priorities_count = 2;
+
+  struct Task
+  {
+    virtual ~Task() = default;
+    virtual void Run() = 0;
+  };
+
+  template<typename TFunction>
+  struct FunctionTask final : Task
+  {
+    explicit FunctionTask(TFunction&& function)
+      : function(std::move(function))
+    {
+    }
+
+    void Run() override
+    {
+      function();
+    }
+
+    TFunction function;
+  };
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::array<std::deque<std::unique_ptr<Task>>, priorities_count> tasks;
+  };
+
+  static std::size_t Index(Priority priority)
+  {
+    return static_cast<std::size_t>(priority);
+  }
+
+  template<typename TTask>
+  void Push(Priority priority, TTask&& task)
+  {
+    auto queued_task = std::make_unique<FunctionTask<std::decay_t<TTask>>>(
+      std::decay_t<TTask>(std::forward<TTask>(task)));
+    // Tasks queued by a worker stay with it unless another worker steals
+    // them, and the others are spread between the workers
+    const auto worker_index = RunningInThisThread()
+      ? current_worker_
+      : next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    auto& worker = *workers_[worker_index];
+    {
+      const auto lock = std::lock_guard(worker.mutex);
+      worker.tasks[Index(priority)].emplace_back(std::move(queued_task));
+    }
+    if (sleeping_count_.load())
+    {
+      // Synchronizes with a worker that is about to wait
+      const auto lock = std::lock_guard(sleep_mutex_);
+    }
+    wake_.notify_one();
+  }
+
+  std::unique_ptr<Task> TryPop(std::size_t worker_index, std::size_t priority)
+  {
+    for (auto i = std::size_t(0); i < workers_.size(); i++)
+    {
+      auto& worker = *workers_[(worker_index + i) % workers_.size()];
+      const auto lock = std::lock_guard(worker.mutex);
+      if (auto& tasks = worker.tasks[priority]; !tasks.empty())
+      {
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        return task;
+      }
+    }
+    return {};
+  }
+
+  bool HasQueuedTasks() const
+  {
+    for (auto& queued_count : queued_counts_)
+    {
+      if (queued_count.load())
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void RunWorker(std::size_t worker_index)
+  {
+    current_pool_ = this;
+    current_worker_ = worker_index;
+    while (!stopped_.load(std::memory_order_relaxed))
+    {
+      auto task = std::unique_ptr<Task>();
+      for (auto priority = std::size_t(0);
+           !task && priority < priorities_count; priority++)
+      {
+        if (queued_counts_[priority].load(std::memory_order_relaxed)
+            && (task = TryPop(worker_index, priority)))
+        {
+          queued_counts_[priority].fetch_sub(1);
+        }
+      }
+      if (task)
+      {
+        task->Run();
+        continue;
+      }
+      auto lock = std::unique_lock(sleep_mutex_);
+      if (stopped_)
+      {
+        break;
+      }
+      sleeping_count_++;
+      wake_.wait(lock, [this] { return stopped_ || HasQueuedTasks(); });
+      sleeping_count_--;
+    }
+    current_pool_ = nullptr;
+  }
+
+  const std::size_t max_queued_tasks_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  // Counts the tasks of each priority that are waiting in any queue
+  std::array<std::atomic<std::size_t>, priorities_count> queued_counts_ = {};
+  std::atomic<std::size_t> next_worker_ = 0;
+  std::atomic<std::size_t> sleeping_count_ = 0;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> stopped_ = false;
+
+  inline static thread_local CpuPool* current_pool_ = nullptr;
+  inline static thread_local std::size_t current_worker_ = 0;
+};
+
+/**
+ * Posts handlers to the pool with a priority, so strands can be used to run
+ * related tasks in order.
+ */
+class CpuPool::executor_type
+{
+public:
+  executor_type(CpuPool& pool, Priority priority) noexcept
+    : pool_(&pool), priority_(priority)
+  {
+  }
+
+  CpuPool& context() const noexcept
+  {
+    return *pool_;
+  }
+
+  void on_work_started() const noexcept
+  {
+  }
+
+  void on_work_finished() const noexcept
+  {
+  }
+
+  template<typename TFunction, typename TAllocator>
+  void dispatch(TFunction&& function, const TAllocator& allocator) const
+  {
+    if (running_in_this_thread())
+    {
+      auto local_function = std::decay_t<TFunction>(
+        std::forward<TFunction>(function));
+      local_function();
+      return;
+    }
+    post(std::forward<TFunction>(function), allocator);
+  }
+
+  template<typename TFunction, typename TAllocator>
+  void post(TFunction&& function, const TAllocator&) const
+  {
+    pool_->Post(priority_, std::forward<TFunction>(function));
+  }
+
+  template<typename TFunction, typename TAllocator>
+  void defer(TFunction&& function, const TAllocator& allocator) const
+  {
+    post(std::forward<TFunction>(function), allocator);
+  }
+
+  bool running_in_this_thread() const noexcept
+  {
+    return pool_->RunningInThisThread();
+  }
+
+  friend bool operator==(const executor_type& a, const executor_type& b) noexcept
+  {
+    return a.pool_ == b.pool_ && a.priority_ == b.priority_;
+  }
+
+  friend bool operator!=(const executor_type& a, const executor_type& b) noexcept
+  {
+    return !(a == b);
+  }
+
+private:
+  CpuPool* pool_;
+  Priority priority_;
+};
+
+inline CpuPool::executor_type CpuPool::get_executor(Priority priority)
+{
+  return executor_type(*this, priority);
+}
+} // namespace CollabVm::Server
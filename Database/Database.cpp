@@ -62,7 +62,14 @@ Database::Database() : db_("collab-vm.db") {
     "  StartTime INTEGER,"
     "  StopTime INTEGER,"
     "  FilePath TEXT NOT NULL UNIQUE,"
+    "  Compacted INTEGER NOT NULL DEFAULT 0,"
     "  PRIMARY KEY (VmId, StartTime))";
+  auto has_compacted_column = false;
+  db_ << "SELECT COUNT(*) > 0 FROM pragma_table_info('Recordings') WHERE name = 'Compacted'"
+      >> has_compacted_column;
+  if (!has_compacted_column) {
+    db_ << "ALTER TABLE Recordings ADD COLUMN Compacted INTEGER NOT NULL DEFAULT 0";
+  }
 
   if (created_new) {
     std::cout << "A new database has been created" << std::endl;
@@ -639,41 +646,16 @@ void Database::SetRecordingStartStopTime(
          time.time_since_epoch()).count();
 }
 
-std::tuple<std::string,
-          std::chrono::time_point<std::chrono::system_clock>,
-          std::chrono::time_point<std::chrono::system_clock>>
-  Database::GetRecordingFilePath(
-    const std::uint32_t vm_id,
-    const std::chrono::time_point<std::chrono::system_clock> start_time,
-    const std::chrono::time_point<std::chrono::system_clock> stop_time)
-{
-  std::string file_path;
-  std::uint64_t file_start_time = 0;
-  std::uint64_t file_stop_time = 0;
-  try {
-    db_ <<
-      "SELECT FilePath, StartTime, StopTime FROM Recordings"
-      "  WHERE VmId = ? AND StartTime >= ? AND StartTime < ?"
-      "  ORDER BY StartTime ASC"
-      "  LIMIT 1"
-      << vm_id
-      << std::chrono::duration_cast<std::chrono::milliseconds>(
-        start_time.time_since_epoch()).count()
-      << std::chrono::duration_cast<std::chrono::milliseconds>(
-        stop_time.time_since_epoch()).count()
-      >> std::tie(file_path, file_start_time, file_stop_time);
-  } catch (const sqlite::sqlite_exception&) {
-  }
-  return { file_path,
-           file_start_time
-           ? std::chrono::time_point<std::chrono::system_clock>(
-               std::chrono::milliseconds(file_start_time))
-           : std::chrono::time_point<std::chrono::system_clock>(),
-           file_stop_time
-           ? std::chrono::time_point<std::chrono::system_clock>(
-               std::chrono::milliseconds(file_stop_time))
-           : std::chrono::time_point<std::chrono::system_clock>()
-         };
+void Database::DeleteRecording(const std::string_view file_path) {
+  db_ <<
+    "DELETE FROM Recordings WHERE FilePath = ?"
+    << std::string(file_path);
+}
+
+void Database::SetRecordingCompacted(const std::string_view file_path) {
+  db_ <<
+    "UPDATE Recordings SET Compacted = 1 WHERE FilePath = ?"
+    << std::string(file_path);
 }
 
 }  // namespace CollabVm::Server
@@ -311,13 +311,41 @@ static Timestamp GetCurrentTimestamp();
     SetRecordingStartStopTime(vm_id, file_path, time, false);
   }
 
-  std::tuple<std::string,
-            std::chrono::time_point<std::chrono::system_clock>,
-            std::chrono::time_point<std::chrono::system_clock>>
-    GetRecordingFilePath(
-      const std::uint32_t vm_id,
-      const std::chrono::time_point<std::chrono::system_clock> start_time,
-      const std::chrono::time_point<std::chrono::system_clock> stop_time);
+  void DeleteRecording(const std::string_view file_path);
+
+  void SetRecordingCompacted(const std::string_view file_path);
+
+  /**
+   * Invokes the callback with the file path of every recording that has had
+   * its audio removed.
+   */
+  template<typename TCallback>
+  void ForEachCompactedRecording(TCallback&& callback)
+  {
+    db_ <<
+      "SELECT FilePath FROM Recordings WHERE Compacted != 0"
+      >> [&](std::string file_path)
+      {
+        callback(std::move(file_path));
+      };
+  }
+
+  /**
+   * Invokes the callback with the VM ID, file path, start time, and stop time
+   * of every recording. The times are in milliseconds and are zero if unset.
+   */
+  template<typename TCallback>
+  void ForEachRecording(TCallback&& callback)
+  {
+    db_ <<
+      "SELECT VmId, FilePath, StartTime, StopTime FROM Recordings"
+      "  ORDER BY VmId, StartTime ASC"
+      >> [&](const std::uint32_t vm_id, std::string file_path,
+             const std::uint64_t start_time, const std::uint64_t stop_time)
+      {
+        callback(vm_id, std::move(file_path), start_time, stop_time);
+      };
+  }
 
  private:
   void CreateTestVm();
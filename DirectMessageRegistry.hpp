@@ -0,0 +1,181 @@
+#pragma once
+
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace CollabVm::Server {
+/**
+ * The direct message channels between every pair of users on the server.
+ * Both users of a channel refer to it by the same ID, and it can be found
+ * by its ID or by the pair of users in constant time. Sending a message only
+ * takes a shared lock, so the only strand that's involved is the recipient's
+ * send queue. Thread-safe.
+ */
+template<typename TUser>
+class DirectMessageRegistry {
+public:
+  enum class Result {
+    Created,
+    Existing,
+    SenderLimitReached,
+    RecipientLimitReached,
+    // One of the users was removed, like when their socket disconnected
+    UserRemoved
+  };
+
+  explicit DirectMessageRegistry(std::size_t max_channels_per_user)
+    : max_channels_per_user_(max_channels_per_user) {
+  }
+
+  /**
+   * @returns The ID of the channel between the users, which is created if
+   * it doesn't exist, neither user has been removed and neither user has
+   * reached the channel limit.
+   */
+  std::pair<Result, std::uint32_t> GetOrCreateChannel(
+      const std::shared_ptr<TUser>& sender,
+      const std::shared_ptr<TUser>& recipient) {
+    assert(sender != recipient);
+    const auto key = GetKey(*sender, *recipient);
+    {
+      const auto lock = std::shared_lock(mutex_);
+      if (const auto it = channel_ids_.find(key); it != channel_ids_.end()) {
+        return {Result::Existing, it->second};
+      }
+    }
+    const auto lock = std::unique_lock(mutex_);
+    if (const auto it = channel_ids_.find(key); it != channel_ids_.end()) {
+      return {Result::Existing, it->second};
+    }
+    if (IsRemoved(sender) || IsRemoved(recipient)) {
+      return {Result::UserRemoved, 0};
+    }
+    if (CountUserChannels(*sender) >= max_channels_per_user_) {
+      return {Result::SenderLimitReached, 0};
+    }
+    if (CountUserChannels(*recipient) >= max_channels_per_user_) {
+      return {Result::RecipientLimitReached, 0};
+    }
+    const auto id = next_id_++;
+    channels_.emplace(id, Channel{sender, recipient});
+    channel_ids_.emplace(key, id);
+    user_channels_[sender.get()].push_back(id);
+    user_channels_[recipient.get()].push_back(id);
+    return {Result::Created, id};
+  }
+
+  /**
+   * @returns The other user in the channel, or nullptr if the channel
+   * doesn't exist or the sender isn't in it.
+   */
+  std::shared_ptr<TUser> GetRecipient(std::uint32_t channel_id,
+                                      const TUser& sender) const {
+    const auto lock = std::shared_lock(mutex_);
+    const auto it = channels_.find(channel_id);
+    if (it == channels_.end()) {
+      return nullptr;
+    }
+    const auto& [first_user, second_user] = it->second;
+    return first_user.get() == &sender
+             ? second_user
+             : second_user.get() == &sender
+                 ? first_user
+                 : nullptr;
+  }
+
+  /**
+   * Removes every channel the user is in. New channels can't be created
+   * with the user afterwards, even by someone who found the user before it
+   * was removed.
+   */
+  void RemoveUser(const std::shared_ptr<TUser>& user_ptr) {
+    const auto& user = *user_ptr;
+    // The users are released after the lock
+    auto removed_channels = std::vector<Channel>();
+    const auto lock = std::unique_lock(mutex_);
+    // Destroyed users are forgotten, because their addresses can be reused
+    if (removed_users_.size() >= max_removed_users_) {
+      for (auto it = removed_users_.begin(); it != removed_users_.end();) {
+        it = it->second.expired() ? removed_users_.erase(it) : std::next(it);
+      }
+      max_removed_users_ =
+        std::max(2 * removed_users_.size(), min_max_removed_users);
+    }
+    removed_users_.insert_or_assign(&user, user_ptr);
+    const auto user_channels = user_channels_.find(&user);
+    if (user_channels == user_channels_.end()) {
+      return;
+    }
+    removed_channels.reserve(user_channels->second.size());
+    for (const auto id : user_channels->second) {
+      const auto channel = channels_.find(id);
+      const auto& [first_user, second_user] = channel->second;
+      const auto& other_user = first_user.get() == &user ? *second_user : *first_user;
+      channel_ids_.erase(GetKey(user, other_user));
+      const auto other_user_channels = user_channels_.find(&other_user);
+      auto& other_channel_ids = other_user_channels->second;
+      other_channel_ids.erase(std::find(other_channel_ids.begin(),
+                                        other_channel_ids.end(), id));
+      if (other_channel_ids.empty()) {
+        user_channels_.erase(other_user_channels);
+      }
+      removed_channels.push_back(std::move(channel->second));
+      channels_.erase(channel);
+    }
+    user_channels_.erase(user_channels);
+  }
+
+  [[nodiscard]]
+  std::size_t GetChannelCount() const {
+    const auto lock = std::shared_lock(mutex_);
+    return channels_.size();
+  }
+
+private:
+  using Channel = std::pair<std::shared_ptr<TUser>, std::shared_ptr<TUser>>;
+  using Key = std::pair<const TUser*, const TUser*>;
+
+  /**
+   * The caller must lock mutex_.
+   */
+  bool IsRemoved(const std::shared_ptr<TUser>& user) const {
+    const auto it = removed_users_.find(user.get());
+    return it != removed_users_.end() && !it->second.expired();
+  }
+
+  /**
+   * The caller must lock mutex_.
+   */
+  std::size_t CountUserChannels(const TUser& user) const {
+    const auto it = user_channels_.find(&user);
+    return it == user_channels_.end() ? 0 : it->second.size();
+  }
+
+  static Key GetKey(const TUser& first_user, const TUser& second_user) {
+    return std::less<const TUser*>()(&first_user, &second_user)
+             ? Key(&first_user, &second_user)
+             : Key(&second_user, &first_user);
+  }
+
+  const std::size_t max_channels_per_user_;
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::uint32_t, Channel> channels_;
+  std::unordered_map<Key, std::uint32_t, boost::hash<Key>> channel_ids_;
+  std::unordered_map<const TUser*, std::vector<std::uint32_t>> user_channels_;
+  // Users that were removed but may still be referenced by other threads
+  std::unordered_map<const TUser*, std::weak_ptr<TUser>> removed_users_;
+  constexpr static std::size_t min_max_removed_users = 64;
+  std::size_t max_removed_users_ = min_max_removed_users;
+  std::uint32_t next_id_ = 1;
+};
+}
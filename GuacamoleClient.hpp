@@ -23,6 +23,7 @@ extern "C" {
 #include <boost/asio.hpp>
 #include <cairo.h>
 #include <capnp/message.h>
+#include <capnp/serialize.h>
 #include <functional>
 #include <gsl/span>
 #include <optional>
@@ -30,6 +31,7 @@ extern "C" {
 #include <memory>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "Guacamole.capnp.h"
 #include "GuacamoleScreenshot.hpp"
@@ -148,7 +150,24 @@ public:
         message_builder.template getRoot<Guacamole::GuacServerInstruction>());
     });
 
-    return screenshot.CreateScreenshot(400, 400, std::forward<TWriteCallback>(callback));
+    return screenshot.CreateScreenshot(GuacamoleScreenshot::thumbnail_size,
+                                       GuacamoleScreenshot::thumbnail_size,
+                                       std::forward<TWriteCallback>(callback));
+  }
+
+  /*
+   * Copies the instructions that draw the display, so a screenshot can be
+   * created from them on another thread.
+   * @returns An empty vector if the client isn't running
+   */
+  std::vector<kj::Array<capnp::word>> CopyScreenshotInstructions()
+  {
+    auto instructions = std::vector<kj::Array<capnp::word>>();
+    AddUser([&instructions](auto&& message_builder)
+    {
+      instructions.emplace_back(capnp::messageToFlatArray(message_builder));
+    });
+    return instructions;
   }
 
 private:
@@ -6,6 +6,10 @@ namespace CollabVm::Server
 {
 struct GuacamoleScreenshot
 {
+  /**
+   * The maximum width and height of VM thumbnails.
+   */
+  constexpr static std::uint32_t thumbnail_size = 400;
   std::unique_ptr<guacenc_display,
                   decltype(&guacenc_display_free)>
     display_ = {guacenc_display_alloc(nullptr, nullptr, 0, 0, 0), &guacenc_display_free};
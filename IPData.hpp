@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include "RateLimiter.hpp"
 
 namespace CollabVm::Server
 {
@@ -11,9 +13,40 @@ namespace CollabVm::Server
 struct IPData
 {
   /**
-   * The number of active connections from the IP.
+   * The number of active connections from the IP. It can be used without
+   * dispatching to a strand, so connections are admitted in the accept path.
    */
-  std::uint8_t connections = 0;
+  std::atomic<std::uint32_t> connections = 0;
+
+  /**
+   * Counts a new connection unless the IP already has the maximum number.
+   * @param max_connections The maximum, or zero for no limit.
+   * @returns Whether the connection was counted.
+   */
+  bool TryAddConnection(std::uint32_t max_connections)
+  {
+    auto count = connections.load(std::memory_order_relaxed);
+    do
+    {
+      if (max_connections && count >= max_connections)
+      {
+        return false;
+      }
+    } while (!connections.compare_exchange_weak(count, count + 1,
+                                                std::memory_order_relaxed));
+    return true;
+  }
+
+  void RemoveConnection()
+  {
+    connections.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Limits the rate of messages from every connection of the IP combined.
+   * It can be used without dispatching to the IP's strand.
+   */
+  RateLimiter rate_limiter;
 
   /**
    * IP data associated with a VM.
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace CollabVm::Server
+{
+/**
+ * The data for each IP address with connections to the server. Entries are
+ * counted while they're in use, and an entry that has had no users for the
+ * idle time is evicted. Unused entries are kept in a list ordered by when
+ * they were released, so finding the expired ones never visits the others.
+ * The table is also bounded: once it is full, the oldest unused entry is
+ * evicted early to make room for a new one.
+ * The entries are split between shards with separate locks, which are only
+ * held to look up an entry, so the table can be used from the accept path
+ * of every thread. Thread-safe.
+ */
+template<typename TKey, typename TValue, typename THasher = std::hash<TKey>,
+         std::size_t ShardCount = 16>
+class IPDataTable
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  IPDataTable(Clock::duration idle_time, std::size_t max_size)
+    : idle_time_(idle_time),
+      max_shard_size_((std::max)(max_size / ShardCount, std::size_t(1)))
+  {
+  }
+
+  IPDataTable(const IPDataTable&) = delete;
+  IPDataTable& operator=(const IPDataTable&) = delete;
+
+  /**
+   * Gets the entry for the key, creating it if it doesn't exist, and marks
+   * it as used until Release is called.
+   */
+  template<typename TCreateValue>
+  TValue Acquire(const TKey& key, TCreateValue&& create_value)
+  {
+    auto& shard = GetShard(key);
+    const auto lock = std::lock_guard(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end())
+    {
+      if (shard.entries.size() >= max_shard_size_ && shard.oldest_idle)
+      {
+        shard.Evict(*shard.oldest_idle);
+      }
+      it = shard.entries.try_emplace(key, create_value()).first;
+      it->second.key = &it->first;
+    }
+    auto& entry = it->second;
+    if (!entry.users++)
+    {
+      shard.UnlinkIdle(entry);
+    }
+    return entry.value;
+  }
+
+  void Release(const TKey& key, Clock::time_point now = Clock::now())
+  {
+    auto& shard = GetShard(key);
+    const auto lock = std::lock_guard(shard.mutex);
+    const auto it = shard.entries.find(key);
+    if (it == shard.entries.end() || !it->second.users)
+    {
+      return;
+    }
+    auto& entry = it->second;
+    if (!--entry.users)
+    {
+      entry.idle_since = now;
+      shard.LinkIdle(entry);
+    }
+  }
+
+  /**
+   * Evicts the entries that haven't been used for the idle time.
+   * @returns The number of evicted entries.
+   */
+  std::size_t EvictIdle(Clock::time_point now = Clock::now())
+  {
+    auto evicted = std::size_t(0);
+    for (auto& shard : shards_)
+    {
+      const auto lock = std::lock_guard(shard.mutex);
+      auto shard_evicted = std::size_t(0);
+      while (shard.oldest_idle
+             && now - shard.oldest_idle->idle_since >= idle_time_)
+      {
+        shard.Evict(*shard.oldest_idle);
+        shard_evicted++;
+      }
+      // Release the buckets left behind by a burst of addresses
+      if (shard_evicted && shard.entries.bucket_count()
+            > 8 * (std::max)(shard.entries.size(), min_bucket_count))
+      {
+        shard.entries.rehash(0);
+      }
+      evicted += shard_evicted;
+    }
+    return evicted;
+  }
+
+  [[nodiscard]]
+  std::size_t GetSize() const
+  {
+    auto size = std::size_t(0);
+    for (auto& shard : shards_)
+    {
+      const auto lock = std::lock_guard(shard.mutex);
+      size += shard.entries.size();
+    }
+    return size;
+  }
+
+  [[nodiscard]]
+  std::size_t GetIdleCount() const
+  {
+    auto idle_count = std::size_t(0);
+    for (auto& shard : shards_)
+    {
+      const auto lock = std::lock_guard(shard.mutex);
+      idle_count += shard.idle_count;
+    }
+    return idle_count;
+  }
+
+  [[nodiscard]]
+  Clock::duration GetIdleTime() const
+  {
+    return idle_time_;
+  }
+
+private:
+  struct Entry
+  {
+    explicit Entry(TValue value) : value(std::move(value))
+    {
+    }
+
+    TValue value;
+    std::uint32_t users = 0;
+    Clock::time_point idle_since;
+    // The neighbours in the list of unused entries
+    Entry* older = nullptr;
+    Entry* newer = nullptr;
+    // Points to the key in the map, whose nodes don't move
+    const TKey* key = nullptr;
+  };
+
+  struct Shard
+  {
+    void LinkIdle(Entry& entry)
+    {
+      entry.older = newest_idle;
+      entry.newer = nullptr;
+      (newest_idle ? newest_idle->newer : oldest_idle) = &entry;
+      newest_idle = &entry;
+      idle_count++;
+    }
+
+    void UnlinkIdle(Entry& entry)
+    {
+      // New entries aren't in the list
+      if (!entry.older && !entry.newer && oldest_idle != &entry)
+      {
+        return;
+      }
+      (entry.older ? entry.older->newer : oldest_idle) = entry.newer;
+      (entry.newer ? entry.newer->older : newest_idle) = entry.older;
+      entry.older = entry.newer = nullptr;
+      idle_count--;
+    }
+
+    void Evict(Entry& entry)
+    {
+      UnlinkIdle(entry);
+      // The key is copied since it's destroyed with the entry
+      const auto key = *entry.key;
+      entries.erase(key);
+    }
+
+    mutable std::mutex mutex;
+    std::unordered_map<TKey, Entry, THasher> entries;
+    Entry* oldest_idle = nullptr;
+    Entry* newest_idle = nullptr;
+    std::size_t idle_count = 0;
+  };
+
+  Shard& GetShard(const TKey& key)
+  {
+    // Mixed so the shard doesn't depend on the bits used by the hash tables
+    auto hash = static_cast<std::uint64_t>(THasher()(key));
+    hash = (hash ^ (hash >> 31)) * 0x9E37'79B9'7F4A'7C15u;
+    return shards_[(hash >> 32) % ShardCount];
+  }
+
+  constexpr static std::size_t min_bucket_count = 64;
+  const Clock::duration idle_time_;
+  const std::size_t max_shard_size_;
+  std::array<Shard, ShardCount> shards_;
+};
+} // namespace CollabVm::Server
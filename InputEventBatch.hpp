@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <gsl/span>
+
+namespace CollabVm::Server {
+// Batches are stored in blob instructions with this stream index, which
+// Guacamole never uses because its stream indices are non-negative
+constexpr auto input_event_batch_stream = -1;
+
+struct InputEvent {
+  enum class Type : std::uint8_t {
+    Mouse,
+    Key
+  };
+
+  Type type;
+  std::uint64_t timestamp;
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t button_mask;
+  std::uint32_t keysym;
+  bool pressed;
+
+  bool operator==(const InputEvent& event) const {
+    return type == event.type && timestamp == event.timestamp
+        && (type == Type::Mouse
+              ? x == event.x && y == event.y && button_mask == event.button_mask
+              : keysym == event.keysym && pressed == event.pressed);
+  }
+};
+
+/**
+ * Packs mouse and key events into a compact byte string. Each event starts
+ * with a tag byte followed by the time since the previous event as a varint.
+ * Mouse coordinates are stored relative to the previous mouse event as
+ * zigzag-encoded varints, and the button mask is only stored if it changed.
+ * Every batch can be decoded on its own.
+ */
+class InputEventBatchWriter {
+public:
+  void Add(const InputEvent& event) {
+    if (data_.empty()) {
+      previous_timestamp_ = 0;
+      previous_x_ = 0;
+      previous_y_ = 0;
+      previous_button_mask_ = 0;
+    }
+    auto tag = std::uint8_t(event.type);
+    if (event.type == InputEvent::Type::Mouse) {
+      if (event.button_mask != previous_button_mask_) {
+        tag |= changed_flag;
+      }
+    } else if (event.pressed) {
+      tag |= pressed_flag;
+    }
+    data_.push_back(std::byte(tag));
+    WriteVarint(event.timestamp - previous_timestamp_);
+    previous_timestamp_ = event.timestamp;
+    if (event.type == InputEvent::Type::Mouse) {
+      WriteVarint(ZigzagEncode(std::int64_t(event.x) - previous_x_));
+      WriteVarint(ZigzagEncode(std::int64_t(event.y) - previous_y_));
+      previous_x_ = event.x;
+      previous_y_ = event.y;
+      if (tag & changed_flag) {
+        WriteVarint(static_cast<std::uint32_t>(event.button_mask));
+        previous_button_mask_ = event.button_mask;
+      }
+    } else {
+      WriteVarint(event.keysym);
+    }
+  }
+
+  [[nodiscard]]
+  bool IsEmpty() const {
+    return data_.empty();
+  }
+
+  [[nodiscard]]
+  gsl::span<const std::byte> GetData() const {
+    return data_;
+  }
+
+  void Clear() {
+    data_.clear();
+  }
+
+  constexpr static std::uint8_t changed_flag = 0b10;
+  constexpr static std::uint8_t pressed_flag = 0b10;
+
+private:
+  static std::uint64_t ZigzagEncode(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ (value >> 63);
+  }
+
+  void WriteVarint(std::uint64_t value) {
+    while (value >= 0x80) {
+      data_.push_back(std::byte(value | 0x80));
+      value >>= 7;
+    }
+    data_.push_back(std::byte(value));
+  }
+
+  std::vector<std::byte> data_;
+  std::uint64_t previous_timestamp_ = 0;
+  std::int32_t previous_x_ = 0;
+  std::int32_t previous_y_ = 0;
+  std::int32_t previous_button_mask_ = 0;
+};
+
+/**
+ * Decodes the events written by InputEventBatchWriter without copying
+ * the data.
+ */
+class InputEventBatchReader {
+public:
+  explicit InputEventBatchReader(gsl::span<const std::byte> data)
+    : data_(data.data()),
+      size_(data.size()) {
+  }
+
+  /**
+   * @returns An empty optional at the end of the batch or if it's corrupted.
+   */
+  std::optional<InputEvent> Next() {
+    if (position_ >= size_) {
+      return {};
+    }
+    const auto tag = std::to_integer<std::uint8_t>(data_[position_++]);
+    auto event = InputEvent();
+    event.type = InputEvent::Type(tag & 1);
+    auto time_delta = std::uint64_t();
+    if (!ReadVarint(time_delta)) {
+      return {};
+    }
+    previous_timestamp_ += time_delta;
+    event.timestamp = previous_timestamp_;
+    if (event.type == InputEvent::Type::Mouse) {
+      auto x_delta = std::uint64_t();
+      auto y_delta = std::uint64_t();
+      if (!ReadVarint(x_delta) || !ReadVarint(y_delta)) {
+        return {};
+      }
+      previous_x_ = static_cast<std::int32_t>(previous_x_ + ZigzagDecode(x_delta));
+      previous_y_ = static_cast<std::int32_t>(previous_y_ + ZigzagDecode(y_delta));
+      if (tag & InputEventBatchWriter::changed_flag) {
+        auto button_mask = std::uint64_t();
+        if (!ReadVarint(button_mask)) {
+          return {};
+        }
+        previous_button_mask_ = static_cast<std::int32_t>(button_mask);
+      }
+      event.x = previous_x_;
+      event.y = previous_y_;
+      event.button_mask = previous_button_mask_;
+    } else {
+      auto keysym = std::uint64_t();
+      if (!ReadVarint(keysym)) {
+        return {};
+      }
+      event.keysym = static_cast<std::uint32_t>(keysym);
+      event.pressed = tag & InputEventBatchWriter::pressed_flag;
+    }
+    return event;
+  }
+
+private:
+  static std::int64_t ZigzagDecode(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+  }
+
+  bool ReadVarint(std::uint64_t& value) {
+    value = 0;
+    for (auto shift = 0u; shift < 64; shift += 7) {
+      if (position_ >= size_) {
+        position_ = size_;
+        return false;
+      }
+      const auto byte = std::to_integer<std::uint64_t>(data_[position_++]);
+      value |= (byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    position_ = size_;
+    return false;
+  }
+
+  const std::byte* data_;
+  std::size_t size_;
+  std::size_t position_ = 0;
+  std::uint64_t previous_timestamp_ = 0;
+  std::int32_t previous_x_ = 0;
+  std::int32_t previous_y_ = 0;
+  std::int32_t previous_button_mask_ = 0;
+};
+}
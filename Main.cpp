@@ -15,6 +15,7 @@
 #include <iostream>
 #include <sqlite_modern_cpp.h>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <thread>
 #include <rfb/rfbconfig.h>
@@ -36,6 +37,21 @@ int main(int argc, char* argv[]) {
   auto port = 0u;
   auto root = "./web-app/"s;
   auto auto_start_vms = true;
+  auto recordings_max_size = 0u;
+  auto recordings_vm_max_size = 0u;
+  auto recordings_max_age = 0u;
+  auto recordings_compact_age = 0u;
+  // Previews are decoded on the CPU pool, which also has a thread for half
+  // the cores
+  auto preview_workers = std::max(cores / 2, 1u);
+  auto chat_batch_interval = 5u;
+  auto vote_status_interval = 250u;
+  auto input_flush_interval = 1'000u;
+  auto ip_data_idle_time = 600u;
+  auto rate_limits = std::vector<std::string>();
+  auto chat_filter = ""s;
+  auto chat_filter_action = "mask"s;
+  auto chat_log = "chat-log.db"s;
   auto invalid_arguments = std::vector<std::string>();
   enum {
     start,
@@ -56,6 +72,37 @@ int main(int argc, char* argv[]) {
         .doc("path to PEM certificate to use for SSL/TLS"),
       option("--no-autostart", "-n").set(auto_start_vms, false)
         .doc("don't automatically start any VMs"),
+      (option("--recordings-max-size") & integer("MiB", recordings_max_size))
+        .doc("delete the oldest recordings when all of them exceed this size (default: unlimited)"),
+      (option("--recordings-vm-max-size") & integer("MiB", recordings_vm_max_size))
+        .doc("delete the oldest recordings of a VM when they exceed this size (default: unlimited)"),
+      (option("--recordings-max-age") & integer("days", recordings_max_age))
+        .doc("delete recordings older than this (default: unlimited)"),
+      (option("--recordings-compact-age") & integer("days", recordings_compact_age))
+        .doc("remove audio from recordings older than this (default: never)"),
+      (option("--preview-workers") & integer("number", preview_workers))
+        .doc("the number of threads used to create recording previews for a single request (default: "
+          + std::to_string(preview_workers) + " - half the number of cores)"),
+      (option("--chat-batch-interval") & integer("ms", chat_batch_interval))
+        .doc("broadcast chat messages sent within this interval together, or 0 to send each immediately (default: "
+          + std::to_string(chat_batch_interval) + ")"),
+      (option("--vote-status-interval") & integer("ms", vote_status_interval))
+        .doc("the minimum time between vote count updates sent to users, or 0 to send one for every vote (default: "
+          + std::to_string(vote_status_interval) + ")"),
+      (option("--input-flush-interval") & integer("ms", input_flush_interval))
+        .doc("the longest time that recorded input events are buffered before they're written, or 0 to write each immediately (default: "
+          + std::to_string(input_flush_interval) + ")"),
+      (option("--ip-data-idle-time") & integer("seconds", ip_data_idle_time))
+        .doc("forget the data of an IP address after it has had no connections for this long (default: "
+          + std::to_string(ip_data_idle_time) + ")"),
+      repeatable(option("--rate-limit") & value("type=rate[/burst][,ip_rate[/ip_burst]]", rate_limits))
+        .doc("limit the messages per second of a type (chat, input, vote, or turn) from each connection and each IP, or 0 for unlimited"),
+      (option("--chat-filter") & value("path", chat_filter))
+        .doc("a file with a banned chat phrase on each line, which is reloaded when it's modified"),
+      (option("--chat-filter-action") & value("drop|mask|flag", chat_filter_action))
+        .doc("what to do with chat messages that contain a banned phrase (default: " + chat_filter_action + ")"),
+      (option("--chat-log") & value("path", chat_log))
+        .doc("the database that chat messages are logged to (default: '" + chat_log + "')"),
       option("--version", "-v").set(mode, version)
         .doc("show version and dependencies"),
       option("--help", "-h").set(mode, help)
@@ -98,5 +145,38 @@ int main(int argc, char* argv[]) {
   }
 
   using Server = CollabVm::Server::CollabVmServer<CollabVm::Server::WebServer>;
-  Server(root).Start(threads, host, port, auto_start_vms);
+  auto options = Server::Options();
+  for (const auto& rate_limit : rate_limits) {
+    if (!CollabVm::Server::ParseRateLimit(rate_limit, options.rate_limits)) {
+      std::cout << "invalid rate limit '" << rate_limit << "'" << std::endl;
+      return 1;
+    }
+  }
+  constexpr std::string_view chat_filter_actions[] = { "drop", "mask", "flag" };
+  const auto chat_filter_action_it = std::find(std::begin(chat_filter_actions),
+                                               std::end(chat_filter_actions),
+                                               chat_filter_action);
+  if (chat_filter_action_it == std::end(chat_filter_actions)) {
+    std::cout << "invalid chat filter action '" << chat_filter_action << "'" << std::endl;
+    return 1;
+  }
+  options.chat_filter_path = chat_filter;
+  options.chat_log_path = chat_log;
+  options.chat_filter_action = CollabVm::Server::ChatFilter::Action(
+    chat_filter_action_it - std::begin(chat_filter_actions));
+  auto& recording_retention_policy = options.recording_retention_policy;
+  recording_retention_policy.max_total_bytes =
+    std::uint64_t(recordings_max_size) * 1'024 * 1'024;
+  recording_retention_policy.max_vm_bytes =
+    std::uint64_t(recordings_vm_max_size) * 1'024 * 1'024;
+  recording_retention_policy.max_age = std::chrono::hours(24 * recordings_max_age);
+  recording_retention_policy.compact_age =
+    std::chrono::hours(24 * recordings_compact_age);
+  options.recording_preview_workers = preview_workers;
+  options.chat_batch_interval = std::chrono::milliseconds(chat_batch_interval);
+  options.vote_status_interval = std::chrono::milliseconds(vote_status_interval);
+  options.ip_data_idle_time = std::chrono::seconds(ip_data_idle_time);
+  options.input_events_flush_interval =
+    std::chrono::milliseconds(input_flush_interval);
+  Server(root, options).Start(threads, host, port, auto_start_vms);
 }
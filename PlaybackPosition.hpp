@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace CollabVm::Server {
+/**
+ * Schedules the frames of a recording relative to when playback started so
+ * that delays in sending one frame don't push back all of the following
+ * ones.
+ */
+class PlaybackClock {
+public:
+  /**
+   * Only 2x and 8x are supported, and anything else plays at normal speed.
+   */
+  void SetSpeed(std::uint32_t speed) {
+    speed_ = speed == 2 || speed == 8 ? speed : 1;
+  }
+
+  /**
+   * Makes the next frame play immediately, like after seeking or when the
+   * next recording starts.
+   */
+  void Reset() {
+    anchor_timestamp_ = 0;
+  }
+
+  /**
+   * @returns When the frame with the timestamp should be sent.
+   */
+  std::chrono::steady_clock::time_point GetFrameTime(
+      std::uint64_t timestamp, std::chrono::steady_clock::time_point now) {
+    if (!anchor_timestamp_ || timestamp < anchor_timestamp_) {
+      anchor_timestamp_ = timestamp;
+      anchor_time_ = now;
+    }
+    return anchor_time_
+      + std::chrono::milliseconds((timestamp - anchor_timestamp_) / speed_);
+  }
+
+private:
+  std::uint32_t speed_ = 1;
+  std::uint64_t anchor_timestamp_ = 0;
+  std::chrono::steady_clock::time_point anchor_time_;
+};
+
+/**
+ * Moves the reader to the timestamp and writes the instructions before it
+ * to the display. The display is only cleared if the reader moved to a
+ * keyframe, so seeking forward within the same keyframe only decodes the
+ * instructions that were skipped.
+ */
+template<typename TReader, typename TDisplay>
+void SeekRecording(TReader& reader, TDisplay& display, std::uint64_t timestamp) {
+  const auto offset = reader.GetFileOffset();
+  reader.SeekToTimestamp(timestamp);
+  if (reader.GetFileOffset() != offset) {
+    display = TDisplay();
+  }
+  while (reader.current_timestamp < timestamp) {
+    const auto instruction = reader.ReadGuacamoleInstruction();
+    if (!instruction) {
+      break;
+    }
+    display.WriteInstruction(*instruction);
+  }
+}
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+namespace CollabVm::Server
+{
+/**
+ * A token bucket that allows one message per interval on average and up to
+ * the burst size at once. It's implemented as the generic cell rate
+ * algorithm, so the entire state is the time at which the bucket will be
+ * full again. That time is updated with compare-and-swap, so a bucket can be
+ * shared by the connections from an IP address without a lock.
+ */
+class TokenBucket
+{
+public:
+  struct Limit
+  {
+    // A value of zero disables the limit
+    std::chrono::nanoseconds interval = std::chrono::nanoseconds::zero();
+    std::uint32_t burst = 1;
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+      return interval.count() > 0;
+    }
+  };
+
+  bool TryConsume(const Limit& limit, std::chrono::steady_clock::time_point now)
+  {
+    const auto now_ns = ToNanoseconds(now);
+    const auto interval = limit.interval.count();
+    auto full_time = full_time_.load(std::memory_order_relaxed);
+    while (true)
+    {
+      const auto arrival_time = std::max(full_time, now_ns);
+      if (arrival_time - now_ns > GetTolerance(limit))
+      {
+        return false;
+      }
+      if (full_time_.compare_exchange_weak(full_time,
+                                           arrival_time + interval,
+                                           std::memory_order_relaxed))
+      {
+        return true;
+      }
+    }
+  }
+
+  /**
+   * @returns Whether TryConsume would succeed, without taking a token.
+   */
+  [[nodiscard]]
+  bool CanConsume(const Limit& limit, std::chrono::steady_clock::time_point now) const
+  {
+    const auto now_ns = ToNanoseconds(now);
+    return std::max(full_time_.load(std::memory_order_relaxed), now_ns) - now_ns
+           <= GetTolerance(limit);
+  }
+
+private:
+  static std::int64_t ToNanoseconds(std::chrono::steady_clock::time_point time)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      time.time_since_epoch()).count();
+  }
+
+  static std::int64_t GetTolerance(const Limit& limit)
+  {
+    return limit.interval.count() * (std::max(limit.burst, 1u) - 1);
+  }
+
+  std::atomic<std::int64_t> full_time_{0};
+};
+
+/**
+ * The types of client messages that are rate limited.
+ */
+enum class RateLimitedMessage : std::uint8_t
+{
+  Chat,
+  GuacamoleInstruction,
+  Vote,
+  Turn,
+  Count
+};
+
+struct RateLimits
+{
+  using Limits = std::array<TokenBucket::Limit,
+                            std::size_t(RateLimitedMessage::Count)>;
+  Limits connection;
+  // Shared by every connection from the same IP address
+  Limits ip;
+
+  [[nodiscard]]
+  const TokenBucket::Limit& GetConnectionLimit(RateLimitedMessage type) const
+  {
+    return connection[std::size_t(type)];
+  }
+
+  [[nodiscard]]
+  const TokenBucket::Limit& GetIpLimit(RateLimitedMessage type) const
+  {
+    return ip[std::size_t(type)];
+  }
+};
+
+/**
+ * Parses an argument of the form "type=rate[/burst][,ip_rate[/ip_burst]]",
+ * where the type is chat, input, vote, or turn and the rates are in messages
+ * per second. A rate of zero disables the limit.
+ * @returns false if the argument is invalid.
+ */
+inline bool ParseRateLimit(std::string_view argument, RateLimits& limits)
+{
+  const auto separator = argument.find('=');
+  if (separator == std::string_view::npos)
+  {
+    return false;
+  }
+  constexpr std::string_view type_names[] = { "chat", "input", "vote", "turn" };
+  const auto type_name = argument.substr(0, separator);
+  const auto type = static_cast<std::size_t>(
+    std::find(std::begin(type_names), std::end(type_names), type_name)
+    - std::begin(type_names));
+  if (type == std::size(type_names))
+  {
+    return false;
+  }
+  const auto parse_limit = [](std::string_view value, TokenBucket::Limit& limit)
+  {
+    const auto string = std::string(value);
+    auto end = static_cast<char*>(nullptr);
+    const auto rate = std::strtod(string.c_str(), &end);
+    if (end == string.c_str() || rate < 0)
+    {
+      return false;
+    }
+    auto burst = 1ul;
+    if (*end == '/')
+    {
+      const auto burst_begin = end + 1;
+      burst = std::strtoul(burst_begin, &end, 10);
+      if (end == burst_begin || !burst)
+      {
+        return false;
+      }
+    }
+    if (*end)
+    {
+      return false;
+    }
+    limit.interval = rate > 0
+      ? std::chrono::nanoseconds(static_cast<std::int64_t>(1'000'000'000 / rate))
+      : std::chrono::nanoseconds::zero();
+    limit.burst = static_cast<std::uint32_t>(burst);
+    return true;
+  };
+  const auto value = argument.substr(separator + 1);
+  const auto ip_separator = value.find(',');
+  return parse_limit(value.substr(0, ip_separator), limits.connection[type])
+      && (ip_separator == std::string_view::npos
+          || parse_limit(value.substr(ip_separator + 1), limits.ip[type]));
+}
+
+/**
+ * A token bucket for each type of rate limited message, with counters for
+ * the messages that were dropped. Thread-safe.
+ */
+class RateLimiter
+{
+public:
+  bool TryConsume(RateLimitedMessage type,
+                  const TokenBucket::Limit& limit,
+                  std::chrono::steady_clock::time_point now)
+  {
+    if (!limit.IsEnabled()
+        || buckets_[std::size_t(type)].TryConsume(limit, now))
+    {
+      return true;
+    }
+    dropped_counts_[std::size_t(type)].fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /**
+   * Checks a limit without taking a token, so that another limit can be
+   * checked before either is charged. A message that would be dropped is
+   * counted as dropped.
+   */
+  bool CanConsume(RateLimitedMessage type,
+                  const TokenBucket::Limit& limit,
+                  std::chrono::steady_clock::time_point now)
+  {
+    if (!limit.IsEnabled()
+        || buckets_[std::size_t(type)].CanConsume(limit, now))
+    {
+      return true;
+    }
+    dropped_counts_[std::size_t(type)].fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  [[nodiscard]]
+  std::uint64_t GetDroppedCount(RateLimitedMessage type) const
+  {
+    return dropped_counts_[std::size_t(type)].load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<TokenBucket, std::size_t(RateLimitedMessage::Count)> buckets_;
+  std::array<std::atomic<std::uint64_t>, std::size_t(RateLimitedMessage::Count)>
+    dropped_counts_{};
+};
+} // namespace CollabVm::Server
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <kj/std/iostream.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include "CollabVm.capnp.h"
+#include "Guacamole.capnp.h"
+#include "RecordingFileReader.hpp"
+
+namespace CollabVm::Server {
+/**
+ * Tracks the audio streams of a recording so that their audio, blob, and
+ * end instructions can be skipped.
+ * @returns Whether the message belongs to an audio stream.
+ */
+inline bool IsAudioMessage(CollabVmServerMessage::Message::Reader message,
+                           std::unordered_set<std::int32_t>& audio_streams) {
+  if (message.which() != CollabVmServerMessage::Message::GUAC_INSTR) {
+    return false;
+  }
+  const auto instruction = message.getGuacInstr();
+  switch (instruction.which()) {
+  case Guacamole::GuacServerInstruction::AUDIO:
+    audio_streams.insert(instruction.getAudio().getStream());
+    return true;
+  case Guacamole::GuacServerInstruction::BLOB:
+    return audio_streams.count(instruction.getBlob().getStream());
+  case Guacamole::GuacServerInstruction::END:
+    return audio_streams.erase(instruction.getEnd());
+  default:
+    return false;
+  }
+}
+
+/**
+ * Writes a copy of the recording without any audio streams and with the
+ * keyframe offsets in its header updated, so the copy can still be seeked.
+ * A truncated message at the end of the recording is discarded.
+ * @returns false if the recording didn't have any audio, or if it couldn't
+ * be read or the copy couldn't be written.
+ */
+inline bool CompactRecording(const std::string& file_path,
+                             const std::string& output_file_path) {
+  auto removed_audio = false;
+  try {
+    auto reader = RecordingFileReader(file_path);
+    auto header_message_builder = capnp::MallocMessageBuilder();
+    header_message_builder.setRoot(reader.GetHeader());
+    auto keyframes = header_message_builder.getRoot<RecordingFileHeader>()
+                                           .getKeyframes();
+    const auto keyframes_count = reader.GetKeyframes().size();
+    auto file_stream = std::ofstream(
+      output_file_path, std::ofstream::binary | std::ofstream::out);
+    auto output_stream = kj::std::StdOutputStream(file_stream);
+    // The header is the same size when it's written again
+    capnp::writeMessage(output_stream, header_message_builder);
+
+    auto audio_streams = std::unordered_set<std::int32_t>();
+    auto keyframe_index = std::size_t(0);
+    try {
+      while (true) {
+        const auto offset = reader.GetFileOffset();
+        for (; keyframe_index < keyframes_count
+               && keyframes[keyframe_index].getFileOffset() <= offset;
+             keyframe_index++) {
+          keyframes[keyframe_index].setFileOffset(file_stream.tellp());
+        }
+        const auto message = reader.ReadMessage();
+        if (!message) {
+          break;
+        }
+        if (IsAudioMessage(*message, audio_streams)) {
+          removed_audio = true;
+          continue;
+        }
+        const auto bytes = reader.GetMessageBytes();
+        file_stream.write(reinterpret_cast<const char*>(bytes.begin()),
+                          bytes.size());
+      }
+    } catch (const kj::Exception&) {
+      // Discard the truncated message at the end of the file
+    }
+    for (; keyframe_index < keyframes_count; keyframe_index++) {
+      keyframes[keyframe_index].setFileOffset(file_stream.tellp());
+    }
+    if (removed_audio) {
+      file_stream.seekp(0);
+      capnp::writeMessage(output_stream, header_message_builder);
+    }
+    file_stream.close();
+    return removed_audio && file_stream.good();
+  } catch (const kj::Exception&) {
+    return false;
+  }
+}
+}
@@ -13,16 +13,21 @@
 #include <string_view>
 #include <unordered_set>
 #include "CollabVm.capnp.h"
+#include "InputEventBatch.hpp"
 #include "SocketMessage.hpp"
 
 namespace CollabVm::Server {
 template<typename TCallbacks>
 struct RecordingController {
   template<typename TExecutionContext>
-  RecordingController(TExecutionContext& context, std::uint32_t vm_id)
+  RecordingController(TExecutionContext& context,
+                      std::uint32_t vm_id,
+                      std::chrono::milliseconds input_events_flush_interval)
       : vm_id_(vm_id),
         stop_timer_(context),
-        keyframe_timer_(context) {
+        keyframe_timer_(context),
+        input_events_timer_(context),
+        input_events_flush_interval_(input_events_flush_interval) {
   }
 
   void SetRecordingSettings(ServerSetting::Recordings::Reader settings) {
@@ -101,6 +106,8 @@ struct RecordingController {
     }
     keyframe_timer_.cancel();
     stop_timer_.cancel();
+    input_events_timer_.cancel();
+    FlushInputEvents();
     const auto now = std::chrono::system_clock::now();
     auto file_header = file_header_.getRoot<RecordingFileHeader>();
     file_header.setStopTime(
@@ -129,6 +136,9 @@ struct RecordingController {
         || !ShouldRecordMessage(collab_vm_message)) {
       return;
     }
+    if (IsDisplayInstruction(collab_vm_message)) {
+      FlushInputEvents();
+    }
     IncludeTimestamp(collab_vm_message);
     message.CreateFrame();
     for (auto&& buffer : message.GetBuffers()) {
@@ -143,6 +153,9 @@ struct RecordingController {
         || !ShouldRecordMessage(message)) {
       return;
     }
+    if (IsDisplayInstruction(message)) {
+      FlushInputEvents();
+    }
     auto output_stream = kj::std::StdOutputStream(file_stream_);
     IncludeTimestamp(message);
     capnp::writeMessage(output_stream, message_builder);
@@ -154,39 +167,83 @@ struct RecordingController {
     if (!IsRecording() || !settings_.getCaptureInput()) {
       return;
     }
+    // Input events are buffered and written in compact batches
+    // because there are usually a lot of them
+    auto event = InputEvent();
+    event.timestamp =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
     if (guacamole_instruction.which() == Guacamole::GuacClientInstruction::MOUSE) {
-      auto message_builder = capnp::MallocMessageBuilder();
-      auto server_mouse = message_builder
-        .initRoot<CollabVmServerMessage>()
-        .initMessage()
-        .initGuacInstr()
-        .initMouse();
       auto client_mouse = guacamole_instruction.getMouse();
-      server_mouse.setX(client_mouse.getX());
-      server_mouse.setY(client_mouse.getY());
-      server_mouse.setButtonMask(client_mouse.getButtonMask());
-      server_mouse.setTimestamp(
-        std::chrono::duration_cast<std::chrono::milliseconds>(
-          std::chrono::system_clock::now().time_since_epoch()).count());
-      WriteMessage(message_builder);
+      event.type = InputEvent::Type::Mouse;
+      event.x = client_mouse.getX();
+      event.y = client_mouse.getY();
+      event.button_mask = client_mouse.getButtonMask();
     } else if (guacamole_instruction.which() == Guacamole::GuacClientInstruction::KEY) {
-      auto message_builder = capnp::MallocMessageBuilder();
       auto client_key = guacamole_instruction.getKey();
-      auto server_key = message_builder
-        .initRoot<CollabVmServerMessage>()
-        .initMessage()
-        .initGuacInstr()
-        .initKey();
-      server_key.setKeysym(client_key.getKeysym());
-      server_key.setPressed(client_key.getPressed());
-      server_key.setTimestamp(
-        std::chrono::duration_cast<std::chrono::milliseconds>(
-          std::chrono::system_clock::now().time_since_epoch()).count());
-      WriteMessage(message_builder);
+      event.type = InputEvent::Type::Key;
+      event.keysym = client_key.getKeysym();
+      event.pressed = client_key.getPressed();
+    } else {
+      return;
+    }
+    const auto starts_batch = input_events_.IsEmpty();
+    input_events_.Add(event);
+    if (!input_events_flush_interval_.count()) {
+      FlushInputEvents();
+    } else if (starts_batch) {
+      StartInputEventsTimer();
     }
   }
 
 private:
+  // Events are written before the next display update, or after the flush
+  // interval if the display doesn't change, so they stay close to the
+  // frames they happened in
+  void StartInputEventsTimer() {
+    input_events_timer_.expires_after(input_events_flush_interval_);
+    input_events_timer_.async_wait([this](const auto error_code) {
+      if (!error_code && IsRecording()) {
+        FlushInputEvents();
+      }
+    });
+  }
+
+  void FlushInputEvents() {
+    if (input_events_.IsEmpty()) {
+      return;
+    }
+    auto message_builder = capnp::MallocMessageBuilder();
+    auto blob = message_builder
+      .initRoot<CollabVmServerMessage>()
+      .initMessage()
+      .initGuacInstr()
+      .initBlob();
+    blob.setStream(input_event_batch_stream);
+    const auto data = input_events_.GetData();
+    blob.setData(kj::arrayPtr(
+      reinterpret_cast<const kj::byte*>(data.data()), data.size()));
+    auto output_stream = kj::std::StdOutputStream(file_stream_);
+    capnp::writeMessage(output_stream, message_builder);
+    input_events_.Clear();
+  }
+
+  [[nodiscard]]
+  static bool IsDisplayInstruction(CollabVmServerMessage::Message::Reader message) {
+    if (message.which() != CollabVmServerMessage::Message::GUAC_INSTR) {
+      return false;
+    }
+    switch (message.getGuacInstr().which()) {
+    case Guacamole::GuacServerInstruction::AUDIO:
+    case Guacamole::GuacServerInstruction::MOUSE:
+    case Guacamole::GuacServerInstruction::KEY:
+      return false;
+    default:
+      // Includes sync instructions
+      return true;
+    }
+  }
+
   [[nodiscard]]
   bool ShouldRecordMessage(CollabVmServerMessage::Message::Reader message) {
     if (message.which() != CollabVmServerMessage::Message::GUAC_INSTR) {
@@ -262,6 +319,8 @@ private:
         return;
       }
 
+      // Batches don't span keyframes so they can be decoded after seeking
+      FlushInputEvents();
       auto keyframe =
         keyframe_offsets[next_keyframe_offset_ - keyframe_offsets.begin()];
       keyframe.setFileOffset(file_stream_.tellp());
@@ -271,6 +330,8 @@ private:
       ++next_keyframe_offset_;
       file_header.setKeyframesCount(file_header.getKeyframesCount() + 1);
       WriteFileHeader();
+      static_cast<TCallbacks&>(*this).OnKeyframeAdded(
+        keyframe.getFileOffset(), keyframe.getTimestamp());
       StartKeyframeTimer();
     });
   };
@@ -298,6 +359,8 @@ private:
   capnp::List<RecordingFileHeader::Keyframe>::Builder::Iterator next_keyframe_offset_;
   boost::asio::steady_timer stop_timer_;
   boost::asio::steady_timer keyframe_timer_;
+  boost::asio::steady_timer input_events_timer_;
+  const std::chrono::milliseconds input_events_flush_interval_;
   std::chrono::minutes file_duration_ = std::chrono::minutes::zero();
   std::chrono::seconds keyframe_interval_ = std::chrono::seconds::zero();
   std::string filename_;
@@ -305,6 +368,7 @@ private:
   ServerSetting::Recordings::Reader settings_ = settings_message_builder_.initRoot<ServerSetting::Recordings>();
   capnp::MallocMessageBuilder timestamp_message_builder;
   std::unordered_set<std::int32_t> ignored_streams_;
+  InputEventBatchWriter input_events_;
   static constexpr std::string_view recordings_directory = "./recordings/";
 };
 }
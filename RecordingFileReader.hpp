@@ -0,0 +1,249 @@
+#pragma once
+
+#include <capnp/serialize.h>
+#include <kj/filesystem.h>
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "CollabVm.capnp.h"
+#include "Guacamole.capnp.h"
+#include "InputEventBatch.hpp"
+
+namespace CollabVm::Server {
+/**
+ * Reads a recording file by memory-mapping it and constructing readers that
+ * point directly into the mapping, so messages that are skipped over are
+ * never copied.
+ * The constructor throws a kj::Exception if the file can't be opened or
+ * doesn't begin with a valid RecordingFileHeader.
+ */
+class RecordingFileReader {
+public:
+  explicit RecordingFileReader(const std::string& file_path)
+    : filesystem_(kj::newDiskFilesystem()),
+      file_(filesystem_->getRoot().openFile(
+        filesystem_->getCurrentPath().evalNative(file_path))),
+      mapping_(file_->mmap(0, file_->stat().size)),
+      words_(reinterpret_cast<const capnp::word*>(mapping_.begin()),
+             mapping_.size() / sizeof(capnp::word)),
+      header_reader_(words_),
+      file_header_(header_reader_.getRoot<RecordingFileHeader>()),
+      messages_begin_(header_reader_.getEnd()),
+      position_(messages_begin_),
+      message_begin_(messages_begin_),
+      current_timestamp(file_header_.getStartTime())
+  {
+    auto keyframes = file_header_.getKeyframes();
+    const auto keyframes_count =
+      std::min(file_header_.getKeyframesCount(), keyframes.size());
+    keyframes_.reserve(keyframes_count);
+    keyframes_.insert(keyframes_.end(),
+                      keyframes.begin(),
+                      keyframes.begin() + keyframes_count);
+    keyframe_ = keyframes_.cbegin();
+  }
+
+  RecordingFileReader(const RecordingFileReader&) = delete;
+  RecordingFileReader& operator=(const RecordingFileReader&) = delete;
+
+  [[nodiscard]]
+  RecordingFileHeader::Reader GetHeader() const {
+    return file_header_;
+  }
+
+  [[nodiscard]]
+  const std::vector<RecordingFileHeader::Keyframe::Reader>& GetKeyframes() const {
+    return keyframes_;
+  }
+
+  /**
+   * Reads the next message in the file. The returned reader is only valid
+   * until the next call to ReadMessage().
+   * @returns An empty optional at the end of the file.
+   */
+  std::optional<CollabVmServerMessage::Message::Reader> ReadMessage() {
+    if (position_ >= words_.end()) {
+      return {};
+    }
+    // Only the segment table and the root pointer are touched here,
+    // the segments themselves remain in the mapping
+    message_begin_ = position_;
+    input_events_.reset();
+    unpacked_message_.reset();
+    message_reader_.emplace(kj::arrayPtr(position_, words_.end()));
+    position_ = message_reader_->getEnd();
+    return message_reader_->getRoot<CollabVmServerMessage>().getMessage();
+  }
+
+  /**
+   * Skips over every message that isn't a Guacamole instruction.
+   * Batches of input events are unpacked into individual instructions.
+   * @returns An empty optional at the end of the file or if the remaining
+   * data could not be deserialized.
+   */
+  std::optional<Guacamole::GuacServerInstruction::Reader> ReadGuacamoleInstruction() {
+    if (auto instruction = ReadInputEvent()) {
+      return instruction;
+    }
+    try {
+      while (auto message = ReadMessage()) {
+        if (message->which() != CollabVmServerMessage::Message::Which::GUAC_INSTR) {
+          continue;
+        }
+        const auto instruction = message->getGuacInstr();
+        if (instruction.which() == Guacamole::GuacServerInstruction::Which::BLOB
+            && instruction.getBlob().getStream() == input_event_batch_stream) {
+          const auto data = instruction.getBlob().getData();
+          input_events_.emplace(gsl::span<const std::byte>(
+            reinterpret_cast<const std::byte*>(data.begin()), data.size()));
+          if (auto input_event = ReadInputEvent()) {
+            return input_event;
+          }
+          continue;
+        }
+        if (instruction.which() == Guacamole::GuacServerInstruction::Which::SYNC) {
+          current_timestamp = instruction.getSync();
+        }
+        return instruction;
+      }
+    } catch (const kj::Exception&) {
+      // The file is truncated, possibly because it's still being recorded
+      position_ = words_.end();
+    }
+    return {};
+  }
+
+  bool NextKeyframe() {
+    if (std::distance(keyframe_, keyframes_.cend()) > 1) {
+      SeekToKeyframe(std::next(keyframe_));
+      return true;
+    }
+    current_timestamp = GetNextFileTimestamp();
+    return false;
+  }
+
+  /**
+   * Moves to the closest keyframe before the timestamp unless the timestamp
+   * can be reached sooner by continuing to read from the current position.
+   * Files that are still being recorded don't have a stop time yet.
+   * @returns false if the timestamp is outside of this file.
+   */
+  bool SeekToTimestamp(std::uint64_t timestamp) {
+    if (timestamp < file_header_.getStartTime()
+        || (file_header_.getStopTime()
+            && timestamp > file_header_.getStopTime())) {
+      return false;
+    }
+    const auto keyframe = std::upper_bound(
+      keyframes_.cbegin(), keyframes_.cend(), timestamp,
+      [](auto timestamp, auto keyframe) {
+        return timestamp < keyframe.getTimestamp();
+      });
+    if (keyframe == keyframes_.cbegin()) {
+      if (timestamp < current_timestamp) {
+        position_ = messages_begin_;
+        input_events_.reset();
+        keyframe_ = keyframes_.cbegin();
+        current_timestamp = file_header_.getStartTime();
+      }
+      return true;
+    }
+    const auto previous_keyframe = std::prev(keyframe);
+    if (current_timestamp < previous_keyframe->getTimestamp()
+        || timestamp < current_timestamp) {
+      SeekToKeyframe(previous_keyframe);
+    }
+    return true;
+  }
+
+  /**
+   * @returns The message containing the instruction that was last returned
+   * by ReadGuacamoleInstruction() if it was unpacked from a batch of input
+   * events, or nullptr if it was read directly from the file.
+   */
+  [[nodiscard]]
+  capnp::MessageBuilder* GetUnpackedMessage() {
+    return unpacked_message_ ? &*unpacked_message_ : nullptr;
+  }
+
+  /**
+   * @returns The serialized bytes of the message that was last read.
+   */
+  [[nodiscard]]
+  kj::ArrayPtr<const kj::byte> GetMessageBytes() const {
+    return kj::arrayPtr(message_begin_, position_).asBytes();
+  }
+
+  /**
+   * @returns The file offset of the next message.
+   */
+  [[nodiscard]]
+  std::uint64_t GetFileOffset() const {
+    return (position_ - words_.begin()) * sizeof(capnp::word);
+  }
+
+  [[nodiscard]]
+  std::uint64_t GetNextFileTimestamp() const {
+    return std::max(file_header_.getStartTime() + 1, file_header_.getStopTime());
+  }
+
+private:
+  std::optional<Guacamole::GuacServerInstruction::Reader> ReadInputEvent() {
+    if (!input_events_) {
+      return {};
+    }
+    const auto event = input_events_->Next();
+    if (!event) {
+      input_events_.reset();
+      unpacked_message_.reset();
+      return {};
+    }
+    auto instruction = unpacked_message_.emplace()
+      .initRoot<CollabVmServerMessage>()
+      .initMessage()
+      .initGuacInstr();
+    if (event->type == InputEvent::Type::Mouse) {
+      auto mouse = instruction.initMouse();
+      mouse.setX(event->x);
+      mouse.setY(event->y);
+      mouse.setButtonMask(event->button_mask);
+      mouse.setTimestamp(event->timestamp);
+    } else {
+      auto key = instruction.initKey();
+      key.setKeysym(event->keysym);
+      key.setPressed(event->pressed);
+      key.setTimestamp(event->timestamp);
+    }
+    return instruction.asReader();
+  }
+
+  void SeekToKeyframe(
+      std::vector<RecordingFileHeader::Keyframe::Reader>::const_iterator keyframe) {
+    const auto offset = keyframe->getFileOffset() / sizeof(capnp::word);
+    position_ = words_.begin() + std::min<std::size_t>(offset, words_.size());
+    input_events_.reset();
+    keyframe_ = keyframe;
+    current_timestamp = keyframe->getTimestamp();
+  }
+
+  kj::Own<kj::Filesystem> filesystem_;
+  kj::Own<const kj::ReadableFile> file_;
+  kj::Array<const kj::byte> mapping_;
+  kj::ArrayPtr<const capnp::word> words_;
+  capnp::FlatArrayMessageReader header_reader_;
+  RecordingFileHeader::Reader file_header_;
+  std::vector<RecordingFileHeader::Keyframe::Reader> keyframes_;
+  std::vector<RecordingFileHeader::Keyframe::Reader>::const_iterator keyframe_;
+  const capnp::word* messages_begin_;
+  const capnp::word* position_;
+  const capnp::word* message_begin_;
+  std::optional<capnp::FlatArrayMessageReader> message_reader_;
+  std::optional<InputEventBatchReader> input_events_;
+  std::optional<capnp::MallocMessageBuilder> unpacked_message_;
+
+public:
+  std::uint64_t current_timestamp;
+};
+}
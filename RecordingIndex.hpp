@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Database/Database.h"
+#include "RecordingFileReader.hpp"
+
+namespace CollabVm::Server {
+/**
+ * An in-memory index of every recording file ordered by time, so a range of
+ * recordings can be found without querying the database for each file.
+ * It is loaded from the Recordings table once and then kept up to date by
+ * the recording controllers. Thread-safe.
+ */
+class RecordingIndex {
+public:
+  struct Keyframe {
+    std::uint64_t file_offset;
+    std::uint64_t timestamp;
+  };
+
+  struct Recording {
+    std::string file_path;
+    std::uint64_t start_time;
+    // Zero if the file is still being recorded
+    std::uint64_t stop_time;
+    std::vector<Keyframe> keyframes;
+    bool keyframes_loaded;
+
+    /**
+     * @returns The file offset of the closest keyframe before the timestamp,
+     * or zero if there isn't one.
+     */
+    [[nodiscard]]
+    std::uint64_t GetKeyframeOffset(std::uint64_t timestamp) const {
+      const auto keyframe = std::upper_bound(
+        keyframes.cbegin(), keyframes.cend(), timestamp,
+        [](auto timestamp, const auto& keyframe) {
+          return timestamp < keyframe.timestamp;
+        });
+      return keyframe == keyframes.cbegin()
+               ? 0
+               : std::prev(keyframe)->file_offset;
+    }
+
+    /**
+     * @returns The timestamp of the first keyframe after the timestamp,
+     * or zero if there isn't one.
+     */
+    [[nodiscard]]
+    std::uint64_t GetNextKeyframeTimestamp(std::uint64_t timestamp) const {
+      const auto keyframe = std::upper_bound(
+        keyframes.cbegin(), keyframes.cend(), timestamp,
+        [](auto timestamp, const auto& keyframe) {
+          return timestamp < keyframe.timestamp;
+        });
+      return keyframe == keyframes.cend() ? 0 : keyframe->timestamp;
+    }
+  };
+
+  explicit RecordingIndex(Database& db) {
+    db.ForEachRecording(
+      [this](auto vm_id, auto&& file_path, auto start_time, auto stop_time) {
+        if (!start_time) {
+          return;
+        }
+        recordings_[vm_id].emplace(
+          start_time,
+          Recording{std::move(file_path), start_time, stop_time, {}, false});
+      });
+  }
+
+  void AddRecording(std::uint32_t vm_id,
+                    std::string_view file_path,
+                    std::chrono::time_point<std::chrono::system_clock> time) {
+    const auto start_time = ToTimestamp(time);
+    const auto lock = std::lock_guard(mutex_);
+    recordings_[vm_id].insert_or_assign(
+      start_time,
+      Recording{std::string(file_path), start_time, 0, {}, true});
+  }
+
+  void AddKeyframe(std::uint32_t vm_id,
+                   std::string_view file_path,
+                   std::uint64_t file_offset,
+                   std::uint64_t timestamp) {
+    const auto lock = std::lock_guard(mutex_);
+    if (auto recording = FindRecording(vm_id, file_path)) {
+      recording->keyframes.push_back({file_offset, timestamp});
+    }
+  }
+
+  void SetStopTime(std::uint32_t vm_id,
+                   std::string_view file_path,
+                   std::chrono::time_point<std::chrono::system_clock> time) {
+    const auto lock = std::lock_guard(mutex_);
+    if (auto recording = FindRecording(vm_id, file_path)) {
+      recording->stop_time = ToTimestamp(time);
+    }
+  }
+
+  void RemoveRecording(std::uint32_t vm_id, std::string_view file_path) {
+    const auto lock = std::lock_guard(mutex_);
+    const auto vm_recordings = recordings_.find(vm_id);
+    if (vm_recordings == recordings_.end()) {
+      return;
+    }
+    auto& files = vm_recordings->second;
+    for (auto it = files.begin(); it != files.end(); ++it) {
+      if (it->second.file_path == file_path) {
+        files.erase(it);
+        return;
+      }
+    }
+  }
+
+  /**
+   * Causes the keyframes to be read from the file again, which is needed
+   * after the file has been rewritten.
+   */
+  void InvalidateKeyframes(std::uint32_t vm_id, std::string_view file_path) {
+    const auto lock = std::lock_guard(mutex_);
+    if (auto recording = FindRecording(vm_id, file_path)) {
+      recording->keyframes.clear();
+      recording->keyframes_loaded = false;
+    }
+  }
+
+  /**
+   * Invokes the callback with the VM ID and file path, start time, and stop
+   * time of every recording while the lock is held.
+   */
+  template<typename TCallback>
+  void ForEachRecording(TCallback&& callback) {
+    const auto lock = std::lock_guard(mutex_);
+    for (const auto& [vm_id, files] : recordings_) {
+      for (const auto& [start_time, recording] : files) {
+        callback(vm_id, std::string_view(recording.file_path),
+                 recording.start_time, recording.stop_time);
+      }
+    }
+  }
+
+  /**
+   * @returns Every recording that overlaps the time range, ordered by
+   * start time.
+   */
+  std::vector<Recording> GetRecordings(std::uint32_t vm_id,
+                                       std::uint64_t start_time,
+                                       std::uint64_t stop_time) {
+    auto recordings = std::vector<Recording>();
+    {
+      const auto lock = std::lock_guard(mutex_);
+      const auto vm_recordings = recordings_.find(vm_id);
+      if (vm_recordings == recordings_.end()) {
+        return recordings;
+      }
+      auto& files = vm_recordings->second;
+      auto it = files.upper_bound(start_time);
+      if (it != files.begin()) {
+        // Include the file that was being recorded at the start time
+        if (const auto previous = std::prev(it);
+            !previous->second.stop_time
+            || previous->second.stop_time > start_time) {
+          it = previous;
+        }
+      }
+      for (; it != files.end() && it->first < stop_time; ++it) {
+        recordings.push_back(it->second);
+      }
+    }
+    // The keyframes of old files are only read from their headers when
+    // they're first needed, so file I/O is done without holding the lock
+    for (auto& recording : recordings) {
+      if (recording.keyframes_loaded) {
+        continue;
+      }
+      LoadKeyframes(recording);
+      const auto lock = std::lock_guard(mutex_);
+      if (auto cached_recording = FindRecording(vm_id, recording.file_path);
+          cached_recording && !cached_recording->keyframes_loaded) {
+        cached_recording->keyframes = recording.keyframes;
+        cached_recording->keyframes_loaded = true;
+      }
+    }
+    return recordings;
+  }
+
+private:
+  static std::uint64_t ToTimestamp(
+      std::chrono::time_point<std::chrono::system_clock> time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      time.time_since_epoch()).count();
+  }
+
+  static void LoadKeyframes(Recording& recording) {
+    recording.keyframes_loaded = true;
+    try {
+      const auto reader = RecordingFileReader(recording.file_path);
+      const auto& keyframes = reader.GetKeyframes();
+      recording.keyframes.reserve(keyframes.size());
+      for (const auto keyframe : keyframes) {
+        recording.keyframes.push_back(
+          {keyframe.getFileOffset(), keyframe.getTimestamp()});
+      }
+    } catch (const kj::Exception&) {
+    }
+  }
+
+  Recording* FindRecording(std::uint32_t vm_id, std::string_view file_path) {
+    const auto vm_recordings = recordings_.find(vm_id);
+    if (vm_recordings == recordings_.end()) {
+      return nullptr;
+    }
+    auto& files = vm_recordings->second;
+    // The recording that is being updated is almost always the newest one
+    for (auto it = files.rbegin(); it != files.rend(); ++it) {
+      if (it->second.file_path == file_path) {
+        return &it->second;
+      }
+    }
+    return nullptr;
+  }
+
+  std::mutex mutex_;
+  std::unordered_map<std::uint32_t, std::map<std::uint64_t, Recording>>
+    recordings_;
+};
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <capnp/serialize.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CollabVm.capnp.h"
+#include "CpuPool.hpp"
+#include "GuacamoleScreenshot.hpp"
+#include "PlaybackPosition.hpp"
+#include "RecordingFileReader.hpp"
+#include "RecordingIndex.hpp"
+#include "SocketMessage.hpp"
+
+namespace CollabVm::Server {
+// A recording preview request with this width and height is for playback
+// instead of thumbnails
+constexpr auto playback_request_size = 0u;
+
+/**
+ * A message that points directly into a memory-mapped recording, which is
+ * possible because recordings contain serialized CollabVmServerMessages.
+ */
+struct RecordingSocketMessage final : SocketMessage {
+  RecordingSocketMessage(std::shared_ptr<const RecordingFileReader> recording,
+                         kj::ArrayPtr<const kj::byte> bytes)
+    : recording_(std::move(recording)),
+      buffers_({ boost::asio::const_buffer(bytes.begin(), bytes.size()) }),
+      reader_(kj::arrayPtr(reinterpret_cast<const capnp::word*>(bytes.begin()),
+                           bytes.size() / sizeof(capnp::word))) {
+  }
+
+  ~RecordingSocketMessage() noexcept override { }
+
+  const std::vector<boost::asio::const_buffer>& GetBuffers() const override {
+    return buffers_;
+  }
+  void CreateFrame() override {
+  }
+  capnp::AnyPointer::Reader GetRoot() const override {
+    return const_cast<capnp::FlatArrayMessageReader&>(
+      reader_).getRoot<capnp::AnyPointer>();
+  }
+private:
+  // Keeps the mapping alive
+  const std::shared_ptr<const RecordingFileReader> recording_;
+  const std::vector<boost::asio::const_buffer> buffers_;
+  capnp::FlatArrayMessageReader reader_;
+};
+
+/**
+ * Streams the Guacamole instructions of a VM's recordings to a socket,
+ * paced by the timestamps of the recorded sync instructions. The socket
+ * stops sending the live VM's instructions while a recording is played so
+ * the two streams aren't drawn on the same display.
+ * Each playback has its own strand on the CPU pool so it doesn't touch the
+ * strands of the live VM. The display state is kept up to date with every
+ * instruction that is sent, so seeking forward within the same keyframe only
+ * has to decode the instructions that were skipped.
+ */
+template<typename TSocket>
+class RecordingPlayback final
+  : public std::enable_shared_from_this<RecordingPlayback<TSocket>> {
+public:
+  RecordingPlayback(boost::asio::io_context& io_context,
+                    CpuPool& cpu_pool,
+                    RecordingIndex& index,
+                    std::weak_ptr<TSocket> socket,
+                    std::uint32_t vm_id)
+    : strand_(boost::asio::make_strand(
+        cpu_pool.get_executor(CpuPool::Priority::Interactive))),
+      timer_(io_context),
+      index_(index),
+      socket_(std::move(socket)),
+      vm_id_(vm_id) {
+  }
+
+  [[nodiscard]]
+  std::uint32_t GetVmId() const {
+    return vm_id_;
+  }
+
+  /**
+   * Starts playing from the timestamp, or seeks to it if the recording is
+   * already being played.
+   */
+  void Play(std::uint64_t timestamp, std::uint64_t stop_time, std::uint32_t speed) {
+    boost::asio::dispatch(strand_,
+      [this, self = this->shared_from_this(), timestamp, stop_time, speed]
+      {
+        Cancel();
+        stop_time_ = stop_time;
+        clock_.SetSpeed(speed);
+        if (!Seek(timestamp)) {
+          reader_.reset();
+          SendResult(false);
+          return;
+        }
+        clock_.Reset();
+        SendNextFrame();
+      });
+  }
+
+  void Stop() {
+    boost::asio::dispatch(strand_,
+      [this, self = this->shared_from_this()]
+      {
+        Cancel();
+        reader_.reset();
+        recordings_.clear();
+      });
+  }
+
+private:
+  void Cancel() {
+    timer_.cancel();
+    // Ignore timers that had already expired
+    generation_++;
+  }
+
+  bool Seek(std::uint64_t timestamp) {
+    recordings_ = index_.GetRecordings(vm_id_, timestamp, stop_time_);
+    current_recording_ = recordings_.begin();
+    if (current_recording_ == recordings_.end()) {
+      return false;
+    }
+    if (!reader_ || file_path_ != current_recording_->file_path) {
+      if (!OpenRecording()) {
+        return false;
+      }
+    }
+    SeekRecording(*reader_, display_, timestamp);
+    SendDisplay();
+    return true;
+  }
+
+  bool OpenRecording() {
+    for (; current_recording_ != recordings_.end(); ++current_recording_) {
+      try {
+        reader_ = std::make_shared<RecordingFileReader>(
+          current_recording_->file_path);
+        file_path_ = current_recording_->file_path;
+        display_ = GuacamoleScreenshot();
+        // Don't wait for the gap between recordings
+        clock_.Reset();
+        return true;
+      } catch (const kj::Exception&) {
+      }
+    }
+    reader_.reset();
+    file_path_.clear();
+    return false;
+  }
+
+  void SendNextFrame() {
+    const auto socket = socket_.lock();
+    if (!socket || !reader_) {
+      return;
+    }
+    auto frame = std::vector<std::shared_ptr<SocketMessage>>();
+    while (true) {
+      const auto instruction = reader_->ReadGuacamoleInstruction();
+      if (!instruction) {
+        if (!frame.empty()) {
+          break;
+        }
+        ++current_recording_;
+        if (!OpenRecording()) {
+          SendResult(true);
+          return;
+        }
+        continue;
+      }
+      display_.WriteInstruction(*instruction);
+      if (const auto unpacked_message = reader_->GetUnpackedMessage()) {
+        frame.push_back(SocketMessage::CopyFromMessageBuilder(*unpacked_message));
+      } else {
+        frame.push_back(std::make_shared<RecordingSocketMessage>(
+          reader_, reader_->GetMessageBytes()));
+      }
+      if (instruction->which() == Guacamole::GuacServerInstruction::Which::SYNC) {
+        break;
+      }
+    }
+    socket->QueueMessageBatch(
+      [frame = std::move(frame)](auto queue_message) mutable
+      {
+        for (auto& message : frame) {
+          queue_message(std::move(message));
+        }
+      });
+
+    const auto timestamp = reader_->current_timestamp;
+    if (timestamp >= stop_time_) {
+      SendResult(true);
+      return;
+    }
+    timer_.expires_at(
+      clock_.GetFrameTime(timestamp, std::chrono::steady_clock::now()));
+    timer_.async_wait(boost::asio::bind_executor(strand_,
+      [this, self = this->shared_from_this(), generation = generation_]
+      (const auto error_code)
+      {
+        if (error_code || generation != generation_) {
+          return;
+        }
+        SendNextFrame();
+      }));
+  }
+
+  /**
+   * Sends the entire display so the client has something to draw the
+   * following instructions on.
+   */
+  void SendDisplay() {
+    const auto socket = socket_.lock();
+    if (!socket) {
+      return;
+    }
+    auto png = std::vector<std::byte>();
+    if (!display_.CreateScreenshot(0, 0,
+          [&png](auto png_bytes) {
+            png.insert(png.end(), png_bytes.begin(), png_bytes.end());
+          })) {
+      return;
+    }
+    auto socket_message = SocketMessage::CreateShared();
+    auto& message_builder = socket_message->GetMessageBuilder();
+    auto preview = message_builder.initRoot<CollabVmServerMessage>()
+                                  .initMessage()
+                                  .initRecordingPlaybackPreview();
+    preview.setTimestamp(reader_->current_timestamp);
+    auto vm_thumbnail = preview.initVmThumbnail();
+    vm_thumbnail.setId(vm_id_);
+    vm_thumbnail.setPngBytes(kj::ArrayPtr(
+      reinterpret_cast<const kj::byte*>(png.data()), png.size()));
+    socket->QueueMessage(std::move(socket_message));
+  }
+
+  void SendResult(bool result) {
+    if (const auto socket = socket_.lock()) {
+      auto socket_message = SocketMessage::CreateShared();
+      auto& message_builder = socket_message->GetMessageBuilder();
+      message_builder.initRoot<CollabVmServerMessage>()
+                     .initMessage()
+                     .setRecordingPlaybackResult(result);
+      socket->QueueMessage(std::move(socket_message));
+    }
+  }
+
+  boost::asio::strand<CpuPool::executor_type> strand_;
+  boost::asio::steady_timer timer_;
+  RecordingIndex& index_;
+  const std::weak_ptr<TSocket> socket_;
+  const std::uint32_t vm_id_;
+  std::vector<RecordingIndex::Recording> recordings_;
+  std::vector<RecordingIndex::Recording>::const_iterator current_recording_;
+  std::shared_ptr<RecordingFileReader> reader_;
+  std::string file_path_;
+  GuacamoleScreenshot display_;
+  std::uint64_t stop_time_ = 0;
+  std::uint32_t generation_ = 0;
+  PlaybackClock clock_;
+};
+}
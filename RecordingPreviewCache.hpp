@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <boost/functional/hash.hpp>
+
+namespace CollabVm::Server {
+/**
+ * A bounded LRU cache of PNG thumbnails created from recordings.
+ * Entries are kept in memory and, if a directory is provided, also written to
+ * disk so they survive restarts. Each tier has its own byte budget and
+ * evicts the least recently used previews. Thread-safe.
+ */
+class RecordingPreviewCache {
+public:
+  struct Key {
+    std::string file_path;
+    std::uint64_t keyframe_offset;
+    std::uint64_t timestamp;
+    std::uint32_t width;
+    std::uint32_t height;
+
+    bool operator==(const Key& key) const {
+      return std::tie(file_path, keyframe_offset, timestamp, width, height)
+          == std::tie(key.file_path, key.keyframe_offset, key.timestamp,
+                      key.width, key.height);
+    }
+  };
+
+  struct Preview {
+    // The timestamp of the frame that was captured
+    std::uint64_t timestamp;
+    std::vector<std::byte> png;
+  };
+
+  struct Statistics {
+    std::uint64_t memory_hits;
+    std::uint64_t disk_hits;
+    std::uint64_t misses;
+    std::size_t memory_bytes;
+    std::uint64_t disk_bytes;
+
+    [[nodiscard]]
+    double GetHitRate() const {
+      const auto total = memory_hits + disk_hits + misses;
+      return total ? double(memory_hits + disk_hits) / total : 0;
+    }
+  };
+
+  /**
+   * @param max_disk_bytes The size of the previews written to the directory,
+   *                       which may already contain previews from a previous
+   *                       run.
+   */
+  explicit RecordingPreviewCache(std::size_t max_memory_bytes,
+                                 std::filesystem::path directory = {},
+                                 std::uint64_t max_disk_bytes = 0)
+    : max_memory_bytes_(max_memory_bytes),
+      max_disk_bytes_(max_disk_bytes),
+      directory_(std::move(directory)) {
+    LoadDiskEntries();
+  }
+
+  std::shared_ptr<const Preview> Get(const Key& key) {
+    {
+      const auto lock = std::lock_guard(mutex_);
+      if (const auto it = entries_.find(key); it != entries_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        memory_hits_++;
+        return it->second->second;
+      }
+    }
+    if (auto preview = ReadFromDisk(key)) {
+      TouchDiskEntry(GetDiskPath(key));
+      disk_hits_++;
+      Insert(key, preview);
+      return preview;
+    }
+    misses_++;
+    return {};
+  }
+
+  void Put(const Key& key, std::uint64_t timestamp, std::vector<std::byte> png) {
+    auto preview = std::make_shared<const Preview>(
+      Preview{timestamp, std::move(png)});
+    WriteToDisk(key, *preview);
+    Insert(key, std::move(preview));
+  }
+
+  /**
+   * Removes the previews of a recording that has been deleted or rewritten.
+   */
+  void RemoveRecording(const std::string& file_path) {
+    {
+      const auto lock = std::lock_guard(mutex_);
+      for (auto it = lru_.begin(); it != lru_.end();) {
+        if (it->first.file_path != file_path) {
+          ++it;
+          continue;
+        }
+        memory_bytes_ -= it->second->png.size();
+        entries_.erase(it->first);
+        it = lru_.erase(it);
+      }
+    }
+    if (directory_.empty()) {
+      return;
+    }
+    const auto recording_directory = GetRecordingDirectory(file_path);
+    auto error_code = std::error_code();
+    {
+      const auto lock = std::lock_guard(disk_mutex_);
+      for (const auto& entry : std::filesystem::directory_iterator(
+             recording_directory, error_code)) {
+        if (const auto it = disk_entries_.find(entry.path().string());
+            it != disk_entries_.end()) {
+          disk_bytes_ -= it->second->size;
+          disk_lru_.erase(it->second);
+          disk_entries_.erase(it);
+        }
+      }
+    }
+    std::filesystem::remove_all(recording_directory, error_code);
+  }
+
+  [[nodiscard]]
+  Statistics GetStatistics() const {
+    auto statistics = Statistics{memory_hits_, disk_hits_, misses_, 0, 0};
+    {
+      const auto lock = std::lock_guard(mutex_);
+      statistics.memory_bytes = memory_bytes_;
+    }
+    {
+      const auto lock = std::lock_guard(disk_mutex_);
+      statistics.disk_bytes = disk_bytes_;
+    }
+    return statistics;
+  }
+
+private:
+  struct KeyHasher {
+    std::size_t operator()(const Key& key) const {
+      auto seed = std::size_t(0);
+      boost::hash_combine(seed, key.file_path);
+      boost::hash_combine(seed, key.keyframe_offset);
+      boost::hash_combine(seed, key.timestamp);
+      boost::hash_combine(seed, key.width);
+      boost::hash_combine(seed, key.height);
+      return seed;
+    }
+  };
+
+  using Entry = std::pair<Key, std::shared_ptr<const Preview>>;
+
+  struct DiskEntry {
+    std::string path;
+    std::uint64_t size;
+  };
+
+  void Insert(const Key& key, std::shared_ptr<const Preview> preview) {
+    const auto lock = std::lock_guard(mutex_);
+    if (const auto it = entries_.find(key); it != entries_.end()) {
+      memory_bytes_ -= it->second->second->png.size();
+      lru_.erase(it->second);
+      entries_.erase(it);
+    }
+    memory_bytes_ += preview->png.size();
+    lru_.emplace_front(key, std::move(preview));
+    entries_.emplace(key, lru_.begin());
+    while (memory_bytes_ > max_memory_bytes_ && lru_.size() > 1) {
+      auto& [oldest_key, oldest_preview] = lru_.back();
+      memory_bytes_ -= oldest_preview->png.size();
+      entries_.erase(oldest_key);
+      lru_.pop_back();
+    }
+  }
+
+  /*
+   * The previews of each recording are kept in a directory named after it
+   * so they can be removed without searching for them.
+   */
+  std::filesystem::path GetRecordingDirectory(const std::string& file_path) const {
+    return directory_ / std::filesystem::path(file_path).stem();
+  }
+
+  std::filesystem::path GetDiskPath(const Key& key) const {
+    // FNV-1a is used because std::hash isn't stable between builds
+    auto hash = std::uint64_t(14695981039346656037u);
+    const auto hash_bytes = [&hash](const void* data, std::size_t size) {
+      for (const auto byte : std::string_view(static_cast<const char*>(data), size)) {
+        hash = (hash ^ static_cast<unsigned char>(byte)) * 1099511628211u;
+      }
+    };
+    hash_bytes(key.file_path.data(), key.file_path.size());
+    hash_bytes(&key.keyframe_offset, sizeof(key.keyframe_offset));
+    hash_bytes(&key.timestamp, sizeof(key.timestamp));
+    hash_bytes(&key.width, sizeof(key.width));
+    hash_bytes(&key.height, sizeof(key.height));
+    char hash_string[17];
+    std::snprintf(hash_string, sizeof(hash_string), "%016llx",
+                  static_cast<unsigned long long>(hash));
+    return GetRecordingDirectory(key.file_path)
+           / (std::string(hash_string) + ".png");
+  }
+
+  /**
+   * Adds the previews written by a previous run to the disk tier, with the
+   * most recently written ones being the last to be evicted.
+   */
+  void LoadDiskEntries() {
+    if (directory_.empty()) {
+      return;
+    }
+    struct File {
+      std::filesystem::file_time_type write_time;
+      DiskEntry entry;
+    };
+    auto files = std::vector<File>();
+    auto error_code = std::error_code();
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(
+           directory_, error_code)) {
+      if (!entry.is_regular_file(error_code)) {
+        continue;
+      }
+      if (entry.path().extension() != ".png") {
+        // Discard previews that were being written when the server stopped
+        std::filesystem::remove(entry.path(), error_code);
+        continue;
+      }
+      const auto size = entry.file_size(error_code);
+      const auto write_time = entry.last_write_time(error_code);
+      if (!error_code) {
+        files.push_back({write_time, {entry.path().string(), size}});
+      }
+    }
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+      return a.write_time < b.write_time;
+    });
+    const auto lock = std::lock_guard(disk_mutex_);
+    for (auto& file : files) {
+      AddDiskEntry(std::move(file.entry));
+    }
+  }
+
+  void TouchDiskEntry(const std::filesystem::path& path) {
+    const auto lock = std::lock_guard(disk_mutex_);
+    if (const auto it = disk_entries_.find(path.string());
+        it != disk_entries_.end()) {
+      disk_lru_.splice(disk_lru_.begin(), disk_lru_, it->second);
+    }
+  }
+
+  /**
+   * Tracks a preview that was written to disk and removes the least recently
+   * used previews that are over the budget. The caller must lock disk_mutex_.
+   */
+  void AddDiskEntry(DiskEntry entry) {
+    if (const auto it = disk_entries_.find(entry.path);
+        it != disk_entries_.end()) {
+      disk_bytes_ -= it->second->size;
+      disk_lru_.erase(it->second);
+      disk_entries_.erase(it);
+    }
+    disk_bytes_ += entry.size;
+    disk_lru_.emplace_front(std::move(entry));
+    disk_entries_.emplace(disk_lru_.front().path, disk_lru_.begin());
+    while (disk_bytes_ > max_disk_bytes_ && disk_lru_.size() > 1) {
+      const auto& oldest_entry = disk_lru_.back();
+      auto error_code = std::error_code();
+      std::filesystem::remove(oldest_entry.path, error_code);
+      disk_bytes_ -= oldest_entry.size;
+      disk_entries_.erase(oldest_entry.path);
+      disk_lru_.pop_back();
+    }
+  }
+
+  std::shared_ptr<const Preview> ReadFromDisk(const Key& key) const {
+    if (directory_.empty()) {
+      return {};
+    }
+    auto file = std::ifstream(GetDiskPath(key),
+                              std::ifstream::in | std::ifstream::binary
+                              | std::ifstream::ate);
+    if (!file.is_open()) {
+      return {};
+    }
+    const auto size = static_cast<std::size_t>(file.tellg());
+    auto preview = Preview();
+    if (size <= sizeof(preview.timestamp)) {
+      return {};
+    }
+    file.seekg(0);
+    preview.png.resize(size - sizeof(preview.timestamp));
+    file.read(reinterpret_cast<char*>(&preview.timestamp),
+              sizeof(preview.timestamp));
+    file.read(reinterpret_cast<char*>(preview.png.data()), preview.png.size());
+    if (!file) {
+      return {};
+    }
+    return std::make_shared<const Preview>(std::move(preview));
+  }
+
+  /**
+   * The preview is written to a temporary file that is then renamed so that
+   * readers never see a partially written preview.
+   */
+  void WriteToDisk(const Key& key, const Preview& preview) {
+    if (directory_.empty()) {
+      return;
+    }
+    const auto path = GetDiskPath(key);
+    auto error_code = std::error_code();
+    std::filesystem::create_directories(path.parent_path(), error_code);
+    if (error_code) {
+      return;
+    }
+    auto temp_path = path;
+    temp_path += '.' + std::to_string(temp_files_count_++) + ".tmp";
+    {
+      auto file = std::ofstream(temp_path,
+                                std::ofstream::out | std::ofstream::binary);
+      file.write(reinterpret_cast<const char*>(&preview.timestamp),
+                 sizeof(preview.timestamp));
+      file.write(reinterpret_cast<const char*>(preview.png.data()),
+                 preview.png.size());
+      file.close();
+      if (!file) {
+        std::filesystem::remove(temp_path, error_code);
+        return;
+      }
+    }
+    std::filesystem::rename(temp_path, path, error_code);
+    if (error_code) {
+      std::filesystem::remove(temp_path, error_code);
+      return;
+    }
+    const auto lock = std::lock_guard(disk_mutex_);
+    AddDiskEntry({path.string(),
+                  sizeof(preview.timestamp) + preview.png.size()});
+  }
+
+  const std::size_t max_memory_bytes_;
+  const std::uint64_t max_disk_bytes_;
+  const std::filesystem::path directory_;
+  mutable std::mutex mutex_;
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHasher> entries_;
+  std::size_t memory_bytes_ = 0;
+  // Guards the disk tier separately so previews can be read from memory
+  // while files are being removed
+  mutable std::mutex disk_mutex_;
+  std::list<DiskEntry> disk_lru_;
+  std::unordered_map<std::string, std::list<DiskEntry>::iterator> disk_entries_;
+  std::uint64_t disk_bytes_ = 0;
+  std::atomic<std::uint64_t> temp_files_count_ = 0;
+  std::atomic<std::uint64_t> memory_hits_ = 0;
+  std::atomic<std::uint64_t> disk_hits_ = 0;
+  std::atomic<std::uint64_t> misses_ = 0;
+};
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "Database/Database.h"
+#include "RecordingCompactor.hpp"
+#include "RecordingIndex.hpp"
+#include "RecordingPreviewCache.hpp"
+
+namespace CollabVm::Server {
+/**
+ * Periodically deletes recordings that exceed the byte quotas or maximum age
+ * and removes the audio from old recordings. The work is done on its own
+ * thread with the lowest I/O priority so it doesn't slow down live recordings,
+ * which are never modified.
+ */
+class RecordingRetention {
+public:
+  struct Policy {
+    // A value of zero disables the limit
+    std::uint64_t max_total_bytes = 0;
+    std::uint64_t max_vm_bytes = 0;
+    std::chrono::hours max_age = std::chrono::hours::zero();
+    // Audio is removed from recordings that are older than this
+    std::chrono::hours compact_age = std::chrono::hours::zero();
+
+    [[nodiscard]]
+    bool IsEnabled() const {
+      return max_total_bytes || max_vm_bytes
+          || max_age.count() || compact_age.count();
+    }
+  };
+
+  RecordingRetention(boost::asio::io_context& io_context,
+                     Database& db,
+                     RecordingIndex& index,
+                     RecordingPreviewCache& preview_cache,
+                     Policy policy)
+    : db_(db),
+      index_(index),
+      preview_cache_(preview_cache),
+      policy_(policy),
+      timer_(io_context),
+      thread_pool_(1) {
+    boost::asio::post(thread_pool_, &LowerThreadPriority);
+  }
+
+  void Start() {
+    if (!policy_.IsEnabled()) {
+      return;
+    }
+    boost::asio::post(thread_pool_, [this] { EnforcePolicy(); });
+    StartTimer();
+  }
+
+  void Stop() {
+    timer_.cancel();
+    thread_pool_.stop();
+  }
+
+private:
+  struct RecordingFile {
+    std::uint32_t vm_id;
+    std::string file_path;
+    std::uint64_t start_time;
+    std::uint64_t stop_time;
+    std::uint64_t size;
+  };
+
+  void StartTimer() {
+    timer_.expires_after(interval_);
+    timer_.async_wait([this](const auto error_code) {
+      if (error_code) {
+        return;
+      }
+      boost::asio::post(thread_pool_, [this] { EnforcePolicy(); });
+      StartTimer();
+    });
+  }
+
+  static void LowerThreadPriority() {
+#ifdef __linux__
+    // glibc doesn't provide a wrapper for ioprio_set
+    constexpr auto ioprio_who_process = 1;
+    constexpr auto ioprio_class_idle = 3;
+    constexpr auto ioprio_class_shift = 13;
+    const auto thread_id = static_cast<int>(syscall(SYS_gettid));
+    syscall(SYS_ioprio_set, ioprio_who_process, thread_id,
+            ioprio_class_idle << ioprio_class_shift);
+    setpriority(PRIO_PROCESS, thread_id, 19);
+#endif
+  }
+
+  void EnforcePolicy() {
+    auto recordings = std::vector<RecordingFile>();
+    index_.ForEachRecording(
+      [&recordings](auto vm_id, auto file_path, auto start_time, auto stop_time) {
+        recordings.push_back(
+          {vm_id, std::string(file_path), start_time, stop_time, 0});
+      });
+    std::sort(recordings.begin(), recordings.end(),
+      [](const auto& a, const auto& b) {
+        return a.start_time < b.start_time;
+      });
+    const auto now = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    const auto is_older_than = [now](const auto& recording, auto age) {
+      const auto age_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(age).count();
+      return recording.stop_time && recording.stop_time + age_ms < now;
+    };
+    auto compacted_recordings = std::unordered_set<std::string>();
+    db_.ForEachCompactedRecording([&](auto file_path) {
+      compacted_recordings.insert(std::move(file_path));
+    });
+
+    auto deleted_count = 0u;
+    auto deleted_bytes = std::uint64_t(0);
+    const auto delete_recording = [&](auto& recording) {
+      if (!DeleteRecording(recording)) {
+        return false;
+      }
+      deleted_count++;
+      deleted_bytes += recording.size;
+      recording.size = 0;
+      return true;
+    };
+
+    auto vm_bytes = std::unordered_map<std::uint32_t, std::uint64_t>();
+    auto total_bytes = std::uint64_t(0);
+    for (auto it = recordings.begin(); it != recordings.end();) {
+      auto error_code = std::error_code();
+      it->size = std::filesystem::file_size(it->file_path, error_code);
+      if (error_code == std::errc::no_such_file_or_directory) {
+        // The file was already deleted
+        RemoveRecording(*it);
+        it = recordings.erase(it);
+        continue;
+      }
+      if (error_code) {
+        it->size = 0;
+      }
+      if (!it->stop_time) {
+        it->stop_time = GetInterruptedStopTime(*it, now);
+      }
+      if (policy_.max_age.count() && is_older_than(*it, policy_.max_age)
+          && delete_recording(*it)) {
+        it = recordings.erase(it);
+        continue;
+      }
+      if (policy_.compact_age.count() && is_older_than(*it, policy_.compact_age)
+          && !compacted_recordings.count(it->file_path)) {
+        it->size = CompactRecording(*it);
+        db_.SetRecordingCompacted(it->file_path);
+      }
+      vm_bytes[it->vm_id] += it->size;
+      total_bytes += it->size;
+      ++it;
+    }
+
+    // Delete the oldest recordings first
+    for (auto& recording : recordings) {
+      auto& bytes = vm_bytes[recording.vm_id];
+      const auto over_vm_quota =
+        policy_.max_vm_bytes && bytes > policy_.max_vm_bytes;
+      const auto over_total_quota =
+        policy_.max_total_bytes && total_bytes > policy_.max_total_bytes;
+      if (!over_vm_quota && !over_total_quota) {
+        continue;
+      }
+      const auto size = recording.size;
+      if (recording.stop_time && delete_recording(recording)) {
+        bytes -= size;
+        total_bytes -= size;
+      }
+    }
+
+    if (deleted_count) {
+      std::cout << "Deleted " << deleted_count << " recording(s) totaling "
+                << deleted_bytes / (1'024 * 1'024) << " MiB" << std::endl;
+    }
+  }
+
+  /**
+   * Recordings that were interrupted, like by a crash, don't have a stop
+   * time, so the time that the file was last written is used instead.
+   * Files that were written to recently are assumed to still be recording.
+   * @returns The stop time, or zero if the file is still being written to.
+   */
+  std::uint64_t GetInterruptedStopTime(const RecordingFile& recording,
+                                       std::uint64_t now) const {
+    auto error_code = std::error_code();
+    const auto write_time =
+      std::filesystem::last_write_time(recording.file_path, error_code);
+    if (error_code) {
+      return recording.start_time;
+    }
+    // The clock of file times can't be converted directly before C++20
+    const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::filesystem::file_time_type::clock::now() - write_time);
+    if (age < interval_) {
+      return 0;
+    }
+    const auto stop_time = now - std::min<std::uint64_t>(age.count(), now);
+    return std::max(stop_time, recording.start_time);
+  }
+
+  bool DeleteRecording(const RecordingFile& recording) {
+    auto error_code = std::error_code();
+    // Returns false without an error if the file was already deleted
+    std::filesystem::remove(recording.file_path, error_code);
+    if (error_code) {
+      return false;
+    }
+    RemoveRecording(recording);
+    return true;
+  }
+
+  void RemoveRecording(const RecordingFile& recording) {
+    db_.DeleteRecording(recording.file_path);
+    index_.RemoveRecording(recording.vm_id, recording.file_path);
+    preview_cache_.RemoveRecording(recording.file_path);
+  }
+
+  /**
+   * Rewrites the recording without any audio streams.
+   * @returns The new size of the file.
+   */
+  std::uint64_t CompactRecording(const RecordingFile& recording) {
+    const auto temp_file_path = recording.file_path + ".tmp";
+    const auto removed_audio =
+      Server::CompactRecording(recording.file_path, temp_file_path);
+
+    auto error_code = std::error_code();
+    if (removed_audio) {
+      // Readers that still have the old file mapped are unaffected
+      std::filesystem::rename(temp_file_path, recording.file_path, error_code);
+      if (!error_code) {
+        index_.InvalidateKeyframes(recording.vm_id, recording.file_path);
+        preview_cache_.RemoveRecording(recording.file_path);
+      }
+    }
+    std::filesystem::remove(temp_file_path, error_code);
+    const auto size = std::filesystem::file_size(recording.file_path, error_code);
+    return error_code ? recording.size : size;
+  }
+
+  Database& db_;
+  RecordingIndex& index_;
+  RecordingPreviewCache& preview_cache_;
+  const Policy policy_;
+  const std::chrono::minutes interval_ = std::chrono::minutes(60);
+  boost::asio::steady_timer timer_;
+  boost::asio::thread_pool thread_pool_;
+};
+}
@@ -2,22 +2,31 @@
 
 #include <boost/asio.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
-#include <deque>
+#include <vector>
 
 namespace CollabVm::Server {
 template<typename TUserPtr>
 class TurnController {
   boost::asio::steady_timer turn_timer_;
   typename decltype(turn_timer_)::duration turn_time_;
-  std::deque<TUserPtr> turn_queue_;
+  // Users are given increasing tickets when they join the queue and their
+  // slot is emptied when they leave, so no other users are renumbered
+  std::vector<TUserPtr> turn_queue_;
+  // A Fenwick tree that counts the occupied slots, so a user's position is
+  // the number of users with smaller tickets
+  std::vector<std::uint32_t> ticket_counts_;
+  std::size_t front_ticket_ = 0;
+  std::size_t turn_queue_size_ = 0;
   std::optional<std::chrono::milliseconds> paused_time_;
 
   void UpdateCurrentTurn(typename decltype(turn_timer_)::duration time_remaining)
   {
-    if (turn_queue_.empty())
+    if (!turn_queue_size_)
     {
-      OnCurrentUserChanged(turn_queue_, std::chrono::milliseconds(0));
+      OnCurrentUserChanged(std::chrono::milliseconds(0));
       return;
     }
 
@@ -25,7 +34,7 @@ class TurnController {
     {
       turn_timer_.expires_after(time_remaining);
       turn_timer_.async_wait(
-        [this, current_user = *turn_queue_.begin()](auto ec)
+        [this, current_user = turn_queue_[front_ticket_]](auto ec)
         {
           if (!ec)
           {
@@ -34,9 +43,98 @@ class TurnController {
         });
     }
     OnCurrentUserChanged(
-      turn_queue_,
       std::chrono::duration_cast<std::chrono::milliseconds>(time_remaining));
   }
+
+  std::size_t AddTicket(TUserPtr user)
+  {
+    if (turn_queue_.size() >= 2 * turn_queue_size_ + min_compacted_size)
+    {
+      CompactTickets();
+    }
+    const auto ticket = turn_queue_.size();
+    turn_queue_.emplace_back(std::move(user));
+    turn_queue_size_++;
+    // Node i of the tree counts the tickets in (i - LowestBit(i), i]
+    const auto node = ticket + 1;
+    auto count = std::uint32_t(1);
+    for (auto child = node - 1; child > node - LowestBit(node);
+         child -= LowestBit(child))
+    {
+      count += ticket_counts_[child];
+    }
+    if (ticket_counts_.empty())
+    {
+      ticket_counts_.push_back(0);
+    }
+    ticket_counts_.push_back(count);
+    return ticket;
+  }
+
+  void RemoveTicket(std::size_t ticket)
+  {
+    turn_queue_[ticket] = TUserPtr();
+    for (auto node = ticket + 1; node < ticket_counts_.size();
+         node += LowestBit(node))
+    {
+      ticket_counts_[node]--;
+    }
+    if (--turn_queue_size_ && ticket == front_ticket_)
+    {
+      while (!turn_queue_[++front_ticket_])
+      {
+      }
+    }
+  }
+
+  [[nodiscard]]
+  std::size_t CountTicketsBefore(std::size_t ticket) const
+  {
+    auto count = std::size_t(0);
+    for (auto node = ticket; node > 0; node -= LowestBit(node))
+    {
+      count += ticket_counts_[node];
+    }
+    return count;
+  }
+
+  static std::size_t LowestBit(std::size_t node)
+  {
+    return node & (~node + 1);
+  }
+
+  // Moves the users to the start of the slots once at least half of them
+  // are empty, so the slots grow with the queue rather than with every
+  // turn that has been taken
+  void CompactTickets()
+  {
+    auto ticket = std::size_t(0);
+    for (auto slot = front_ticket_; slot < turn_queue_.size(); slot++)
+    {
+      if (auto& user = turn_queue_[slot])
+      {
+        user->turn_queue_ticket_ = ticket;
+        if (slot != ticket)
+        {
+          turn_queue_[ticket] = std::move(user);
+        }
+        ticket++;
+      }
+    }
+    turn_queue_.resize(ticket);
+    front_ticket_ = 0;
+    ticket_counts_.assign(ticket ? ticket + 1 : 0, 0);
+    for (auto node = std::size_t(1); node <= ticket; node++)
+    {
+      ticket_counts_[node]++;
+      if (const auto parent = node + LowestBit(node); parent <= ticket)
+      {
+        ticket_counts_[parent] += ticket_counts_[node];
+      }
+    }
+  }
+
+  constexpr static std::size_t min_compacted_size = 64;
 public:
   template<typename TExecutionContext>
   explicit TurnController(TExecutionContext& context) :
@@ -48,75 +146,105 @@ public:
   [[nodiscard]]
   std::chrono::milliseconds GetTimeRemaining() const
   {
-    return turn_queue_.empty()
+    return !turn_queue_size_
         ? std::chrono::milliseconds(0)
         : std::chrono::duration_cast<std::chrono::milliseconds>(
             turn_timer_.expiry() - std::chrono::steady_clock::now());
   }
 
   [[nodiscard]]
-  const std::deque<TUserPtr>& GetTurnQueue() const
+  std::size_t GetTurnQueueSize() const
   {
-    return turn_queue_;
+    return turn_queue_size_;
+  }
+
+  /**
+   * Invokes the callback with each user in the queue, starting with the
+   * current user.
+   */
+  template<typename TCallback>
+  void ForEachUserInQueue(TCallback&& callback) const
+  {
+    for (auto ticket = front_ticket_; ticket < turn_queue_.size(); ticket++)
+    {
+      if (const auto& user = turn_queue_[ticket])
+      {
+        callback(user);
+      }
+    }
   }
 
   class UserTurnData
   {
-    using TurnQueuePositionType = typename decltype(turn_queue_)::size_type;
-    std::optional<TurnQueuePositionType> turn_queue_position_;
+    std::optional<std::size_t> turn_queue_ticket_;
     friend class TurnController;
   };
 
+  /**
+   * @returns The number of users ahead of the user, or an empty optional
+   *          if the user isn't in the queue.
+   */
+  [[nodiscard]]
+  std::optional<std::size_t> GetTurnQueuePosition(const TUserPtr& user) const
+  {
+    if (!user->turn_queue_ticket_.has_value())
+    {
+      return {};
+    }
+    return CountTicketsBefore(user->turn_queue_ticket_.value());
+  }
+
   auto GetCurrentUser() const
   {
-    return turn_queue_.empty()
+    return !turn_queue_size_
              ? std::optional<TUserPtr>()
-             : turn_queue_.front();
+             : turn_queue_[front_ticket_];
   }
 
   bool RequestTurn(TUserPtr user)
   {
-    if (user->turn_queue_position_.has_value())
+    if (user->turn_queue_ticket_.has_value())
     {
       return false;
     }
-    turn_queue_.emplace_back(user);
-    user->turn_queue_position_ = turn_queue_.size() - 1;
+    if (!turn_queue_size_)
+    {
+      // Start over since the slots are all empty
+      turn_queue_.clear();
+      ticket_counts_.clear();
+      front_ticket_ = 0;
+    }
+    const auto position = turn_queue_size_;
+    user->turn_queue_ticket_ = AddTicket(user);
 
-    if (user->turn_queue_position_ == 0)
+    if (position == 0)
     {
       UpdateCurrentTurn(turn_time_);
     }
     else
     {
-      OnUserAdded(turn_queue_, GetTimeRemaining());
+      OnUserAdded(user, position, GetTimeRemaining());
     }
     return true;
   }
 
   bool RemoveUser(const TUserPtr& user)
   {
-    if (!user->turn_queue_position_.has_value())
+    if (!user->turn_queue_ticket_.has_value())
     {
       return false;
     }
-    const auto user_position =
-      turn_queue_.begin() + user->turn_queue_position_.value();
-    // Remove the user and update the queue position for all users behind them
-    for (auto after_removed = turn_queue_.erase(user_position);
-         after_removed != turn_queue_.end(); after_removed++)
-    {
-      after_removed->get()->turn_queue_position_.value()--;
-    }
-    const auto old_position = user->turn_queue_position_.value();
-    user->turn_queue_position_.reset();
-    if (old_position == 0)
+    const auto ticket = user->turn_queue_ticket_.value();
+    const auto position = CountTicketsBefore(ticket);
+    user->turn_queue_ticket_.reset();
+    RemoveTicket(ticket);
+    if (position == 0)
     {
       UpdateCurrentTurn(turn_time_);
     }
     else
     {
-      OnUserRemoved(turn_queue_, GetTimeRemaining());
+      OnUserRemoved(user, position, GetTimeRemaining());
     }
     return true;
   }
@@ -154,35 +282,46 @@ public:
 
   void EndCurrentTurn()
   {
-    if (turn_queue_.empty())
+    if (!turn_queue_size_)
     {
       return;
     }
-    RemoveUser(turn_queue_.front());
+    RemoveUser(TUserPtr(turn_queue_[front_ticket_]));
   }
 
   void Clear()
   {
     turn_timer_.cancel();
 
-    if (!turn_queue_.empty())
+    if (turn_queue_size_)
     {
-      for (auto& user : turn_queue_)
+      ForEachUserInQueue([](auto& user)
       {
-        user->turn_queue_position_.reset();
-      }
+        user->turn_queue_ticket_.reset();
+      });
       turn_queue_.clear();
-      OnCurrentUserChanged(turn_queue_, std::chrono::milliseconds(0));
+      ticket_counts_.clear();
+      front_ticket_ = 0;
+      turn_queue_size_ = 0;
+      OnCurrentUserChanged(std::chrono::milliseconds(0));
     }
   }
 
 protected:
-  virtual void OnCurrentUserChanged(
-    const std::deque<TUserPtr>& users, std::chrono::milliseconds time_remaining) = 0;
-  virtual void OnUserAdded(
-    const std::deque<TUserPtr>& users, std::chrono::milliseconds time_remaining) = 0;
-  virtual void OnUserRemoved(
-    const std::deque<TUserPtr>& users, std::chrono::milliseconds time_remaining) = 0;
+  virtual void OnCurrentUserChanged(std::chrono::milliseconds time_remaining) = 0;
+  /**
+   * @param position The number of users ahead of the user that was added.
+   */
+  virtual void OnUserAdded(const TUserPtr& user,
+                           std::size_t position,
+                           std::chrono::milliseconds time_remaining) = 0;
+  /**
+   * @param position The number of users that were ahead of the user that
+   *                 was removed.
+   */
+  virtual void OnUserRemoved(const TUserPtr& user,
+                             std::size_t position,
+                             std::chrono::milliseconds time_remaining) = 0;
 };
 
 }
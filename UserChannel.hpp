@@ -1,8 +1,12 @@
 #pragma once
 
+#include <boost/asio/steady_timer.hpp>
 #include <boost/functional/hash.hpp>
+#include <chrono>
 #include <cstdint>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 #include "IPData.hpp"
 
 namespace CollabVm::Server
@@ -12,14 +16,20 @@ template<typename TClient,
          typename TBase = std::nullptr_t>
 struct UserChannel
 {
-  explicit UserChannel(const std::uint32_t id) :
-    chat_room_(id)
+  template<typename TExecutionContext>
+  UserChannel(TExecutionContext& context, const std::uint32_t id) :
+    chat_room_(id),
+    chat_timer_(context)
   {
   }
 
   void Clear()
   {
+    clients_.clear();
     users_.clear();
+    admin_flags_.clear();
+    slots_.clear();
+    InvalidateUserLists();
   }
 
   const auto& GetChatRoom() const
@@ -32,21 +42,35 @@ struct UserChannel
     return chat_room_;
   }
 
-  const auto& GetUsers() const
+  std::size_t GetUserCount() const
   {
-    return users_;
+    return clients_.size();
   }
 
   template<typename TCallback>
   void ForEachUser(TCallback&& callback) {
     OnForEachUsers(callback);
-    std::for_each(
-      users_.begin(),
-      users_.end(),
-      [callback=std::forward<TCallback>(callback)]
-      (auto& user) mutable {
-        callback(user.second, *user.first);
+    for (auto slot = std::size_t(0); slot < clients_.size(); slot++) {
+      callback(users_[slot], *clients_[slot]);
+    }
+  }
+
+  /**
+   * Invokes the callback with the socket and user data of the user with the
+   * username, if there is one.
+   */
+  template<typename TCallback>
+  void FindUser(std::string_view username, TCallback&& callback)
+  {
+    const auto user = std::find_if(users_.begin(), users_.end(),
+      [username](const auto& user_data)
+      {
+        return user_data.username == username;
       });
+    if (user != users_.end())
+    {
+      callback(clients_[user - users_.begin()], *user);
+    }
   }
 
   template<typename TCallback>
@@ -63,18 +87,17 @@ struct UserChannel
   void AddUser(TUserData&& initial_user_data, std::shared_ptr<TClient> user)
   {
     OnAddUser(user);
-    auto& ip_data = ip_data_[initial_user_data.ip_address];
-    ip_data.reference_count_++;
-    auto& user_data = users_.emplace(user, UserData(std::move(initial_user_data), ip_data)).first->second;
-    admins_count_ += !!(user_data.user_type == CollabVmServerMessage::UserType::ADMIN);
-    user->QueueMessage(
-      user_data.IsAdmin()
-      ? CreateAdminUserListMessage()
-      : CreateUserListMessage());
-
-    if (users_.size() <= 1) {
+    if (slots_.count(user.get())) {
       return;
     }
+    auto& ip_data = ip_data_[initial_user_data.ip_address];
+    ip_data.reference_count_++;
+    const auto slot = static_cast<std::uint32_t>(clients_.size());
+    slots_.emplace(user.get(), slot);
+    clients_.push_back(user);
+    auto& user_data = users_.emplace_back(std::move(initial_user_data), ip_data);
+    admin_flags_.push_back(user_data.IsAdmin());
+    admins_count_ += admin_flags_.back();
 
     auto user_message = SocketMessage::CreateShared();
     auto add_user = user_message->GetMessageBuilder()
@@ -92,16 +115,13 @@ struct UserChannel
     add_admin_user.setChannel(GetId());
     AddUserToList(user_data, add_admin_user.initUser());
 
-    ForEachUser([excluded_user = user.get(), user_message=std::move(user_message),
-                 admin_user_message=std::move(admin_user_message)]
-      (const auto& user_data, TClient& user)
-      {
-        if (&user == excluded_user) {
-          return;
-        }
-        user.QueueMessage(
-          user_data.IsAdmin() ? admin_user_message : user_message);
-      });
+    AddUserListChange(user_message, admin_user_message);
+    SendUserList(*user, user_data.IsAdmin());
+    // The new user is in the last slot
+    for (auto i = std::size_t(0); i < slot; i++) {
+      clients_[i]->QueueMessage(
+        admin_flags_[i] ? admin_user_message : user_message);
+    }
   }
 
   void OnAddUser(std::shared_ptr<TClient> user) {
@@ -114,26 +134,136 @@ struct UserChannel
     }
   }
 
-  auto GetUserData(std::shared_ptr<TClient> user_ptr)
+  auto GetUserData(const std::shared_ptr<TClient>& user_ptr)
   {
     return GetUserData(*this, user_ptr);
   }
 
-  auto GetUserData(std::shared_ptr<TClient> user_ptr) const
+  auto GetUserData(const std::shared_ptr<TClient>& user_ptr) const
   {
     return GetUserData(*this, user_ptr);
   }
 
+  void SetUserType(const std::shared_ptr<TClient>& user,
+                   CollabVmServerMessage::UserType user_type)
+  {
+    const auto slot = slots_.find(user.get());
+    if (slot == slots_.end() || users_[slot->second].user_type == user_type) {
+      return;
+    }
+    // User types aren't included in the changes to the user lists
+    InvalidateUserLists();
+    users_[slot->second].user_type = user_type;
+    auto admin_flag = admin_flags_[slot->second];
+    admins_count_ -= admin_flag;
+    admin_flag = users_[slot->second].IsAdmin();
+    admins_count_ += admin_flag;
+    admin_flags_[slot->second] = admin_flag;
+  }
+
+  void ChangeUsername(const std::shared_ptr<TClient>& user,
+                      std::string new_username,
+                      CollabVmServerMessage::UserType user_type)
+  {
+    auto user_data = GetUserData(user);
+    if (!user_data.has_value()) {
+      return;
+    }
+    SetUserType(user, user_type);
+    auto& current_username = user_data.value().get().username;
+    auto message = SocketMessage::CreateShared();
+    auto username_change = message->GetMessageBuilder()
+                                  .initRoot<CollabVmServerMessage>()
+                                  .initMessage()
+                                  .initChangeUsername();
+    username_change.setOldUsername(current_username);
+    username_change.setNewUsername(new_username);
+
+    current_username = std::move(new_username);
+
+    AddUserListChange(message, message);
+    BroadcastMessage(std::move(message));
+  }
+
   void BroadcastMessage(std::shared_ptr<SocketMessage>&& message) {
-    ForEachUser(
-      [message =
-        std::forward<std::shared_ptr<SocketMessage>>(message)]
-      (const auto&, auto& user)
+    auto queue_message = [&message](const auto&, auto& user)
       {
         user.QueueMessage(message);
-      });
+      };
+    OnForEachUsers(queue_message);
+    for (const auto& client : clients_) {
+      client->QueueMessage(message);
+    }
   }
   
+  /**
+   * Adds a message to the chat room and broadcasts it. If the interval isn't
+   * zero, every message that is sent within the interval is broadcast
+   * together so each user only receives one message per interval.
+   */
+  void SendChatMessage(const std::string& username,
+                       CollabVmServerMessage::UserType user_type,
+                       const std::string& message,
+                       std::chrono::milliseconds batch_interval)
+  {
+    if (batch_interval == std::chrono::milliseconds::zero())
+    {
+      auto new_chat_message = SocketMessage::CreateShared();
+      auto chat_room_message =
+        new_chat_message->GetMessageBuilder()
+                        .initRoot<CollabVmServerMessage>()
+                        .initMessage()
+                        .initChatMessage();
+      chat_room_.AddUserMessage(chat_room_message,
+                                username,
+                                user_type,
+                                message);
+      BroadcastMessage(std::move(new_chat_message));
+      return;
+    }
+    if (chat_room_.AddPendingUserMessage(username, user_type, message))
+    {
+      BroadcastPendingChatMessages();
+      return;
+    }
+    if (chat_timer_pending_)
+    {
+      return;
+    }
+    chat_timer_pending_ = true;
+    chat_timer_.expires_after(batch_interval);
+    chat_timer_.async_wait([this](const auto error_code)
+    {
+      if (error_code)
+      {
+        return;
+      }
+      BroadcastPendingChatMessages();
+    });
+  }
+
+  /**
+   * Sends the user up to count chat messages that were broadcast before the
+   * oldest one it has received.
+   */
+  void SendChatHistoryPage(const std::shared_ptr<TClient>& user,
+                           std::uint32_t count)
+  {
+    const auto slot_it = slots_.find(user.get());
+    if (slot_it == slots_.end())
+    {
+      return;
+    }
+    auto& before_id = users_[slot_it->second].chat_history_before_id;
+    auto [message, begin_id] =
+      chat_room_.GetChatHistoryPage(before_id, count);
+    before_id = begin_id;
+    if (message)
+    {
+      user->QueueMessage(std::move(message));
+    }
+  }
+
   auto CreateUserListMessage() {
     return CreateUserListMessages(
       &CollabVmServerMessage::Message::Builder::initUserList);
@@ -146,15 +276,16 @@ struct UserChannel
 
   void RemoveUser(std::shared_ptr<TClient> user)
   {
-    auto user_it = users_.find(user);
-    if (user_it == users_.end()) {
+    const auto slot_it = slots_.find(user.get());
+    if (slot_it == slots_.end()) {
       return;
     }
-    auto& user_data = user_it->second;
-    if (!--user_data.ip_data.reference_count_) {
+    const auto slot = slot_it->second;
+    auto& user_data = users_[slot];
+    if (!--user_data.ip_data->reference_count_) {
       ip_data_.erase(user_data.ip_address);
     }
-    admins_count_ -= !!(user_data.user_type == CollabVmServerMessage::UserType::ADMIN);
+    admins_count_ -= admin_flags_[slot];
 
     auto message = SocketMessage::CreateShared();
     auto user_list_remove = message->GetMessageBuilder()
@@ -165,8 +296,19 @@ struct UserChannel
     user_list_remove.setUsername(user_data.username);
 
     OnRemoveUser(user);
-    users_.erase(user_it);
+    // Move the user in the last slot into the removed user's slot
+    slots_.erase(slot_it);
+    if (slot != clients_.size() - 1) {
+      clients_[slot] = std::move(clients_.back());
+      users_[slot] = std::move(users_.back());
+      admin_flags_[slot] = admin_flags_.back();
+      slots_[clients_[slot].get()] = slot;
+    }
+    clients_.pop_back();
+    users_.pop_back();
+    admin_flags_.pop_back();
 
+    AddUserListChange(message, message);
     BroadcastMessage(std::move(message));
   }
 
@@ -182,18 +324,88 @@ struct UserChannel
   }
 
 private:
+  void BroadcastPendingChatMessages()
+  {
+    chat_timer_.cancel();
+    chat_timer_pending_ = false;
+    if (auto message = chat_room_.CreatePendingMessagesMessage())
+    {
+      BroadcastMessage(std::move(message));
+    }
+  }
+
   template<typename TUserChannel>
-  static auto GetUserData(TUserChannel& user_channel, std::shared_ptr<TClient> user_ptr)
+  static auto GetUserData(TUserChannel& user_channel, const std::shared_ptr<TClient>& user_ptr)
   {
     static_assert(std::is_same_v<
       std::remove_const_t<TUserChannel>, UserChannel>);
     using UserData = std::conditional_t<
       std::is_const_v<TUserChannel>, const UserData, UserData>;
-    auto& users_ = user_channel.users_;
-    auto user = users_.find(user_ptr);
-    return user == users_.end()
+    const auto& slots = user_channel.slots_;
+    const auto slot = slots.find(user_ptr.get());
+    return slot == slots.end()
       ? std::optional<std::reference_wrapper<UserData>>()
-      : std::optional<std::reference_wrapper<UserData>>(user->second);
+      : std::optional<std::reference_wrapper<UserData>>(
+          user_channel.users_[slot->second]);
+  }
+
+  /**
+   * Sends the user list to a user that joined. The list is serialized once
+   * and shared by every user that joins, along with the messages that were
+   * broadcast to add, remove, or rename users since it was serialized. It's
+   * only serialized again once there were too many of those messages.
+   */
+  void SendUserList(TClient& user, bool is_admin)
+  {
+    auto& user_list = is_admin ? admin_user_list_ : user_list_;
+    if (!user_list.snapshot) {
+      user_list.snapshot = is_admin
+                             ? CreateAdminUserListMessage()
+                             : CreateUserListMessage();
+      user_list.snapshot->CreateFrame();
+      user_list.changes.clear();
+    }
+    if (user_list.changes.empty()) {
+      user.QueueMessage(user_list.snapshot);
+      return;
+    }
+    user.QueueMessageBatch(
+      [snapshot = user_list.snapshot, changes = user_list.changes]
+      (auto enqueue)
+      {
+        enqueue(snapshot);
+        for (const auto& change : changes) {
+          enqueue(change);
+        }
+      });
+  }
+
+  void AddUserListChange(std::shared_ptr<SocketMessage> message,
+                         std::shared_ptr<SocketMessage> admin_message)
+  {
+    // Framed here because they're queued from other strands
+    message->CreateFrame();
+    admin_message->CreateFrame();
+    const auto add_change = [](UserList& user_list, auto&& change) {
+      if (!user_list.snapshot) {
+        return;
+      }
+      // The snapshot is created again by the next join instead of keeping
+      // every change until then
+      if (user_list.changes.size() >= max_user_list_changes) {
+        user_list = {};
+        return;
+      }
+      user_list.changes.push_back(std::move(change));
+    };
+    add_change(user_list_, message);
+    add_change(admin_user_list_, admin_message);
+  }
+
+  void InvalidateUserLists()
+  {
+    user_list_ = {};
+    admin_user_list_ = {};
   }
 
   template<typename TInitFunction>
@@ -206,11 +418,10 @@ private:
       .*init)();
     user_list.setChannel(GetId());
     auto users = user_list.initUsers(users_.size());
-    ForEachUser(
-      [this, users_it = users.begin()](auto& user_data, TClient&) mutable
-      {
-        AddUserToList(user_data, *users_it++);
-      });
+    auto users_it = users.begin();
+    for (const auto& user_data : users_) {
+      AddUserToList(user_data, *users_it++);
+    }
     return message;
   }
 
@@ -245,13 +456,31 @@ private:
   {
     UserData(TUserData&& user_data, ChannelIPData& ip_data)
       : TUserData(std::move(user_data)),
-        ip_data(ip_data)
+        ip_data(&ip_data)
     {
     }
-    ChannelIPData& ip_data;
+    // A pointer so the user data can be moved between slots
+    ChannelIPData* ip_data;
   };
 
-  std::unordered_map<std::shared_ptr<TClient>, UserData> users_;
+  // The users are stored in parallel arrays indexed by slot, so broadcasting
+  // a message only reads the contiguous array of sockets. Removing a user
+  // moves the user in the last slot into its slot.
+  std::vector<std::shared_ptr<TClient>> clients_;
+  std::vector<UserData> users_;
+  std::vector<std::uint8_t> admin_flags_;
+  // The slot of each socket, which is only used to find a specific user
+  // because a socket can be in more than one channel
+  std::unordered_map<const TClient*, std::uint32_t> slots_;
+  struct UserList
+  {
+    std::shared_ptr<SocketMessage> snapshot;
+    // The messages that were broadcast after the snapshot was created
+    std::vector<std::shared_ptr<SocketMessage>> changes;
+  };
+  constexpr static auto max_user_list_changes = 64u;
+  UserList user_list_;
+  UserList admin_user_list_;
   std::unordered_map<
       typename TClient::IpAddress::IpBytes,
       ChannelIPData,
@@ -261,6 +490,8 @@ private:
   CollabVmChatRoom<TClient,
 	                 CollabVm::Common::max_username_len,
                    CollabVm::Common::max_chat_message_len> chat_room_;
+  boost::asio::steady_timer chat_timer_;
+  bool chat_timer_pending_ = false;
   capnp::MallocMessageBuilder message_builder_;
 };
 }
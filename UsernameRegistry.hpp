@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace CollabVm::Server {
+/**
+ * The usernames of every user on the server, which are compared without
+ * regard to ASCII case. Usernames are case-folded once into fixed-size keys
+ * that are stored in one of several shards with separate locks, so users
+ * that connect at the same time rarely wait for each other. Guest usernames
+ * are allocated from a pool of free numbers instead of being probed.
+ * Thread-safe.
+ */
+template<typename TUser, std::size_t MaxUsernameLength, std::size_t ShardCount = 16>
+class UsernameRegistry {
+public:
+  UsernameRegistry(std::uint32_t min_guest_number, std::uint32_t max_guest_number)
+    : min_guest_number_(min_guest_number),
+      overflow_guest_number_(max_guest_number + 1),
+      guest_number_indexes_(max_guest_number - min_guest_number + 1) {
+    for (auto number = min_guest_number; number <= max_guest_number; number++) {
+      auto& free_numbers = GetGuestNumberPool(number).free_numbers;
+      guest_number_indexes_[number - min_guest_number] =
+        static_cast<std::uint32_t>(free_numbers.size());
+      free_numbers.push_back(number);
+    }
+  }
+
+  /**
+   * @returns false if the username is taken or too long.
+   */
+  bool TryAdd(std::string_view username, std::shared_ptr<TUser> user) {
+    const auto key = Key::Create(username);
+    if (!key) {
+      return false;
+    }
+    auto& shard = GetShard(*key);
+    {
+      const auto lock = std::lock_guard(shard.mutex);
+      if (!shard.users.emplace(*key, std::move(user)).second) {
+        return false;
+      }
+    }
+    if (const auto guest_number = GetGuestNumber(username)) {
+      // The username was chosen by a user, so it can't be allocated
+      auto& pool = GetGuestNumberPool(*guest_number);
+      const auto lock = std::lock_guard(pool.mutex);
+      TakeGuestNumber(pool, *guest_number);
+    }
+    return true;
+  }
+
+  /**
+   * Adds the user with a username of the form "guest" followed by a number
+   * that isn't taken.
+   */
+  std::string AddGuest(const std::shared_ptr<TUser>& user) {
+    while (true) {
+      const auto guest_number = AllocateGuestNumber();
+      auto username = std::string(guest_prefix) + std::to_string(guest_number);
+      const auto key = *Key::Create(username);
+      auto& shard = GetShard(key);
+      const auto lock = std::lock_guard(shard.mutex);
+      // A user may have chosen the username before the number was taken
+      if (shard.users.emplace(key, user).second) {
+        return username;
+      }
+    }
+  }
+
+  [[nodiscard]]
+  std::shared_ptr<TUser> Find(std::string_view username) const {
+    const auto key = Key::Create(username);
+    if (!key) {
+      return nullptr;
+    }
+    auto& shard = GetShard(*key);
+    const auto lock = std::lock_guard(shard.mutex);
+    const auto it = shard.users.find(*key);
+    return it == shard.users.end() ? nullptr : it->second;
+  }
+
+  void Remove(std::string_view username) {
+    const auto key = Key::Create(username);
+    if (!key) {
+      return;
+    }
+    auto& shard = GetShard(*key);
+    {
+      const auto lock = std::lock_guard(shard.mutex);
+      if (!shard.users.erase(*key)) {
+        return;
+      }
+    }
+    if (const auto guest_number = GetGuestNumber(username)) {
+      auto& pool = GetGuestNumberPool(*guest_number);
+      const auto lock = std::lock_guard(pool.mutex);
+      ReleaseGuestNumber(pool, *guest_number);
+    }
+  }
+
+  [[nodiscard]]
+  std::size_t GetCount() const {
+    auto count = std::size_t(0);
+    for (auto& shard : shards_) {
+      const auto lock = std::lock_guard(shard.mutex);
+      count += shard.users.size();
+    }
+    return count;
+  }
+
+private:
+  constexpr static std::string_view guest_prefix = "guest";
+
+  struct Key {
+    std::array<char, MaxUsernameLength> folded_username;
+    std::uint8_t length;
+    std::uint64_t hash;
+
+    static std::optional<Key> Create(std::string_view username) {
+      if (username.size() > MaxUsernameLength) {
+        return {};
+      }
+      auto key = Key{{}, static_cast<std::uint8_t>(username.size()), 0};
+      // FNV-1a
+      auto hash = std::uint64_t(14'695'981'039'346'656'037u);
+      for (auto i = std::size_t(0); i < username.size(); i++) {
+        const auto c = username[i];
+        key.folded_username[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        hash = (hash ^ static_cast<std::uint8_t>(key.folded_username[i]))
+               * 1'099'511'628'211u;
+      }
+      key.hash = hash;
+      return key;
+    }
+
+    bool operator==(const Key& key) const {
+      return length == key.length
+             && std::equal(folded_username.begin(),
+                           folded_username.begin() + length,
+                           key.folded_username.begin());
+    }
+  };
+
+  struct KeyHasher {
+    std::size_t operator()(const Key& key) const {
+      return static_cast<std::size_t>(key.hash);
+    }
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, std::shared_ptr<TUser>, KeyHasher> users;
+  };
+
+  // The free guest numbers are split between pools by their remainder so
+  // guests can be allocated and released concurrently
+  struct GuestNumberPool {
+    std::mutex mutex;
+    std::vector<std::uint32_t> free_numbers;
+    std::default_random_engine rng{std::random_device()()};
+  };
+
+  Shard& GetShard(const Key& key) {
+    // The low bits are used by the hash tables
+    return shards_[(key.hash >> 32) % ShardCount];
+  }
+
+  const Shard& GetShard(const Key& key) const {
+    return shards_[(key.hash >> 32) % ShardCount];
+  }
+
+  // @returns The number in a username of the form "guest" followed by a
+  // number in the range of the pool
+  std::optional<std::uint32_t> GetGuestNumber(std::string_view username) const {
+    if (username.size() <= guest_prefix.size()
+        || username.size() > guest_prefix.size() + 9
+        || !std::equal(guest_prefix.begin(), guest_prefix.end(), username.begin(),
+                       [](char a, char b) {
+                         return a == (b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b);
+                       })
+        || username[guest_prefix.size()] == '0') {
+      return {};
+    }
+    auto number = std::uint32_t(0);
+    for (const auto c : username.substr(guest_prefix.size())) {
+      if (c < '0' || c > '9') {
+        return {};
+      }
+      number = number * 10 + (c - '0');
+    }
+    if (number < min_guest_number_
+        || number - min_guest_number_ >= guest_number_indexes_.size()) {
+      return {};
+    }
+    return number;
+  }
+
+  GuestNumberPool& GetGuestNumberPool(std::uint32_t number) {
+    return guest_number_pools_[number % ShardCount];
+  }
+
+  std::uint32_t AllocateGuestNumber() {
+    const auto first_pool = next_guest_number_pool_++;
+    for (auto i = std::size_t(0); i < ShardCount; i++) {
+      auto& pool = guest_number_pools_[(first_pool + i) % ShardCount];
+      const auto lock = std::lock_guard(pool.mutex);
+      if (pool.free_numbers.empty()) {
+        continue;
+      }
+      const auto number = pool.free_numbers[
+        std::uniform_int_distribution<std::size_t>(
+          0, pool.free_numbers.size() - 1)(pool.rng)];
+      TakeGuestNumber(pool, number);
+      return number;
+    }
+    return overflow_guest_number_++;
+  }
+
+  void TakeGuestNumber(GuestNumberPool& pool, std::uint32_t number) {
+    auto& index = guest_number_indexes_[number - min_guest_number_];
+    if (index == taken) {
+      return;
+    }
+    // Move the last free number into its place
+    const auto last_number = pool.free_numbers.back();
+    pool.free_numbers[index] = last_number;
+    guest_number_indexes_[last_number - min_guest_number_] = index;
+    pool.free_numbers.pop_back();
+    index = taken;
+  }
+
+  void ReleaseGuestNumber(GuestNumberPool& pool, std::uint32_t number) {
+    auto& index = guest_number_indexes_[number - min_guest_number_];
+    if (index != taken) {
+      return;
+    }
+    index = static_cast<std::uint32_t>(pool.free_numbers.size());
+    pool.free_numbers.push_back(number);
+  }
+
+  constexpr static auto taken = UINT32_MAX;
+  std::array<Shard, ShardCount> shards_;
+  std::array<GuestNumberPool, ShardCount> guest_number_pools_;
+  std::atomic<std::size_t> next_guest_number_pool_ = 0;
+  const std::uint32_t min_guest_number_;
+  // Used once every pool is empty
+  std::atomic<std::uint32_t> overflow_guest_number_;
+  // The index of each number in the free numbers of its pool, or taken
+  std::vector<std::uint32_t> guest_number_indexes_;
+};
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <chrono>
 
 namespace CollabVm::Server {
 struct UserVoteData
@@ -18,6 +19,12 @@ struct UserVoteData
 template<typename TBase>
 class VoteController {
   boost::asio::steady_timer vote_timer_;
+  // Votes that are cast within the interval after a status update are
+  // combined into the next one
+  boost::asio::steady_timer status_timer_;
+  std::chrono::steady_clock::duration status_interval_;
+  std::chrono::steady_clock::time_point last_status_time_;
+  bool status_pending_ = false;
 
   enum class VoteState
   {
@@ -28,10 +35,51 @@ class VoteController {
   std::uint32_t yes_vote_count_ = 0;
   std::uint32_t no_vote_count_ = 0;
 
+  void OnVoteCountChanged()
+  {
+    if (status_pending_)
+    {
+      return;
+    }
+    const auto next_status_time = last_status_time_ + status_interval_;
+    if (std::chrono::steady_clock::now() >= next_status_time)
+    {
+      last_status_time_ = std::chrono::steady_clock::now();
+      static_cast<TBase&>(*this).OnVoteStatusChanged();
+      return;
+    }
+    status_pending_ = true;
+    status_timer_.expires_at(next_status_time);
+    status_timer_.async_wait(
+      [this](const auto ec)
+      {
+        if (ec || !status_pending_)
+        {
+          return;
+        }
+        status_pending_ = false;
+        last_status_time_ = std::chrono::steady_clock::now();
+        static_cast<TBase&>(*this).OnVoteStatusChanged();
+      });
+  }
+
+  void CancelVoteStatus()
+  {
+    status_pending_ = false;
+    status_timer_.cancel();
+  }
+
 public:
+  /**
+   * @param status_interval The minimum time between status updates caused
+   *                        by votes, or zero to send one for every vote.
+   */
   template<typename TExecutionContext>
-  explicit VoteController(TExecutionContext& context) :
-    vote_timer_(context)
+  explicit VoteController(TExecutionContext& context,
+                          std::chrono::steady_clock::duration status_interval = {}) :
+    vote_timer_(context),
+    status_timer_(context),
+    status_interval_(status_interval)
   {
   }
 
@@ -89,6 +137,8 @@ public:
       vote_timer_.async_wait(
         [this](const auto ec)
         {
+          // The final status replaces any update that is pending
+          CancelVoteStatus();
           if (ec || !static_cast<TBase&>(*this).GetVotesEnabled()) {
             vote_state_ = VoteState::kIdle;
             static_cast<TBase&>(*this).OnVoteIdle();
@@ -100,6 +150,7 @@ public:
           if (cooldown_time.count())
           {
             vote_state_ = VoteState::kCoolingdown;
+            static_cast<TBase&>(*this).OnVoteStatusChanged();
             vote_timer_.expires_after(cooldown_time);
             vote_timer_.async_wait([this](const auto ec)
               {
@@ -118,6 +169,10 @@ public:
         });
 
       static_cast<TBase&>(*this).OnVoteStart();
+      // Users are told about a new vote immediately
+      CancelVoteStatus();
+      last_status_time_ = std::chrono::steady_clock::now();
+      static_cast<TBase&>(*this).OnVoteStatusChanged();
       return true;
     }
     case VoteState::kVoting:
@@ -138,6 +193,7 @@ public:
         (voted_yes ? no_vote_count_ : yes_vote_count_)--;
       }
       data.last_vote = vote_decision;
+      OnVoteCountChanged();
       return true;
     }
     case VoteState::kCoolingdown:
@@ -155,6 +211,10 @@ public:
       ? yes_vote_count_
       : no_vote_count_);
     data.last_vote = UserVoteData::VoteDecision::kUndecided;
+    if (vote_state_ == VoteState::kVoting)
+    {
+      OnVoteCountChanged();
+    }
     return true;
   }
 
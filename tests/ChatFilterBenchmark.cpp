@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "ChatFilter.hpp"
+
+// Builds a filter from 2,000 random phrases and measures how long it takes
+// to check chat messages of typical lengths.
+
+using CollabVm::Server::ChatFilter;
+
+constexpr auto phrases_count = 2'000u;
+constexpr auto messages_count = 10'000u;
+constexpr auto iterations = 100u;
+
+bool Check(const ChatFilter& filter, std::string text, const std::string& expected) {
+  const auto contains = filter.Contains(text);
+  const auto masked = filter.Mask(text.data(), text.size());
+  if (contains != masked || text != expected) {
+    std::cout << "Expected '" << expected << "' but got '" << text << "'" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  const auto simple_filter = ChatFilter({"he", "she", "hers", "HIS", "spam link"});
+  if (!Check(simple_filter, "nothing to see", "nothing to see")
+      || !Check(simple_filter, "ushers", "u*****")
+      || !Check(simple_filter, "This Is SPAM LINK", "T*** Is *********")
+      || !Check(simple_filter, "", "")
+      || !Check(simple_filter, "sheers", "***ers")) {
+    return 1;
+  }
+
+  auto rng = std::default_random_engine(0);
+  const auto random_text = [&rng](std::size_t min_length, std::size_t max_length) {
+    auto text = std::string(
+      std::uniform_int_distribution<std::size_t>(min_length, max_length)(rng), ' ');
+    auto letters = std::uniform_int_distribution<int>(0, 29);
+    for (auto& c : text) {
+      const auto letter = letters(rng);
+      c = letter < 26 ? 'a' + letter : ' ';
+    }
+    return text;
+  };
+  auto phrases = std::vector<std::string>();
+  for (auto i = 0u; i < phrases_count; i++) {
+    phrases.push_back(random_text(5, 12));
+  }
+  auto start = std::chrono::steady_clock::now();
+  const auto filter = ChatFilter(phrases);
+  const auto build_duration = std::chrono::steady_clock::now() - start;
+
+  auto messages = std::vector<std::string>();
+  for (auto i = 0u; i < messages_count; i++) {
+    messages.push_back(random_text(20, 100));
+    if (i % 100 == 0) {
+      messages.back() += phrases[i % phrases_count];
+    }
+  }
+  auto total_length = std::size_t(0);
+  for (const auto& message : messages) {
+    total_length += message.size();
+  }
+
+  auto matches = 0u;
+  start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < iterations; i++) {
+    for (const auto& message : messages) {
+      matches += filter.Contains(message);
+    }
+  }
+  const auto duration = std::chrono::steady_clock::now() - start;
+  if (matches < iterations * messages_count / 100) {
+    std::cout << "Only " << matches << " messages matched" << std::endl;
+    return 1;
+  }
+
+  const auto to_ns = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  };
+  std::cout << "Built " << filter.GetStateCount() << " states from "
+            << phrases_count << " phrases in "
+            << to_ns(build_duration) / 1'000'000.0 << " ms\n"
+            << "Checked " << iterations * messages_count << " messages (average length "
+            << total_length / messages_count << ") in "
+            << to_ns(duration) / 1'000'000.0 << " ms ("
+            << to_ns(duration) / double(iterations * messages_count)
+            << " ns per message)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <boost/asio/buffer.hpp>
+#include <capnp/message.h>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "ChatHistory.hpp"
+#include "CollabVmChatRoom.hpp"
+#include "CollabVm.capnp.h"
+#include "CollabVmCommon.hpp"
+
+// Compares the memory used by the chat history of 1000 rooms with the
+// preallocated capnp list that was previously used for each room, and
+// checks that the most recent messages are kept in order. Also compares the
+// size of the history sent to users that join with the size of the entire
+// history, and checks that the rest of it can be requested in pages.
+
+constexpr auto max_messages = 100u;
+constexpr auto rooms_count = 1'000u;
+
+using History = CollabVm::Server::ChatHistory<max_messages>;
+using ChatRoom = CollabVm::Server::CollabVmChatRoom<
+  std::nullptr_t,
+  CollabVm::Common::max_username_len,
+  CollabVm::Common::max_chat_message_len>;
+
+std::size_t GetPreallocatedHistorySize() {
+  auto message_builder = capnp::MallocMessageBuilder();
+  auto channel_messages = message_builder.initRoot<CollabVmServerMessage>()
+                                         .initMessage()
+                                         .initChatMessages();
+  auto messages = channel_messages.initMessages(max_messages);
+  for (auto&& message : messages) {
+    message.initSender(CollabVm::Common::max_username_len);
+    message.initMessage(CollabVm::Common::max_chat_message_len);
+  }
+  auto size = std::size_t(0);
+  for (const auto segment : message_builder.getSegmentsForOutput()) {
+    size += segment.asBytes().size();
+  }
+  return size;
+}
+
+int main() {
+  auto rng = std::default_random_engine(1);
+  auto random_string = [&rng](auto min_length, auto max_length) {
+    auto string = std::string(
+      std::uniform_int_distribution<std::size_t>(min_length, max_length)(rng),
+      '\0');
+    for (auto& c : string) {
+      c = std::uniform_int_distribution<int>('a', 'z')(rng);
+    }
+    return string;
+  };
+
+  auto rooms = std::vector<History>(rooms_count);
+  auto memory_usage = std::size_t(0);
+  for (auto i = 0u; i < rooms_count; i++) {
+    // Most rooms are quiet and a few are busy
+    const auto messages_count = i % 10 == 0 ? 1'000u : i % 3 == 0 ? 0u : i % 150;
+    auto messages = std::vector<std::pair<std::string, std::string>>();
+    for (auto j = 0u; j < messages_count; j++) {
+      auto& [sender, message] = messages.emplace_back(
+        random_string(3, 20),
+        random_string(1, CollabVm::Common::max_chat_message_len / 4));
+      rooms[i].Add(sender, message, CollabVmServerMessage::UserType::GUEST, j);
+    }
+
+    const auto expected_count = std::min(messages_count, max_messages);
+    if (rooms[i].GetCount() != expected_count) {
+      std::cout << "Room " << i << " has " << rooms[i].GetCount()
+                << " messages instead of " << expected_count << std::endl;
+      return 1;
+    }
+    auto message_index = messages_count - expected_count;
+    auto messages_match = true;
+    rooms[i].ForEach(
+      [&](auto sender, auto message, auto, auto timestamp) {
+        messages_match = messages_match && timestamp == message_index
+          && sender == messages[message_index].first
+          && message == messages[message_index].second;
+        message_index++;
+      });
+    if (!messages_match) {
+      std::cout << "Messages in room " << i << " do not match" << std::endl;
+      return 1;
+    }
+    memory_usage += sizeof(History) + rooms[i].GetMemoryUsage();
+  }
+
+  auto chat_room = ChatRoom(1);
+  for (auto i = 0u; i < 1'000; i++) {
+    chat_room.AddPendingUserMessage(
+      random_string(3, 20),
+      CollabVmServerMessage::UserType::GUEST,
+      random_string(1, CollabVm::Common::max_chat_message_len));
+    chat_room.CreatePendingMessagesMessage();
+  }
+  const auto get_size = [](const auto& socket_message) {
+    return boost::asio::buffer_size(socket_message->GetBuffers());
+  };
+  const auto get_messages =
+    [](const CollabVm::Server::SocketMessage& socket_message) {
+      return socket_message.GetRoot<CollabVmServerMessage>()
+                           .getMessage().getChatMessages().getMessages();
+    };
+  const auto join_message = chat_room.GetChatHistoryMessage();
+  const auto join_begin_id = chat_room.GetChatHistoryMessageBeginId();
+  const auto [full_history_message, full_history_begin_id] =
+    chat_room.GetChatHistoryPage(UINT64_MAX, max_messages);
+  const auto join_count = get_messages(*join_message).size();
+  if (join_begin_id != 1'000 - join_count
+      || full_history_begin_id != 1'000 - max_messages) {
+    std::cout << "The joined history has the wrong messages" << std::endl;
+    return 1;
+  }
+  // Request the rest of the history from newest to oldest
+  auto before_id = join_begin_id;
+  auto paged_count = 0u;
+  while (true) {
+    const auto [page, begin_id] = chat_room.GetChatHistoryPage(before_id, 20);
+    if (!page) {
+      break;
+    }
+    const auto messages = get_messages(*page);
+    const auto expected_newest_message = get_messages(*full_history_message)
+      [before_id - 1 - full_history_begin_id];
+    if (messages.size() != before_id - begin_id
+        || messages[messages.size() - 1].getSender()
+           != expected_newest_message.getSender()) {
+      std::cout << "History page before " << before_id << " is wrong" << std::endl;
+      return 1;
+    }
+    paged_count += messages.size();
+    before_id = begin_id;
+  }
+  if (paged_count + join_count != max_messages) {
+    std::cout << "Only " << paged_count << " messages could be paged" << std::endl;
+    return 1;
+  }
+
+  const auto preallocated_memory_usage =
+    rooms_count * GetPreallocatedHistorySize();
+  std::cout << "Compact history: " << memory_usage / 1'024 << " KiB\n"
+            << "Preallocated history: " << preallocated_memory_usage / 1'024
+            << " KiB\n"
+            << "Join history: " << join_count << " messages, "
+            << get_size(join_message) << " bytes\n"
+            << "Entire history: " << max_messages << " messages, "
+            << get_size(full_history_message) << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "CpuPool.hpp"
+
+// Measures how late timers fire on threads that handle I/O while CPU-heavy
+// tasks are run, either on the same threads or on the CPU pool, and checks
+// the pool's priorities, backpressure, work stealing and that results are
+// posted to the strand of the caller.
+
+using CollabVm::Server::CpuPool;
+using Clock = std::chrono::steady_clock;
+
+constexpr auto io_threads_count = 2u;
+constexpr auto tick_interval = std::chrono::milliseconds(1);
+constexpr auto task_interval = std::chrono::milliseconds(5);
+constexpr auto task_time = std::chrono::milliseconds(4);
+constexpr auto run_time = std::chrono::seconds(1);
+
+void BusyWait(Clock::duration duration) {
+  const auto end = Clock::now() + duration;
+  while (Clock::now() < end) {
+  }
+}
+
+bool CheckPriorities() {
+  auto pool = CpuPool(1, 100);
+  auto blocked = std::promise<void>();
+  pool.Post(CpuPool::Priority::Interactive,
+            [blocked = blocked.get_future().share()] { blocked.wait(); });
+  auto mutex = std::mutex();
+  auto order = std::vector<CpuPool::Priority>();
+  auto finished = std::promise<void>();
+  for (auto i = 0; i < 10; i++) {
+    pool.Post(CpuPool::Priority::Background, [&, i] {
+      const auto lock = std::lock_guard(mutex);
+      order.push_back(CpuPool::Priority::Background);
+      if (i == 9) {
+        finished.set_value();
+      }
+    });
+  }
+  for (auto i = 0; i < 10; i++) {
+    pool.Post(CpuPool::Priority::Interactive, [&] {
+      const auto lock = std::lock_guard(mutex);
+      order.push_back(CpuPool::Priority::Interactive);
+    });
+  }
+  blocked.set_value();
+  finished.get_future().wait();
+  const auto lock = std::lock_guard(mutex);
+  return std::is_partitioned(order.begin(), order.end(), [](auto priority) {
+    return priority == CpuPool::Priority::Interactive;
+  }) && order.front() == CpuPool::Priority::Interactive;
+}
+
+bool CheckBackpressure() {
+  constexpr auto max_queued_tasks = 8u;
+  auto pool = CpuPool(1, max_queued_tasks);
+  auto blocked = std::promise<void>();
+  auto started = std::promise<void>();
+  pool.Post(CpuPool::Priority::Background,
+            [&started, blocked = blocked.get_future().share()] {
+              started.set_value();
+              blocked.wait();
+            });
+  started.get_future().wait();
+  auto accepted = 0u;
+  for (auto i = 0u; i < 2 * max_queued_tasks; i++) {
+    accepted += pool.TryPost(CpuPool::Priority::Background, [] {});
+  }
+  // A full queue doesn't stop interactive tasks
+  const auto accepted_interactive =
+    pool.TryPost(CpuPool::Priority::Interactive, [] {});
+  blocked.set_value();
+  return accepted == max_queued_tasks && accepted_interactive;
+}
+
+bool CheckWorkStealing() {
+  auto pool = CpuPool(4, 1'000);
+  auto mutex = std::mutex();
+  auto thread_ids = std::set<std::thread::id>();
+  auto remaining = std::atomic<int>(100);
+  auto finished = std::promise<void>();
+  auto poster_id = std::thread::id();
+  pool.Post(CpuPool::Priority::Background, [&] {
+    poster_id = std::this_thread::get_id();
+    for (auto i = 0; i < 100; i++) {
+      // Tasks posted by a worker are queued for itself
+      pool.Post(CpuPool::Priority::Background, [&] {
+        {
+          const auto lock = std::lock_guard(mutex);
+          thread_ids.insert(std::this_thread::get_id());
+        }
+        if (--remaining == 0) {
+          finished.set_value();
+        }
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  });
+  finished.get_future().wait();
+  const auto lock = std::lock_guard(mutex);
+  return !thread_ids.count(poster_id);
+}
+
+bool CheckResultStrand() {
+  auto io_context = boost::asio::io_context();
+  auto strand = boost::asio::make_strand(io_context);
+  auto pool = CpuPool(2, 100);
+  auto result_on_strand = false;
+  pool.TryPost(CpuPool::Priority::Interactive,
+    [] { return 42; },
+    boost::asio::bind_executor(strand, [&](int result) {
+      result_on_strand = result == 42 && strand.running_in_this_thread();
+    }));
+  // Strands of the pool's executors run their handlers in order
+  auto pool_strand = boost::asio::make_strand(pool.get_executor());
+  auto timer = boost::asio::steady_timer(io_context, std::chrono::milliseconds(1));
+  auto handlers_in_order = true;
+  auto next_handler = 0;
+  auto timer_handled = std::promise<void>();
+  for (auto i = 0; i < 100; i++) {
+    boost::asio::post(pool_strand, [&, i] { handlers_in_order &= next_handler++ == i; });
+  }
+  timer.async_wait(boost::asio::bind_executor(pool_strand, [&](auto) {
+    handlers_in_order &= next_handler == 100
+      && pool_strand.running_in_this_thread();
+    timer_handled.set_value();
+  }));
+  io_context.run();
+  timer_handled.get_future().wait();
+  return result_on_strand && handlers_in_order;
+}
+
+struct Latencies {
+  Clock::duration median;
+  Clock::duration p99;
+  Clock::duration max;
+  std::uint32_t rejected_tasks;
+};
+
+// Timers fire on the I/O threads every millisecond while a task is started
+// every few milliseconds, and the time between each timer's expiry and its
+// handler being run is measured
+Latencies MeasureLatency(CpuPool* pool) {
+  auto io_context = boost::asio::io_context(io_threads_count);
+  auto strand = boost::asio::make_strand(io_context);
+  auto tick_timer = boost::asio::steady_timer(io_context);
+  auto task_timer = boost::asio::steady_timer(io_context);
+  auto latencies = std::vector<Clock::duration>();
+  auto rejected_tasks = 0u;
+  auto results = 0u;
+  const auto end = Clock::now() + run_time;
+
+  auto tick = std::function<void()>();
+  tick = [&] {
+    tick_timer.expires_after(tick_interval);
+    tick_timer.async_wait(boost::asio::bind_executor(strand, [&](auto) {
+      latencies.push_back(Clock::now() - tick_timer.expiry());
+      if (Clock::now() < end) {
+        tick();
+      }
+    }));
+  };
+  auto start_task = std::function<void()>();
+  start_task = [&] {
+    task_timer.expires_after(task_interval);
+    task_timer.async_wait([&](auto) {
+      if (Clock::now() >= end) {
+        return;
+      }
+      if (!pool) {
+        BusyWait(task_time);
+        boost::asio::post(strand, [&] { results++; });
+      } else if (!pool->TryPost(CpuPool::Priority::Background,
+                                [] { BusyWait(task_time); },
+                                boost::asio::bind_executor(strand, [&] {
+                                  results++;
+                                }))) {
+        boost::asio::post(strand, [&] { rejected_tasks++; });
+      }
+      start_task();
+    });
+  };
+  tick();
+  start_task();
+
+  auto threads = std::vector<std::thread>();
+  for (auto i = 0u; i < io_threads_count; i++) {
+    threads.emplace_back([&] { io_context.run(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::sort(latencies.begin(), latencies.end());
+  return {latencies[latencies.size() / 2],
+          latencies[latencies.size() * 99 / 100],
+          latencies.back(),
+          rejected_tasks};
+}
+
+int main() {
+  if (!CheckPriorities()) {
+    std::cout << "Background tasks ran before interactive tasks" << std::endl;
+    return 1;
+  }
+  if (!CheckBackpressure()) {
+    std::cout << "The queue wasn't bounded" << std::endl;
+    return 1;
+  }
+  if (!CheckWorkStealing()) {
+    std::cout << "Tasks weren't stolen from a busy worker" << std::endl;
+    return 1;
+  }
+  if (!CheckResultStrand()) {
+    std::cout << "A result wasn't handled on its strand" << std::endl;
+    return 1;
+  }
+
+  const auto inline_latencies = MeasureLatency(nullptr);
+  auto pool = CpuPool((std::max)(std::thread::hardware_concurrency() / 2, 1u), 64);
+  const auto pool_latencies = MeasureLatency(&pool);
+  const auto print_latencies = [](auto name, const Latencies& latencies) {
+    const auto to_us = [](auto duration) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    };
+    std::cout << "  " << name << ": median " << to_us(latencies.median)
+              << " us, p99 " << to_us(latencies.p99)
+              << " us, max " << to_us(latencies.max) << " us";
+    if (latencies.rejected_tasks) {
+      std::cout << ", " << latencies.rejected_tasks << " tasks rejected";
+    }
+    std::cout << std::endl;
+  };
+  std::cout << "Timer latency on " << io_threads_count
+            << " I/O threads with CPU-heavy tasks run:" << std::endl;
+  print_latencies("On the I/O threads", inline_latencies);
+  print_latencies("On the CPU pool", pool_latencies);
+  return 0;
+}
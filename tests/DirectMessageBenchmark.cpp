@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "DirectMessageRegistry.hpp"
+
+// Creates 10,000 direct message channels between pairs of users and
+// measures how long it takes to find the recipients of messages sent
+// concurrently from several threads.
+
+struct User {
+  std::uint32_t id;
+};
+
+constexpr auto pairs_count = 10'000u;
+constexpr auto messages_per_thread = 1'000'000u;
+
+int main() {
+  auto registry = CollabVm::Server::DirectMessageRegistry<User>(10);
+  auto users = std::vector<std::shared_ptr<User>>();
+  for (auto i = 0u; i < pairs_count * 2; i++) {
+    users.push_back(std::make_shared<User>(User{i}));
+  }
+
+  auto channel_ids = std::vector<std::uint32_t>();
+  auto start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < pairs_count; i++) {
+    const auto [result, id] =
+      registry.GetOrCreateChannel(users[i * 2], users[i * 2 + 1]);
+    if (result != decltype(registry)::Result::Created) {
+      std::cout << "Failed to create channel " << i << std::endl;
+      return 1;
+    }
+    channel_ids.push_back(id);
+  }
+  const auto create_duration = std::chrono::steady_clock::now() - start;
+
+  // The channel is found regardless of which user opens it
+  for (auto i = 0u; i < pairs_count; i++) {
+    const auto [result, id] =
+      registry.GetOrCreateChannel(users[i * 2 + 1], users[i * 2]);
+    if (result != decltype(registry)::Result::Existing || id != channel_ids[i]) {
+      std::cout << "Channel " << i << " was not found" << std::endl;
+      return 1;
+    }
+  }
+  for (auto i = 1u; i <= 10; i++) {
+    const auto [result, id] = registry.GetOrCreateChannel(users[0], users[i * 2]);
+    const auto expected_result = i < 10
+      ? decltype(registry)::Result::Created
+      : decltype(registry)::Result::SenderLimitReached;
+    if (result != expected_result) {
+      std::cout << "Channel limit was not enforced" << std::endl;
+      return 1;
+    }
+  }
+
+  const auto threads_count = std::max(std::thread::hardware_concurrency(), 2u);
+  auto threads = std::vector<std::thread>();
+  auto errors = std::atomic<std::uint32_t>(0);
+  start = std::chrono::steady_clock::now();
+  for (auto thread = 0u; thread < threads_count; thread++) {
+    threads.emplace_back([&, thread] {
+      for (auto i = 0u; i < messages_per_thread; i++) {
+        const auto pair = (i * 7'919 + thread) % pairs_count;
+        const auto sender = pair * 2 + i % 2;
+        const auto recipient =
+          registry.GetRecipient(channel_ids[pair], *users[sender]);
+        if (!recipient || recipient->id != (sender ^ 1)) {
+          errors++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto send_duration = std::chrono::steady_clock::now() - start;
+  if (errors) {
+    std::cout << errors << " messages were sent to the wrong recipient" << std::endl;
+    return 1;
+  }
+
+  for (auto i = 0u; i < pairs_count * 2; i += 2) {
+    registry.RemoveUser(users[i]);
+  }
+  if (registry.GetChannelCount() != 0) {
+    std::cout << registry.GetChannelCount()
+              << " channels remain after removing users" << std::endl;
+    return 1;
+  }
+  // A user that was found before it was removed can't be sent a new message
+  if (registry.GetOrCreateChannel(users[1], users[0]).first
+        != decltype(registry)::Result::UserRemoved
+      || registry.GetOrCreateChannel(users[1], users[3]).first
+        != decltype(registry)::Result::Created) {
+    std::cout << "A channel was created with a removed user" << std::endl;
+    return 1;
+  }
+
+  const auto to_ns = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  };
+  std::cout << "Created " << pairs_count << " channels in "
+            << to_ns(create_duration) / 1'000'000.0 << " ms\n"
+            << "Sent " << threads_count * messages_per_thread << " messages from "
+            << threads_count << " threads in "
+            << to_ns(send_duration) / 1'000'000.0 << " ms ("
+            << to_ns(send_duration) * threads_count
+               / double(threads_count * messages_per_thread)
+            << " ns per message per thread)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <boost/asio.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "IPData.hpp"
+#include "IPDataTable.hpp"
+
+// Measures the rate that connections can be admitted from several threads
+// when each one checks the connection limit of its IP with atomics, compared
+// with dispatching to the strands that used to guard the IP data, and checks
+// that the limit holds when many connections from one IP arrive at once.
+
+using CollabVm::Server::IPData;
+using IpBytes = std::array<std::byte, 16>;
+using Table = CollabVm::Server::IPDataTable<IpBytes,
+                                            std::shared_ptr<IPData>,
+                                            boost::hash<IpBytes>>;
+using Strand = boost::asio::io_context::strand;
+
+constexpr auto addresses_count = 64u;
+constexpr auto connections_per_thread = 100'000u;
+constexpr auto max_connections = 300u;
+
+IpBytes GetIpAddress(std::uint32_t i) {
+  auto ip_address = IpBytes();
+  ip_address[10] = ip_address[11] = std::byte(0xFF);
+  for (auto j = 0; j < 4; j++) {
+    ip_address[15 - j] = std::byte(i >> (8 * j));
+  }
+  return ip_address;
+}
+
+std::shared_ptr<IPData> CreateIPData() {
+  return std::make_shared<IPData>();
+}
+
+template<typename TCallback>
+auto Time(TCallback&& callback) {
+  const auto start = std::chrono::steady_clock::now();
+  callback();
+  return std::chrono::steady_clock::now() - start;
+}
+
+template<typename TCallback>
+void RunThreads(std::uint32_t threads_count, TCallback&& callback) {
+  auto threads = std::vector<std::thread>();
+  for (auto i = 0u; i < threads_count; i++) {
+    threads.emplace_back([&callback, i] { callback(i); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Each connection acquires the data for its IP, is admitted and disconnects
+auto AdmitWithAtomics(std::uint32_t threads_count) {
+  auto table = Table(std::chrono::minutes(1), addresses_count);
+  return Time([&] {
+    RunThreads(threads_count, [&](auto thread) {
+      for (auto i = 0u; i < connections_per_thread; i++) {
+        const auto ip_address = GetIpAddress((i + thread) % addresses_count);
+        const auto ip_data = table.Acquire(ip_address, CreateIPData);
+        if (ip_data->TryAddConnection(max_connections)) {
+          ip_data->RemoveConnection();
+        }
+        table.Release(ip_address);
+      }
+    });
+  });
+}
+
+// The table and each IP's data are guarded by strands, so every connection
+// waits for two strands before it's admitted and a third to release the data
+auto AdmitWithStrands(std::uint32_t threads_count) {
+  struct StrandIPData {
+    explicit StrandIPData(boost::asio::io_context& io_context)
+      : strand(io_context) {
+    }
+    Strand strand;
+    std::uint32_t connections = 0;
+  };
+  auto io_context = boost::asio::io_context(threads_count);
+  auto table_strand = Strand(io_context);
+  auto table = CollabVm::Server::IPDataTable<IpBytes,
+                                             std::shared_ptr<StrandIPData>,
+                                             boost::hash<IpBytes>>(
+    std::chrono::minutes(1), addresses_count);
+  const auto connections_count = threads_count * connections_per_thread;
+  for (auto i = 0u; i < connections_count; i++) {
+    boost::asio::post(table_strand, [&, i] {
+      const auto ip_address = GetIpAddress(i % addresses_count);
+      const auto ip_data = table.Acquire(ip_address, [&] {
+        return std::make_shared<StrandIPData>(io_context);
+      });
+      boost::asio::dispatch(ip_data->strand, [&, ip_data, ip_address] {
+        if (ip_data->connections < max_connections) {
+          ip_data->connections++;
+          ip_data->connections--;
+        }
+        boost::asio::post(table_strand, [&table, ip_address] {
+          table.Release(ip_address);
+        });
+      });
+    });
+  }
+  return Time([&] {
+    RunThreads(threads_count, [&](auto) { io_context.run(); });
+  });
+}
+
+int main() {
+  const auto threads_count =
+    (std::max)(std::thread::hardware_concurrency(), 4u);
+
+  // Connections from one IP arrive on every thread at once and stay open
+  auto table = Table(std::chrono::minutes(1), addresses_count);
+  auto admitted = std::atomic<std::uint32_t>(0);
+  RunThreads(threads_count, [&](auto) {
+    for (auto i = 0u; i < 2 * max_connections; i++) {
+      if (table.Acquire(GetIpAddress(0), CreateIPData)
+            ->TryAddConnection(max_connections)) {
+        admitted++;
+      } else {
+        table.Release(GetIpAddress(0));
+      }
+    }
+  });
+  const auto connections =
+    table.Acquire(GetIpAddress(0), CreateIPData)->connections.load();
+  if (admitted != max_connections || connections != max_connections) {
+    std::cout << admitted << " connections were admitted and " << connections
+              << " were counted with a limit of " << max_connections << std::endl;
+    return 1;
+  }
+
+  const auto atomics_duration = AdmitWithAtomics(threads_count);
+  const auto strands_duration = AdmitWithStrands(threads_count);
+  const auto connections_count = threads_count * connections_per_thread;
+  const auto print_rate = [connections_count](auto name, auto duration) {
+    std::cout << "  " << name << ": "
+              << connections_count * 1'000
+                   / (std::max)(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        duration).count(), std::int64_t(1))
+              << " connections per second" << std::endl;
+  };
+  std::cout << connections_count << " connections admitted by "
+            << threads_count << " threads:" << std::endl;
+  print_rate("Atomics", atomics_duration);
+  print_rate("Strands", strands_duration);
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <boost/functional/hash.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include "IPDataTable.hpp"
+
+// Simulates a million distinct IP addresses connecting once each, like a
+// scanner would, with a connection every 100 microseconds, and checks that
+// the table only keeps the addresses that connected within the idle time.
+
+using IpBytes = std::array<std::byte, 16>;
+using Table = CollabVm::Server::IPDataTable<IpBytes,
+                                            std::shared_ptr<std::uint64_t>,
+                                            boost::hash<IpBytes>>;
+
+constexpr auto addresses_count = 1'000'000u;
+constexpr auto connection_interval = std::chrono::microseconds(100);
+constexpr auto idle_time = std::chrono::seconds(10);
+constexpr auto eviction_interval = std::chrono::seconds(1);
+
+IpBytes GetIpAddress(std::uint32_t i) {
+  auto ip_address = IpBytes();
+  ip_address[10] = ip_address[11] = std::byte(0xFF);
+  for (auto j = 0; j < 4; j++) {
+    ip_address[15 - j] = std::byte(i >> (8 * j));
+  }
+  return ip_address;
+}
+
+int main() {
+  auto table = Table(idle_time, addresses_count);
+  auto now = Table::Clock::time_point();
+  const auto create = [] { return std::make_shared<std::uint64_t>(0); };
+
+  // An address that stays connected is never evicted
+  const auto connected = table.Acquire(GetIpAddress(0), create);
+  *connected = 1;
+
+  auto next_eviction = now + eviction_interval;
+  auto max_size = std::size_t(0);
+  const auto start = std::chrono::steady_clock::now();
+  for (auto i = 1u; i <= addresses_count; i++) {
+    now += connection_interval;
+    const auto ip_address = GetIpAddress(i);
+    table.Acquire(ip_address, create);
+    table.Release(ip_address, now);
+    if (now >= next_eviction) {
+      // The table is largest right before an eviction
+      max_size = std::max(max_size, table.GetSize());
+      table.EvictIdle(now);
+      next_eviction += eviction_interval;
+    }
+  }
+  const auto duration = std::chrono::steady_clock::now() - start;
+
+  // The addresses from the last idle time and the last eviction interval
+  const auto expected_max_size = 2 + (idle_time + eviction_interval) / connection_interval;
+  if (max_size > expected_max_size) {
+    std::cout << "The table grew to " << max_size << " entries" << std::endl;
+    return 1;
+  }
+  if (*table.Acquire(GetIpAddress(0), create) != 1) {
+    std::cout << "A connected address was evicted" << std::endl;
+    return 1;
+  }
+  table.Release(GetIpAddress(0), now);
+  table.Release(GetIpAddress(0), now);
+  table.EvictIdle(now + idle_time);
+  if (table.GetSize() || table.GetIdleCount()) {
+    std::cout << table.GetSize() << " entries remain" << std::endl;
+    return 1;
+  }
+
+  // A full table makes room by evicting the least recently used address
+  auto bounded_table = CollabVm::Server::IPDataTable<
+    IpBytes, std::shared_ptr<std::uint64_t>, boost::hash<IpBytes>, 1>(idle_time, 2);
+  bounded_table.Acquire(GetIpAddress(1), create);
+  bounded_table.Acquire(GetIpAddress(2), create);
+  bounded_table.Release(GetIpAddress(2), now);
+  bounded_table.Release(GetIpAddress(1), now);
+  *bounded_table.Acquire(GetIpAddress(3), create) = 3;
+  if (bounded_table.GetSize() != 2
+      || *bounded_table.Acquire(GetIpAddress(1), create) != 0
+      || *bounded_table.Acquire(GetIpAddress(3), create) != 3) {
+    std::cout << "The wrong address was evicted from a full table" << std::endl;
+    return 1;
+  }
+
+  std::cout << addresses_count << " addresses connected in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()
+            << " ms ("
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()
+                 / addresses_count
+            << " ns per address), at most " << max_size << " were kept" << std::endl;
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "InputEventBatch.hpp"
+
+using CollabVm::Server::InputEvent;
+
+int main() {
+  auto rng = std::default_random_engine(1);
+  auto events = std::vector<InputEvent>();
+  auto timestamp = std::uint64_t(1'600'000'000'000);
+  auto x = 512;
+  auto y = 384;
+  for (auto i = 0; i < 10'000; i++) {
+    timestamp += std::uniform_int_distribution(0, 2'000)(rng);
+    if (i % 10 == 0) {
+      events.push_back({InputEvent::Type::Key, timestamp, 0, 0, 0,
+                        std::uniform_int_distribution(0u, 0xFFFFu)(rng),
+                        i % 20 == 0});
+      continue;
+    }
+    x += std::uniform_int_distribution(-50, 50)(rng);
+    y += std::uniform_int_distribution(-50, 50)(rng);
+    events.push_back({InputEvent::Type::Mouse, timestamp, x, y,
+                      i % 7 == 0 ? 1 : 0, 0, false});
+  }
+  events.push_back({InputEvent::Type::Mouse, timestamp, INT32_MIN, INT32_MAX,
+                    -1, 0, false});
+
+  auto writer = CollabVm::Server::InputEventBatchWriter();
+  for (const auto& event : events) {
+    writer.Add(event);
+  }
+  auto reader = CollabVm::Server::InputEventBatchReader(writer.GetData());
+  for (const auto& event : events) {
+    const auto decoded_event = reader.Next();
+    if (!decoded_event || !(*decoded_event == event)) {
+      std::cout << "Decoded event does not match" << std::endl;
+      return 1;
+    }
+  }
+  if (reader.Next()) {
+    std::cout << "Unexpected event at the end of the batch" << std::endl;
+    return 1;
+  }
+  std::cout << events.size() << " events in " << writer.GetData().size()
+            << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <initializer_list>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "PlaybackPosition.hpp"
+
+// Checks that frames are scheduled relative to when playback started at
+// each speed, and that seeking only clears the display when the recording
+// moves to a keyframe.
+
+using namespace std::chrono_literals;
+using CollabVm::Server::PlaybackClock;
+
+// A recording with a sync instruction every 10 ms and a keyframe every 100 ms
+struct Reader {
+  constexpr static auto frame_interval = std::uint64_t(10);
+  constexpr static auto keyframe_interval = std::uint64_t(100);
+
+  std::uint64_t GetFileOffset() const {
+    return offset;
+  }
+
+  void SeekToTimestamp(std::uint64_t timestamp) {
+    const auto keyframe = timestamp / keyframe_interval * keyframe_interval;
+    // Like RecordingFileReader, keep reading if it's faster than seeking
+    if (current_timestamp < keyframe || timestamp < current_timestamp) {
+      offset = keyframe;
+      current_timestamp = keyframe;
+    }
+  }
+
+  std::optional<std::uint64_t> ReadGuacamoleInstruction() {
+    offset += frame_interval;
+    current_timestamp = offset;
+    return current_timestamp;
+  }
+
+  std::uint64_t offset = 0;
+  std::uint64_t current_timestamp = 0;
+};
+
+struct Display {
+  void WriteInstruction(std::uint64_t timestamp) {
+    frames.push_back(timestamp);
+  }
+
+  std::vector<std::uint64_t> frames;
+};
+
+bool CheckPacing() {
+  const auto start = std::chrono::steady_clock::time_point(1h);
+  auto clock = PlaybackClock();
+  if (clock.GetFrameTime(1'000, start) != start
+      || clock.GetFrameTime(1'500, start + 100ms) != start + 500ms) {
+    std::cout << "Frames weren't scheduled from the first frame" << std::endl;
+    return false;
+  }
+  // A late frame doesn't delay the ones after it
+  if (clock.GetFrameTime(2'000, start + 1'200ms) != start + 1'000ms) {
+    std::cout << "A late frame delayed the next one" << std::endl;
+    return false;
+  }
+  // Moving backward, like into the next recording, restarts the clock
+  if (clock.GetFrameTime(500, start + 2s) != start + 2s) {
+    std::cout << "An earlier frame wasn't sent immediately" << std::endl;
+    return false;
+  }
+  for (const auto& [speed, expected_time] : { std::pair(2u, 500ms),
+                                             std::pair(8u, 125ms),
+                                             std::pair(3u, 1'000ms) }) {
+    clock.SetSpeed(speed);
+    clock.Reset();
+    clock.GetFrameTime(1'000, start);
+    if (clock.GetFrameTime(2'000, start) != start + expected_time) {
+      std::cout << "Incorrect frame time at speed " << speed << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CheckSeeking() {
+  auto reader = Reader();
+  auto display = Display();
+  CollabVm::Server::SeekRecording(reader, display, 50);
+  if (display.frames != std::vector<std::uint64_t>{10, 20, 30, 40, 50}) {
+    std::cout << "Seeking from the start didn't decode every frame" << std::endl;
+    return false;
+  }
+  // Only the skipped frames are decoded when seeking within a keyframe
+  CollabVm::Server::SeekRecording(reader, display, 70);
+  if (display.frames != std::vector<std::uint64_t>{10, 20, 30, 40, 50, 60, 70}) {
+    std::cout << "Seeking forward didn't continue from the display" << std::endl;
+    return false;
+  }
+  CollabVm::Server::SeekRecording(reader, display, 230);
+  if (display.frames != std::vector<std::uint64_t>{210, 220, 230}) {
+    std::cout << "Seeking to a later keyframe didn't clear the display" << std::endl;
+    return false;
+  }
+  CollabVm::Server::SeekRecording(reader, display, 210);
+  if (display.frames != std::vector<std::uint64_t>{210}) {
+    std::cout << "Seeking backward didn't clear the display" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  return CheckPacing() && CheckSeeking() ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <iostream>
+#include "RateLimiter.hpp"
+
+using namespace std::chrono_literals;
+using CollabVm::Server::RateLimitedMessage;
+
+int main() {
+  auto limits = CollabVm::Server::RateLimits();
+  if (!CollabVm::Server::ParseRateLimit("chat=2/3,10/20", limits)
+      || limits.GetConnectionLimit(RateLimitedMessage::Chat).interval != 500ms
+      || limits.GetConnectionLimit(RateLimitedMessage::Chat).burst != 3
+      || limits.GetIpLimit(RateLimitedMessage::Chat).interval != 100ms
+      || limits.GetIpLimit(RateLimitedMessage::Chat).burst != 20) {
+    std::cout << "Failed to parse chat limit" << std::endl;
+    return 1;
+  }
+  if (!CollabVm::Server::ParseRateLimit("input=0", limits)
+      || limits.GetConnectionLimit(RateLimitedMessage::GuacamoleInstruction)
+                                  .IsEnabled()) {
+    std::cout << "Failed to parse disabled limit" << std::endl;
+    return 1;
+  }
+  for (const auto invalid_argument : { "chat", "chats=1", "vote=", "vote=1/0",
+                                       "turn=-1", "turn=1,", "turn=1x" }) {
+    if (CollabVm::Server::ParseRateLimit(invalid_argument, limits)) {
+      std::cout << "Parsed invalid limit '" << invalid_argument << '\'' << std::endl;
+      return 1;
+    }
+  }
+
+  // A burst of 3 followed by one message every 500 ms
+  auto rate_limiter = CollabVm::Server::RateLimiter();
+  const auto& limit = limits.GetConnectionLimit(RateLimitedMessage::Chat);
+  auto now = std::chrono::steady_clock::now();
+  auto allowed = 0;
+  for (auto i = 0; i < 10; i++) {
+    allowed += rate_limiter.TryConsume(RateLimitedMessage::Chat, limit, now);
+  }
+  if (allowed != 3) {
+    std::cout << allowed << " messages were allowed in a burst of 3" << std::endl;
+    return 1;
+  }
+  allowed = 0;
+  for (auto i = 0; i < 100; i++) {
+    now += 100ms;
+    allowed += rate_limiter.TryConsume(RateLimitedMessage::Chat, limit, now);
+  }
+  if (allowed != 20) {
+    std::cout << allowed << " messages were allowed in 10 seconds instead of 20"
+              << std::endl;
+    return 1;
+  }
+  if (rate_limiter.GetDroppedCount(RateLimitedMessage::Chat) != 87
+      || rate_limiter.GetDroppedCount(RateLimitedMessage::Vote) != 0) {
+    std::cout << "Incorrect dropped count" << std::endl;
+    return 1;
+  }
+  // Checking a limit doesn't use it up, so a message dropped by a second
+  // limit doesn't count against the first
+  auto connection_limiter = CollabVm::Server::RateLimiter();
+  auto ip_limiter = CollabVm::Server::RateLimiter();
+  const auto& connection_limit = limits.GetConnectionLimit(RateLimitedMessage::Chat);
+  const auto& ip_limit = limits.GetIpLimit(RateLimitedMessage::Chat);
+  for (auto i = 0; i < 20; i++) {
+    ip_limiter.TryConsume(RateLimitedMessage::Chat, ip_limit, now);
+  }
+  for (auto i = 0; i < 10; i++) {
+    if (connection_limiter.CanConsume(RateLimitedMessage::Chat, connection_limit, now)
+        && ip_limiter.TryConsume(RateLimitedMessage::Chat, ip_limit, now)) {
+      connection_limiter.TryConsume(RateLimitedMessage::Chat, connection_limit, now);
+    }
+  }
+  allowed = 0;
+  for (auto i = 0; i < 10; i++) {
+    allowed += connection_limiter.TryConsume(RateLimitedMessage::Chat,
+                                             connection_limit, now);
+  }
+  if (allowed != 3) {
+    std::cout << "Messages dropped by the IP limit used up the connection limit"
+              << std::endl;
+    return 1;
+  }
+  // Disabled limits never drop messages
+  for (auto i = 0; i < 100; i++) {
+    if (!rate_limiter.TryConsume(RateLimitedMessage::Vote,
+                                 limits.GetConnectionLimit(RateLimitedMessage::Vote),
+                                 now)) {
+      std::cout << "Message was dropped without a limit" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
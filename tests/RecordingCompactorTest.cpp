@@ -0,0 +1,166 @@
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <kj/std/iostream.h>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include "CollabVm.capnp.h"
+#include "Guacamole.capnp.h"
+#include "RecordingCompactor.hpp"
+#include "RecordingFileReader.hpp"
+
+// Compacts a recording with audio and display streams and checks that only
+// the audio was removed and that every keyframe can still be seeked to.
+
+constexpr auto frames_count = 100u;
+constexpr auto keyframe_interval = 10u;
+constexpr auto audio_stream = 1;
+constexpr auto display_stream = 2;
+
+void WriteInstruction(kj::OutputStream& output_stream,
+    const std::function<void(Guacamole::GuacServerInstruction::Builder)>& init)
+{
+  auto message_builder = capnp::MallocMessageBuilder();
+  init(message_builder.initRoot<CollabVmServerMessage>()
+                      .initMessage()
+                      .initGuacInstr());
+  capnp::writeMessage(output_stream, message_builder);
+}
+
+// Each frame has an audio blob, a display blob and a sync instruction,
+// and the timestamp of frame i is i + 1
+void WriteRecording(const std::string& file_path)
+{
+  auto file_stream =
+    std::ofstream(file_path, std::ofstream::binary | std::ofstream::out);
+  auto output_stream = kj::std::StdOutputStream(file_stream);
+
+  auto header_message_builder = capnp::MallocMessageBuilder();
+  auto header = header_message_builder.initRoot<RecordingFileHeader>();
+  header.setVmId(1);
+  header.setStartTime(1);
+  header.setStopTime(frames_count);
+  const auto keyframes_count = frames_count / keyframe_interval;
+  header.setKeyframesCount(keyframes_count);
+  auto keyframes = header.initKeyframes(keyframes_count);
+  capnp::writeMessage(output_stream, header_message_builder);
+
+  WriteInstruction(output_stream, [](auto instruction) {
+    instruction.initAudio().setStream(audio_stream);
+  });
+  for (auto i = 0u; i < frames_count; i++) {
+    if (i % keyframe_interval == 0) {
+      auto keyframe = keyframes[i / keyframe_interval];
+      keyframe.setFileOffset(file_stream.tellp());
+      keyframe.setTimestamp(i + 1);
+    }
+    WriteInstruction(output_stream, [](auto instruction) {
+      instruction.initBlob().setStream(audio_stream);
+    });
+    WriteInstruction(output_stream, [i](auto instruction) {
+      auto blob = instruction.initBlob();
+      blob.setStream(display_stream);
+      const auto data = static_cast<kj::byte>(i);
+      blob.setData(kj::arrayPtr(&data, 1));
+    });
+    WriteInstruction(output_stream, [i](auto instruction) {
+      instruction.setSync(i + 1);
+    });
+  }
+  WriteInstruction(output_stream, [](auto instruction) {
+    instruction.setEnd(audio_stream);
+  });
+  file_stream.seekp(0);
+  capnp::writeMessage(output_stream, header_message_builder);
+}
+
+bool CheckInstructions(const std::string& file_path)
+{
+  auto reader = CollabVm::Server::RecordingFileReader(file_path);
+  auto display_blobs = 0u;
+  auto syncs = 0u;
+  while (const auto instruction = reader.ReadGuacamoleInstruction()) {
+    switch (instruction->which()) {
+    case Guacamole::GuacServerInstruction::AUDIO:
+    case Guacamole::GuacServerInstruction::END:
+      std::cout << "An audio instruction wasn't removed" << std::endl;
+      return false;
+    case Guacamole::GuacServerInstruction::BLOB:
+      if (instruction->getBlob().getStream() != display_stream
+          || instruction->getBlob().getData()[0] != display_blobs++) {
+        std::cout << "The blobs weren't kept in order" << std::endl;
+        return false;
+      }
+      break;
+    case Guacamole::GuacServerInstruction::SYNC:
+      syncs++;
+      break;
+    default:
+      break;
+    }
+  }
+  if (display_blobs != frames_count || syncs != frames_count) {
+    std::cout << "Display instructions were removed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool CheckSeeking(const std::string& file_path)
+{
+  auto reader = CollabVm::Server::RecordingFileReader(file_path);
+  // Seek backward so the reader moves to each keyframe
+  for (auto i = reader.GetKeyframes().size(); i-- > 0;) {
+    const auto timestamp = reader.GetKeyframes()[i].getTimestamp();
+    reader.SeekToTimestamp(timestamp);
+    const auto instruction = reader.ReadGuacamoleInstruction();
+    if (!instruction
+        || instruction->which() != Guacamole::GuacServerInstruction::BLOB
+        || instruction->getBlob().getData()[0] != timestamp - 1) {
+      std::cout << "The keyframe at " << timestamp
+                << " doesn't point to its frame" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  const auto file_path = std::string("recording-compactor-test.bin");
+  const auto compacted_file_path = file_path + ".compacted";
+  WriteRecording(file_path);
+  // Append a truncated message, like in a recording that was interrupted
+  {
+    auto file_stream = std::ofstream(
+      file_path, std::ofstream::binary | std::ofstream::app);
+    file_stream.write("\0\0\0\0\xff\0\0\0", 8);
+  }
+
+  auto success = true;
+  if (!CollabVm::Server::CompactRecording(file_path, compacted_file_path)) {
+    std::cout << "The recording wasn't compacted" << std::endl;
+    success = false;
+  } else if (std::ifstream(file_path, std::ifstream::ate).tellg()
+             <= std::ifstream(compacted_file_path, std::ifstream::ate).tellg()) {
+    std::cout << "The compacted recording wasn't smaller" << std::endl;
+    success = false;
+  } else {
+    success = CheckInstructions(compacted_file_path)
+           && CheckSeeking(compacted_file_path);
+  }
+  // A recording without audio doesn't need to be rewritten
+  if (success && CollabVm::Server::CompactRecording(compacted_file_path,
+                                                    file_path + ".tmp")) {
+    std::cout << "A recording without audio was compacted" << std::endl;
+    success = false;
+  }
+
+  std::remove(file_path.c_str());
+  std::remove(compacted_file_path.c_str());
+  std::remove((file_path + ".tmp").c_str());
+  return success ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "RecordingPreviewCache.hpp"
+
+// Checks the memory and disk tiers of the preview cache: hits, LRU eviction
+// within each tier's budget, previews surviving a restart, and removing the
+// previews of a recording.
+
+using CollabVm::Server::RecordingPreviewCache;
+
+constexpr auto png_size = std::size_t(1'000);
+// The timestamp is stored before the PNG in each file
+constexpr auto file_size = png_size + sizeof(std::uint64_t);
+
+RecordingPreviewCache::Key GetKey(const std::string& file_path,
+                                  std::uint64_t timestamp) {
+  return {file_path, 0, timestamp, 320, 240};
+}
+
+std::vector<std::byte> GetPng(std::uint64_t timestamp) {
+  return std::vector<std::byte>(png_size, std::byte(timestamp));
+}
+
+bool IsPreview(const std::shared_ptr<const RecordingPreviewCache::Preview>& preview,
+               std::uint64_t timestamp) {
+  return preview && preview->timestamp == timestamp
+      && preview->png == GetPng(timestamp);
+}
+
+std::size_t CountFiles(const std::filesystem::path& directory) {
+  auto count = std::size_t(0);
+  for (const auto& entry :
+         std::filesystem::recursive_directory_iterator(directory)) {
+    count += entry.is_regular_file();
+  }
+  return count;
+}
+
+bool CheckMemoryTier() {
+  auto cache = RecordingPreviewCache(3 * png_size);
+  for (auto i = 1u; i <= 3; i++) {
+    cache.Put(GetKey("1.bin", i), i, GetPng(i));
+  }
+  // The first preview becomes the most recently used
+  if (!IsPreview(cache.Get(GetKey("1.bin", 1)), 1)) {
+    std::cout << "A preview wasn't found in memory" << std::endl;
+    return false;
+  }
+  cache.Put(GetKey("1.bin", 4), 4, GetPng(4));
+  if (cache.Get(GetKey("1.bin", 2))
+      || !IsPreview(cache.Get(GetKey("1.bin", 1)), 1)
+      || !IsPreview(cache.Get(GetKey("1.bin", 4)), 4)) {
+    std::cout << "The least recently used preview wasn't evicted" << std::endl;
+    return false;
+  }
+  const auto statistics = cache.GetStatistics();
+  if (statistics.memory_hits != 3 || statistics.disk_hits != 0
+      || statistics.misses != 1 || statistics.memory_bytes != 3 * png_size
+      || statistics.GetHitRate() != 0.75) {
+    std::cout << "The statistics were incorrect" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool CheckDiskTier(const std::filesystem::path& directory) {
+  {
+    auto cache = RecordingPreviewCache(png_size, directory, 3 * file_size);
+    for (auto i = 1u; i <= 3; i++) {
+      cache.Put(GetKey("1.bin", i), i, GetPng(i));
+    }
+    // Only the last preview remains in memory
+    if (!IsPreview(cache.Get(GetKey("1.bin", 1)), 1)
+        || cache.GetStatistics().disk_hits != 1) {
+      std::cout << "A preview wasn't read from disk" << std::endl;
+      return false;
+    }
+    cache.Put(GetKey("2.bin", 1), 1, GetPng(1));
+    if (CountFiles(directory) != 3 || cache.GetStatistics().disk_bytes != 3 * file_size) {
+      std::cout << "The disk tier wasn't bounded" << std::endl;
+      return false;
+    }
+  }
+  // The previews written before a restart are used
+  auto cache = RecordingPreviewCache(png_size, directory, 3 * file_size);
+  if (cache.GetStatistics().disk_bytes != 3 * file_size
+      || !IsPreview(cache.Get(GetKey("1.bin", 1)), 1)
+      || !IsPreview(cache.Get(GetKey("1.bin", 3)), 3)
+      || cache.Get(GetKey("1.bin", 2))) {
+    std::cout << "The disk tier wasn't loaded after a restart" << std::endl;
+    return false;
+  }
+  cache.RemoveRecording("1.bin");
+  if (cache.Get(GetKey("1.bin", 1)) || CountFiles(directory) != 1
+      || cache.GetStatistics().disk_bytes != file_size
+      || !IsPreview(cache.Get(GetKey("2.bin", 1)), 1)) {
+    std::cout << "The previews of a recording weren't removed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  const auto directory = std::filesystem::temp_directory_path()
+                         / "recording-preview-cache-test";
+  std::filesystem::remove_all(directory);
+  const auto success = CheckMemoryTier() && CheckDiskTier(directory);
+  std::filesystem::remove_all(directory);
+  return success ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <kj/std/iostream.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "CollabVm.capnp.h"
+#include "RecordingFileReader.hpp"
+
+// Compares reading every Guacamole instruction from a recording using
+// std::ifstream and capnp::readMessageCopy() with RecordingFileReader.
+// Usage: recording-reader-benchmark [size in MiB (default: 1024)]
+
+constexpr auto keyframes_count = 64u;
+
+void WriteRecording(const std::string& file_path, std::uint64_t size)
+{
+  auto file_stream =
+    std::ofstream(file_path, std::ofstream::binary | std::ofstream::out);
+  auto output_stream = kj::std::StdOutputStream(file_stream);
+
+  auto header_message_builder = capnp::MallocMessageBuilder();
+  auto header = header_message_builder.initRoot<RecordingFileHeader>();
+  header.setVmId(1);
+  header.setStartTime(1);
+  auto keyframes = header.initKeyframes(keyframes_count);
+  capnp::writeMessage(output_stream, header_message_builder);
+
+  // Most messages in a real recording are large display updates,
+  // so pad the file with messages that must be skipped
+  auto padding_message_builder = capnp::MallocMessageBuilder();
+  padding_message_builder.initRoot<CollabVmServerMessage>()
+                         .initMessage()
+                         .initChatMessage()
+                         .initMessage()
+                         .setMessage(std::string(4 * 1'024, 'a'));
+  auto sync_message_builder = capnp::MallocMessageBuilder();
+  auto sync = sync_message_builder.initRoot<CollabVmServerMessage>()
+                                  .initMessage()
+                                  .initGuacInstr();
+  const auto keyframe_size = size / keyframes_count;
+  auto keyframe_index = 0u;
+  auto timestamp = std::uint64_t(1);
+  auto position = std::uint64_t(0);
+  while ((position = file_stream.tellp()) < size) {
+    if (keyframe_index < keyframes_count
+        && position >= keyframe_size * keyframe_index) {
+      keyframes[keyframe_index].setFileOffset(position);
+      keyframes[keyframe_index].setTimestamp(timestamp);
+      keyframe_index++;
+    }
+    for (auto i = 0; i < 16; i++) {
+      capnp::writeMessage(output_stream, padding_message_builder);
+    }
+    sync.setSync(++timestamp);
+    capnp::writeMessage(output_stream, sync_message_builder);
+  }
+  header.setKeyframesCount(keyframe_index);
+  header.setStopTime(timestamp);
+  file_stream.seekp(0);
+  capnp::writeMessage(output_stream, header_message_builder);
+}
+
+template<typename TFunction>
+void Benchmark(const char* name, TFunction&& function)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const auto instructions = function();
+  const auto duration = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << instructions << " instructions in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 duration).count()
+            << " ms" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  const auto size_mib = argc > 1 ? std::stoull(argv[1]) : 1'024;
+  const auto file_path = std::string("recording-reader-benchmark.bin");
+  WriteRecording(file_path, size_mib * 1'024 * 1'024);
+
+  Benchmark("readMessageCopy", [&file_path]
+  {
+    auto file_stream =
+      std::ifstream(file_path, std::ifstream::in | std::ifstream::binary);
+    auto input_stream = kj::std::StdInputStream(file_stream);
+    auto message_builder = capnp::MallocMessageBuilder();
+    capnp::readMessageCopy(input_stream, message_builder);
+    auto instructions = 0u;
+    try {
+      while (true) {
+        capnp::readMessageCopy(input_stream, message_builder);
+        instructions += message_builder.getRoot<CollabVmServerMessage>()
+                                       .getMessage().which()
+                        == CollabVmServerMessage::Message::Which::GUAC_INSTR;
+      }
+    } catch (const kj::Exception&) {
+      // End of file
+    }
+    return instructions;
+  });
+
+  Benchmark("RecordingFileReader", [&file_path]
+  {
+    auto recording = CollabVm::Server::RecordingFileReader(file_path);
+    auto instructions = 0u;
+    while (recording.ReadGuacamoleInstruction()) {
+      instructions++;
+    }
+    return instructions;
+  });
+
+  Benchmark("RecordingFileReader (seek to last keyframe)", [&file_path]
+  {
+    auto recording = CollabVm::Server::RecordingFileReader(file_path);
+    recording.SeekToTimestamp(recording.GetHeader().getStopTime());
+    auto instructions = 0u;
+    while (recording.ReadGuacamoleInstruction()) {
+      instructions++;
+    }
+    return instructions;
+  });
+
+  std::remove(file_path.c_str());
+  return 0;
+}
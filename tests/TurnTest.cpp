@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
 #include <memory>
+#include <random>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <utility>
 #include "TurnController.hpp"
@@ -17,22 +22,60 @@ public:
 class TestUserTurnController final : public UserTurnController {
   using UserTurnController::UserTurnController;
   void OnCurrentUserChanged(
-    const std::deque<TestUserPtr>& users,
     std::chrono::milliseconds time_remaining) override
   {
   }
   void OnUserAdded(
-    const std::deque<TestUserPtr>& users,
+    const TestUserPtr& user,
+    std::size_t position,
     std::chrono::milliseconds time_remaining) override
   {
   }
   void OnUserRemoved(
-    const std::deque<TestUserPtr>& users,
+    const TestUserPtr& user,
+    std::size_t position,
     std::chrono::milliseconds time_remaining) override
   {
   }
 };
 
+// Compares the positions of the users in the queue with a deque
+bool CheckPositions(const UserTurnController& turn_controller,
+                    const std::deque<TestUserPtr>& expected_queue,
+                    const std::vector<TestUserPtr>& users)
+{
+  if (turn_controller.GetTurnQueueSize() != expected_queue.size())
+  {
+    std::cout << "The queue has " << turn_controller.GetTurnQueueSize()
+              << " users instead of " << expected_queue.size() << std::endl;
+    return false;
+  }
+  auto i = 0u;
+  auto in_order = true;
+  turn_controller.ForEachUserInQueue([&](const auto& user)
+  {
+    in_order &= expected_queue[i++] == user;
+  });
+  if (!in_order)
+  {
+    std::cout << "The users in the queue are out of order" << std::endl;
+    return false;
+  }
+  for (const auto& user : users)
+  {
+    const auto it = std::find(expected_queue.begin(), expected_queue.end(), user);
+    const auto position = turn_controller.GetTurnQueuePosition(user);
+    if (it == expected_queue.end()
+          ? position.has_value()
+          : position != std::size_t(it - expected_queue.begin()))
+    {
+      std::cout << "A user has the wrong position" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 int main(int argc, char** args)
 {
   auto io_context = boost::asio::io_context();
@@ -51,6 +94,51 @@ int main(int argc, char** args)
   turn_controller.RequestTurn(user3);
 
   turn_controller.RemoveUser(user1);
+  if (turn_controller.GetCurrentUser() != user2
+      || !CheckPositions(turn_controller, {user2, user3}, {user1, user2, user3}))
+  {
+    return 1;
+  }
+  turn_controller.Clear();
+
+  // Users join and leave from random positions in the queue
+  auto rng = std::default_random_engine(0);
+  auto users = std::vector<TestUserPtr>();
+  for (auto i = 0; i < 500; i++)
+  {
+    users.push_back(std::make_shared<TestUser>("user" + std::to_string(i)));
+  }
+  auto expected_queue = std::deque<TestUserPtr>();
+  for (auto i = 0; i < 5'000; i++)
+  {
+    const auto& user = users[std::uniform_int_distribution<std::size_t>(
+      0, users.size() - 1)(rng)];
+    const auto it = std::find(expected_queue.begin(), expected_queue.end(), user);
+    if (it == expected_queue.end())
+    {
+      turn_controller.RequestTurn(user);
+      expected_queue.push_back(user);
+    }
+    else if (i % 3 == 0)
+    {
+      turn_controller.EndCurrentTurn();
+      expected_queue.pop_front();
+    }
+    else
+    {
+      turn_controller.RemoveUser(user);
+      expected_queue.erase(it);
+    }
+    if (i % 100 == 0
+        && !CheckPositions(turn_controller, expected_queue, users))
+    {
+      return 1;
+    }
+  }
+  if (!CheckPositions(turn_controller, expected_queue, users))
+  {
+    return 1;
+  }
   turn_controller.Clear();
 
   io_context.run();
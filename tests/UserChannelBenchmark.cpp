@@ -0,0 +1,149 @@
+#include <boost/asio.hpp>
+#include <boost/endian/conversion.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CollabVm.capnp.h"
+#include "CollabVmCommon.hpp"
+#include "SocketMessage.hpp"
+#include "CollabVmChatRoom.hpp"
+#include "UserChannel.hpp"
+
+// Measures how long it takes for 2000 users to join a channel and to
+// broadcast a message to all of them, compared to iterating over the hash
+// map the users were previously stored in, and checks that users are found
+// after others leave.
+
+struct Client {
+  struct IpAddress {
+    using IpBytes = std::array<std::byte, 16>;
+  };
+
+  struct UserData {
+    std::string username;
+    CollabVmServerMessage::UserType user_type;
+    IpAddress::IpBytes ip_address;
+    std::uint64_t chat_history_before_id = 0;
+
+    bool IsAdmin() const {
+      return user_type == CollabVmServerMessage::UserType::ADMIN;
+    }
+  };
+
+  template<typename TMessage>
+  void QueueMessage(TMessage&&) {
+    queued_messages++;
+  }
+
+  template<typename TCallback>
+  void QueueMessageBatch(TCallback&& callback) {
+    callback([this](auto&& message) {
+      QueueMessage(message);
+    });
+  }
+
+  std::uint32_t id;
+  std::size_t queued_messages = 0;
+};
+
+using Channel = CollabVm::Server::UserChannel<Client, Client::UserData>;
+
+constexpr auto users_count = 2'000u;
+constexpr auto broadcasts_count = 10'000u;
+
+int main() {
+  auto io_context = boost::asio::io_context();
+  auto channel = Channel(io_context, 1);
+  auto clients = std::vector<std::shared_ptr<Client>>();
+  // Separate the clients in memory like sockets with buffers would be
+  auto padding = std::vector<std::unique_ptr<std::array<char, 4'096>>>();
+  auto hash_map = std::unordered_map<std::shared_ptr<Client>, Client::UserData>();
+  auto start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < users_count; i++) {
+    auto& client = clients.emplace_back(std::make_shared<Client>());
+    client->id = i;
+    padding.push_back(std::make_unique<std::array<char, 4'096>>());
+    auto user_data = Client::UserData();
+    user_data.username = "guest" + std::to_string(i);
+    user_data.user_type = i % 100 == 0
+                            ? CollabVmServerMessage::UserType::ADMIN
+                            : CollabVmServerMessage::UserType::GUEST;
+    user_data.ip_address[15] = std::byte(i % 256);
+    hash_map.emplace(client, user_data);
+    channel.AddUser(std::move(user_data), client);
+  }
+  const auto join_duration = std::chrono::steady_clock::now() - start;
+
+  auto message = std::shared_ptr<CollabVm::Server::SocketMessage>(
+    CollabVm::Server::SocketMessage::CreateShared());
+  start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < broadcasts_count; i++) {
+    for (auto& [client, user_data] : hash_map) {
+      client->QueueMessage(message);
+    }
+  }
+  const auto hash_map_duration = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < broadcasts_count; i++) {
+    channel.BroadcastMessage(std::shared_ptr(message));
+  }
+  const auto channel_duration = std::chrono::steady_clock::now() - start;
+
+  for (const auto& client : clients) {
+    if (client->queued_messages < 2 * broadcasts_count) {
+      std::cout << "User " << client->id << " only received "
+                << client->queued_messages << " messages" << std::endl;
+      return 1;
+    }
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (auto i = 0u; i < users_count; i += 2) {
+    channel.RemoveUser(clients[i]);
+  }
+  const auto leave_duration = std::chrono::steady_clock::now() - start;
+  if (channel.GetUserCount() != users_count / 2) {
+    std::cout << channel.GetUserCount() << " users remain" << std::endl;
+    return 1;
+  }
+  for (auto i = 0u; i < users_count; i++) {
+    const auto user_data = channel.GetUserData(clients[i]);
+    if (user_data.has_value() != (i % 2 == 1)
+        || (user_data && user_data->get().username != "guest" + std::to_string(i))) {
+      std::cout << "The user data of user " << i << " is wrong" << std::endl;
+      return 1;
+    }
+  }
+
+  // The channel has no chat history, so no page is sent to a user that's
+  // in the channel or one that has left
+  const auto queued_messages = clients[1]->queued_messages;
+  channel.SendChatHistoryPage(clients[0], 10);
+  channel.SendChatHistoryPage(clients[1], 10);
+  if (clients[1]->queued_messages != queued_messages) {
+    std::cout << "An empty chat history page was sent" << std::endl;
+    return 1;
+  }
+
+  const auto to_ns = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  };
+  const auto deliveries = double(broadcasts_count) * users_count;
+  std::cout << "Joined " << users_count << " users in "
+            << to_ns(join_duration) / 1'000'000.0 << " ms\n"
+            << "Left " << users_count / 2 << " users in "
+            << to_ns(leave_duration) / 1'000'000.0 << " ms\n"
+            << "Broadcast to " << users_count << " users:\n"
+            << "  Hash map: " << to_ns(hash_map_duration) / deliveries
+            << " ns per user\n"
+            << "  Slots: " << to_ns(channel_duration) / deliveries
+            << " ns per user" << std::endl;
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include <boost/functional/hash.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+#include <locale>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "StrandGuard.hpp"
+#include "UsernameRegistry.hpp"
+
+// Simulates a storm of guests connecting and disconnecting from several
+// threads at once, checks that every guest gets a unique username, and
+// measures how long it takes compared to the strand-guarded map that the
+// registry replaced.
+
+struct User {
+};
+
+// The comparator and hasher that the previous implementation used
+struct CaseInsensitiveComparator {
+  template <typename String1, typename String2>
+  bool operator()(String1 const& x1, String2 const& x2) const {
+    return boost::algorithm::iequals(x1, x2, locale_);
+  }
+private:
+  std::locale locale_;
+};
+
+struct CaseInsensitiveHasher {
+  template <typename String>
+  std::size_t operator()(String const& x) const {
+    std::size_t seed = 0;
+    for (auto it = x.begin(); it != x.end(); ++it) {
+      boost::hash_combine(seed, std::toupper(*it, locale_));
+    }
+    return seed;
+  }
+private:
+  std::locale locale_;
+};
+
+using Registry = CollabVm::Server::UsernameRegistry<User, 20>;
+
+constexpr auto threads_count = 8u;
+constexpr auto guests_per_thread = 10'000u;
+constexpr auto storms_count = 5u;
+
+int main() {
+  auto registry = Registry(1'000, 99'999);
+
+  if (!registry.TryAdd("Guest1234", std::make_shared<User>())
+      || registry.TryAdd("gUEST1234", std::make_shared<User>())
+      || !registry.Find("GUEST1234")
+      || registry.TryAdd("a-username-that-is-too-long", std::make_shared<User>())) {
+    std::cout << "Usernames aren't compared case-insensitively" << std::endl;
+    return 1;
+  }
+  registry.Remove("guest1234");
+  if (registry.Find("Guest1234") || registry.GetCount()) {
+    std::cout << "The username wasn't removed" << std::endl;
+    return 1;
+  }
+
+  auto failed = std::atomic_bool(false);
+  auto duration = std::chrono::steady_clock::duration();
+  for (auto storm = 0u; storm < storms_count; storm++) {
+    auto usernames = std::vector<std::vector<std::string>>(threads_count);
+    auto threads = std::vector<std::thread>();
+    const auto start = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < threads_count; i++) {
+      threads.emplace_back([&registry, &usernames = usernames[i], &failed] {
+        const auto user = std::make_shared<User>();
+        for (auto j = 0u; j < guests_per_thread; j++) {
+          auto& username = usernames.emplace_back(registry.AddGuest(user));
+          if (registry.Find(username) != user) {
+            failed = true;
+          }
+          // Some guests leave while others are connecting
+          if (j % 4 == 0) {
+            registry.Remove(usernames[j / 2]);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    duration += std::chrono::steady_clock::now() - start;
+    if (failed) {
+      std::cout << "A guest couldn't be found after being added" << std::endl;
+      return 1;
+    }
+
+    auto unique_usernames = std::unordered_set<std::string>();
+    for (auto& thread_usernames : usernames) {
+      for (auto j = 0u; j < thread_usernames.size(); j++) {
+        // Guest j / 2 was removed after every fourth guest j connected
+        const auto removed = j % 2 == 0 && j * 2 < guests_per_thread;
+        if (!removed && !unique_usernames.insert(thread_usernames[j]).second) {
+          std::cout << "Two guests were given " << thread_usernames[j] << std::endl;
+          return 1;
+        }
+      }
+    }
+    if (registry.GetCount() != unique_usernames.size()) {
+      std::cout << "Expected " << unique_usernames.size() << " usernames but found "
+                << registry.GetCount() << std::endl;
+      return 1;
+    }
+    for (const auto& username : unique_usernames) {
+      registry.Remove(username);
+    }
+  }
+
+  // The previous implementation: every connection dispatches to the
+  // strand that guards the map, and a guest's number is probed from a
+  // random number
+  auto baseline_duration = std::chrono::steady_clock::duration();
+  for (auto storm = 0u; storm < storms_count; storm++) {
+    auto io_context = boost::asio::io_context(threads_count);
+    auto guests = StrandGuard<boost::asio::io_context::strand,
+                              std::unordered_map<std::string,
+                                                 std::shared_ptr<User>,
+                                                 CaseInsensitiveHasher,
+                                                 CaseInsensitiveComparator>>(
+      io_context);
+    auto guest_rng = std::uniform_int_distribution<std::uint32_t>(1'000, 99'999);
+    auto rng = std::default_random_engine(std::random_device()());
+    auto usernames = std::vector<std::vector<std::string>>(
+      threads_count, std::vector<std::string>(guests_per_thread));
+    const auto user = std::make_shared<User>();
+    auto found_count = std::size_t(0);
+    for (auto j = 0u; j < guests_per_thread; j++) {
+      for (auto i = 0u; i < threads_count; i++) {
+        boost::asio::post(io_context, [&, i, j] {
+          guests.dispatch([&, i, j](auto& guests) {
+            auto num = guest_rng(rng);
+            auto username = std::string();
+            auto is_username_taken = false;
+            do {
+              if (is_username_taken) {
+                num++;
+              }
+              username = "guest" + std::to_string(num);
+              is_username_taken = !guests.insert({username, user}).second;
+            } while (is_username_taken);
+            usernames[i][j] = std::move(username);
+          });
+          // Finding a guest was also dispatched to the strand
+          guests.dispatch([&, i, j](auto& guests) {
+            found_count += guests.count(usernames[i][j]);
+          });
+          if (j % 4 == 0) {
+            guests.dispatch([&, i, j](auto& guests) {
+              guests.erase(usernames[i][j / 2]);
+            });
+          }
+        });
+      }
+    }
+    auto threads = std::vector<std::thread>();
+    const auto start = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < threads_count; i++) {
+      threads.emplace_back([&io_context] { io_context.run(); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    baseline_duration += std::chrono::steady_clock::now() - start;
+    // A guest may have been removed by another connection before it was found
+    if (!found_count) {
+      std::cout << "No guests were found" << std::endl;
+      return 1;
+    }
+  }
+
+  const auto to_ns = [](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  };
+  const auto connections = double(storms_count) * threads_count * guests_per_thread;
+  std::cout << threads_count << " threads connecting "
+            << threads_count * guests_per_thread << " guests:\n"
+            << "  Strand: " << to_ns(baseline_duration) / connections
+            << " ns per guest\n"
+            << "  Sharded: " << to_ns(duration) / connections
+            << " ns per guest" << std::endl;
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include "CollabVmCommon.hpp"
+#include "VoteController.hpp"
+
+// Simulates a vote on a VM with 1,000 viewers who all vote at random times,
+// and counts the vote status messages that would be sent to the viewers
+// with and without a minimum interval between status updates.
+
+using CollabVm::Server::UserVoteData;
+
+constexpr auto viewers_count = 1'000u;
+constexpr auto vote_time = std::chrono::milliseconds(1'000);
+constexpr auto voting_time = std::chrono::milliseconds(800);
+
+struct TestVm final : CollabVm::Server::VoteController<TestVm> {
+  TestVm(boost::asio::io_context& io_context,
+         std::chrono::milliseconds status_interval)
+    : VoteController(io_context, status_interval) {
+  }
+
+  bool GetVotesEnabled() const {
+    return true;
+  }
+
+  auto GetVoteTime() const {
+    return vote_time;
+  }
+
+  auto GetVoteCooldownTime() const {
+    return std::chrono::seconds(0);
+  }
+
+  void OnVoteStart() {
+  }
+
+  void OnVoteStatusChanged() {
+    status_count++;
+    last_status_vote_count = GetYesVoteCount() + GetNoVoteCount();
+  }
+
+  void OnVoteEnd(bool vote_passed) {
+    final_vote_count = GetYesVoteCount() + GetNoVoteCount();
+  }
+
+  // The server sends the status when the vote becomes idle
+  void OnVoteIdle() {
+    final_status_sent = true;
+  }
+
+  std::uint32_t status_count = 0;
+  std::uint32_t last_status_vote_count = 0;
+  std::uint32_t final_vote_count = 0;
+  bool final_status_sent = false;
+};
+
+struct Result {
+  std::uint32_t status_count;
+  bool last_status_was_current;
+  bool final_status_sent;
+};
+
+Result Simulate(std::chrono::milliseconds status_interval) {
+  auto io_context = boost::asio::io_context();
+  auto vm = TestVm(io_context, status_interval);
+  auto rng = std::default_random_engine(0);
+  auto vote_delay = std::uniform_int_distribution<std::int64_t>(1, voting_time.count());
+  auto votes = std::vector<UserVoteData>(viewers_count);
+  auto timers = std::vector<std::unique_ptr<boost::asio::steady_timer>>();
+  vm.AddVote(votes.front(), true);
+  for (auto i = 1u; i < viewers_count; i++) {
+    auto& timer = timers.emplace_back(
+      std::make_unique<boost::asio::steady_timer>(io_context));
+    timer->expires_after(std::chrono::milliseconds(vote_delay(rng)));
+    timer->async_wait([&vm, &vote = votes[i], i](auto ec) {
+      vm.AddVote(vote, i % 3 != 0);
+    });
+  }
+  io_context.run();
+  return {vm.status_count,
+          vm.last_status_vote_count == vm.final_vote_count,
+          vm.final_status_sent && vm.final_vote_count == viewers_count};
+}
+
+int main() {
+  const auto unthrottled = Simulate(std::chrono::milliseconds(0));
+  const auto throttled = Simulate(std::chrono::milliseconds(100));
+  if (unthrottled.status_count != viewers_count) {
+    std::cout << "Expected a status for each of the " << viewers_count
+              << " votes but there were " << unthrottled.status_count << std::endl;
+    return 1;
+  }
+  if (!throttled.last_status_was_current || !throttled.final_status_sent) {
+    std::cout << "The final vote count wasn't sent" << std::endl;
+    return 1;
+  }
+  // One status at the start and at most one per interval while voting
+  if (throttled.status_count > 2 + voting_time / std::chrono::milliseconds(100)) {
+    std::cout << throttled.status_count << " statuses were sent" << std::endl;
+    return 1;
+  }
+  std::cout << "Vote status messages sent to " << viewers_count << " viewers:\n"
+            << "  Every vote: " << std::uint64_t(unthrottled.status_count) * viewers_count
+            << "\n  Every 100 ms: " << std::uint64_t(throttled.status_count) * viewers_count
+            << std::endl;
+  return 0;
+}